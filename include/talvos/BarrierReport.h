@@ -0,0 +1,100 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file BarrierReport.h
+/// This file declares the BarrierReport class.
+
+#ifndef TALVOS_BARRIERREPORT_H
+#define TALVOS_BARRIERREPORT_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+
+namespace talvos
+{
+
+class Instruction;
+class Module;
+class Workgroup;
+
+/// This class measures the time that the invocations of a workgroup spend
+/// waiting at barriers for the rest of their workgroup.
+///
+/// Each time that a workgroup clears a barrier, the number of instructions
+/// that each invocation executed since the previous barrier (or since the
+/// start of the workgroup) is recorded against the barrier instruction. The
+/// invocation that executed the most instructions arrives last, and every
+/// other invocation is assumed to idle for one cycle for each instruction
+/// that it did not execute. The end of a workgroup is treated as an implicit
+/// barrier, so that imbalance after the last barrier is also reported.
+///
+/// The critical path of a workgroup is the sum of the longest segment between
+/// each pair of consecutive barriers, which is the number of cycles that the
+/// workgroup would take with one instruction per cycle on each lane.
+class BarrierReport
+{
+public:
+  /// The statistics recorded for a single barrier instruction.
+  struct Record
+  {
+    const Module *Mod;        ///< The module containing the barrier.
+    uint64_t Phases;          ///< The number of times it was cleared.
+    uint64_t Arrivals;        ///< The number of invocation arrivals.
+    uint64_t Instructions;    ///< Instructions executed before arriving.
+    uint64_t MinInstructions; ///< Fewest instructions before arriving.
+    uint64_t MaxInstructions; ///< Most instructions before arriving.
+    uint64_t TotalSpread;     ///< Sum of spread between arrivals.
+    uint64_t MaxSpread;       ///< Largest spread between arrivals.
+    uint64_t IdleLaneCycles;  ///< Lane-cycles spent waiting.
+  };
+
+  /// Create a report that lists the \p NumTop barriers with the most idle
+  /// lane-cycles.
+  BarrierReport(unsigned NumTop);
+
+  // Do not allow BarrierReport objects to be copied.
+  ///\{
+  BarrierReport(const BarrierReport &) = delete;
+  BarrierReport &operator=(const BarrierReport &) = delete;
+  ///\}
+
+  /// Record the invocations of \p Group arriving at a barrier.
+  void barrier(const Workgroup &Group);
+
+  /// Record the completion of \p Group.
+  void complete(const Workgroup &Group);
+
+  /// Returns the records of each barrier, keyed by the barrier instruction.
+  /// The end of a workgroup is recorded with a null instruction.
+  const std::map<const Instruction *, Record> &getRecords() const
+  {
+    return Records;
+  }
+
+  /// Print the report for the current dispatch to \p O and discard it.
+  void print(std::ostream &O);
+
+private:
+  /// Record the current segment of each invocation in \p Group against the
+  /// barrier \p Inst.
+  void recordSegment(const Workgroup &Group, const Instruction *Inst);
+
+  unsigned NumTop; ///< The number of barriers to list.
+
+  /// The statistics recorded for each barrier instruction.
+  std::map<const Instruction *, Record> Records;
+
+  /// The critical path of each running workgroup so far.
+  std::map<const Workgroup *, uint64_t> RunningGroups;
+
+  uint64_t NumGroups;       ///< The number of completed workgroups.
+  uint64_t CriticalPath;    ///< Sum of critical paths of completed groups.
+  uint64_t MaxCriticalPath; ///< The longest critical path of any group.
+};
+
+} // namespace talvos
+
+#endif
@@ -11,6 +11,7 @@
 
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 namespace talvos
 {
@@ -38,6 +39,12 @@ public:
   /// Returns the label instruction for this block.
   Instruction &getLabel() const { return *Label.get(); }
 
+  /// Returns the IDs of the blocks that this block may branch to.
+  std::vector<uint32_t> getSuccessors() const;
+
+  /// Returns the last instruction in this block, or nullptr if it is empty.
+  const Instruction *getTerminator() const;
+
 private:
   uint32_t Id; ///< The unique ID of the block.
 
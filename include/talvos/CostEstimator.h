@@ -0,0 +1,132 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file CostEstimator.h
+/// This file declares the CostEstimator class.
+
+#ifndef TALVOS_COSTESTIMATOR_H
+#define TALVOS_COSTESTIMATOR_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace talvos
+{
+
+class Function;
+class Instruction;
+class Module;
+class Object;
+class PipelineStage;
+class TimingModel;
+
+/// This class statically estimates the cost of a compute shader, without
+/// executing it.
+///
+/// Each instruction is assigned a cost in cycles from the latencies of a
+/// TimingModel: the latency of its instruction class, plus the latency of the
+/// storage class accessed by loads, stores and atomics. A function call also
+/// costs the estimated cost of the callee.
+///
+/// The number of times each block executes is estimated by propagating
+/// execution frequencies through the control flow graph of each function,
+/// assuming that the targets of a branch are equally likely. The header of
+/// each structured loop executes once per iteration. The number of iterations
+/// is computed from the loop's induction variable when its initial value, step
+/// and exit condition bound are constants (including specialization
+/// constants), and is otherwise assumed to be TALVOS_COST_LOOP_TRIPS
+/// (default 16).
+class CostEstimator
+{
+public:
+  /// The estimated cost of a block.
+  struct BlockCost
+  {
+    const Function *Func; ///< The function containing the block.
+    uint32_t Id;          ///< The ID of the block.
+    double Frequency;     ///< Executions per call of the function.
+    uint64_t Cost;        ///< Cycles for each execution of the block.
+  };
+
+  /// The number of iterations assigned to a loop.
+  struct LoopTrips
+  {
+    const Function *Func; ///< The function containing the loop.
+    uint32_t Header;      ///< The ID of the loop header block.
+    uint64_t Trips;       ///< Executions of the header per entry to the loop.
+    bool Known;           ///< True if the trip count was computed.
+  };
+
+  /// Estimate the cost of the entry point of \p Stage, using the latencies of
+  /// \p Model.
+  CostEstimator(const PipelineStage &Stage, const TimingModel &Model);
+
+  // Do not allow CostEstimator objects to be copied.
+  ///\{
+  CostEstimator(const CostEstimator &) = delete;
+  CostEstimator &operator=(const CostEstimator &) = delete;
+  ///\}
+
+  /// Returns the estimated cost of each block in each function reached from
+  /// the entry point.
+  const std::vector<BlockCost> &getBlocks() const { return Blocks; }
+
+  /// Returns the estimated cost of a single invocation in cycles.
+  double getInvocationCost() const { return InvocationCost; }
+
+  /// Returns the trip counts assigned to each loop.
+  const std::vector<LoopTrips> &getLoops() const { return Loops; }
+
+  /// Print a summary of the estimate to \p O, for a dispatch of
+  /// \p NumInvocations invocations.
+  void print(std::ostream &O, uint64_t NumInvocations) const;
+
+private:
+  /// Structural information about a loop.
+  struct Loop;
+
+  /// Returns the estimated cost of a single call to \p F.
+  double analyzeFunction(const Function *F);
+
+  /// Returns the number of header executions per entry to \p L, or 0 if it
+  /// cannot be computed.
+  uint64_t computeTrips(const Loop &L) const;
+
+  /// Get the value of the integer constant \p Id.
+  /// Returns false if \p Id is not an integer constant.
+  bool getConstant(uint32_t Id, uint64_t &Value) const;
+
+  /// Returns the cost of \p Inst in cycles, excluding the cost of any callee.
+  uint64_t getInstructionCost(const Instruction *Inst) const;
+
+  /// Returns the latency of the storage class of pointer \p Id.
+  uint64_t getMemoryLatency(uint32_t Id) const;
+
+  const Module &Mod;                  ///< The module being analyzed.
+  const std::vector<Object> &Objects; ///< The specialized result objects.
+  const TimingModel &Model;           ///< The source of latencies.
+  const PipelineStage &Stage;         ///< The pipeline stage being analyzed.
+  uint64_t DefaultTrips; ///< Trip count assumed for unknown loops.
+
+  /// The instruction that defines each result ID in the functions analyzed.
+  std::map<uint32_t, const Instruction *> Defs;
+
+  /// The storage class of each pointer result ID.
+  std::map<uint32_t, uint32_t> StorageClasses;
+
+  /// The estimated cost of each function analyzed, or of those in progress.
+  std::map<const Function *, double> FunctionCosts;
+
+  std::vector<BlockCost> Blocks; ///< The cost of each block.
+  std::vector<LoopTrips> Loops;  ///< The trip count of each loop.
+  double InvocationCost;         ///< The cost of a single invocation.
+};
+
+} // namespace talvos
+
+#endif
@@ -9,6 +9,7 @@
 #ifndef TALVOS_DEVICE_H
 #define TALVOS_DEVICE_H
 
+#include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <memory>
@@ -22,9 +23,15 @@ class Command;
 class Instruction;
 class Invocation;
 class Memory;
+class PerformanceCounters;
 class PipelineExecutor;
+class PipelineStageCache;
 class Plugin;
+class Roofline;
+class SamplingProfiler;
+class TimingModel;
 class Workgroup;
+class WorkgroupSampler;
 
 /// A Device instance encapsulates properties and state for the virtual device.
 class Device
@@ -44,12 +51,33 @@ public:
   Device &operator=(const Device &) = delete;
   ///\}
 
+  /// Returns the number of errors reported on this device.
+  size_t getNumErrors() const { return NumErrors; }
+
+  /// Returns the performance counters for this device.
+  PerformanceCounters &getCounters() const { return *Counters; }
+
   /// Get the global memory instance associated with this device.
   Memory &getGlobalMemory() { return *GlobalMemory; }
 
   /// Returns the PipelineExecutor for this device.
   PipelineExecutor &getPipelineExecutor() { return *Executor; }
 
+  /// Returns the cache of specialized pipeline stages for this device.
+  PipelineStageCache &getPipelineStageCache() const { return *StageCache; }
+
+  /// Returns the roofline model, or nullptr if it is disabled.
+  Roofline *getRoofline() const { return RooflineModel; }
+
+  /// Returns the sampling profiler, or nullptr if sampling is disabled.
+  SamplingProfiler *getProfiler() const { return Profiler; }
+
+  /// Returns the timing model, or nullptr if timing is not being modeled.
+  TimingModel *getTimingModel() const { return Timing; }
+
+  /// Returns the workgroup sampler, or nullptr if every workgroup is executed.
+  WorkgroupSampler *getWorkgroupSampler() const { return Sampler; }
+
   /// Returns true if all of the loaded plugins are thread-safe.
   bool isThreadSafe() const;
 
@@ -109,6 +137,28 @@ private:
   /// Condition variable to notify threads waiting on fence signals.
   mutable std::condition_variable FenceSignaled;
 
+  /// The sampling profiler, if enabled with TALVOS_PROFILE_INTERVAL.
+  SamplingProfiler *Profiler;
+
+  /// The performance counters for this device.
+  PerformanceCounters *Counters;
+
+  /// The timing model, if enabled with TALVOS_DEVICE_FILE.
+  TimingModel *Timing;
+
+  /// The roofline model, if enabled with TALVOS_ROOFLINE.
+  Roofline *RooflineModel;
+
+  /// The workgroup sampler, if enabled with TALVOS_SAMPLE_GROUPS or
+  /// TALVOS_SAMPLE_FRACTION.
+  WorkgroupSampler *Sampler;
+
+  /// The cache of specialized pipeline stages.
+  PipelineStageCache *StageCache;
+
+  /// The number of errors reported on this device.
+  std::atomic<size_t> NumErrors;
+
 #ifdef __EMSCRIPTEN__
   class StaticABI;
 #endif
@@ -119,7 +169,7 @@ private:
 #pragma clang diagnostic ignored "-Winvalid-offsetof"
 class Device::StaticABI
 {
-  static_assert(sizeof(talvos::Device) == 112);
+  static_assert(sizeof(talvos::Device) == 144);
   static_assert(offsetof(talvos::Device, GlobalMemory) == 16);
   static_assert(offsetof(talvos::Device, Executor) == 32);
 };
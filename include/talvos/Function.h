@@ -23,6 +23,9 @@ class Type;
 class Function
 {
 public:
+  /// A mapping from IDs to Blocks.
+  typedef std::map<uint32_t, std::unique_ptr<Block>> BlockMap;
+
   /// Create a new function with an ID and a type.
   Function(uint32_t Id, const Type *FunctionType);
 
@@ -41,6 +44,9 @@ public:
   /// Returns the block with ID \p Id.
   const Block *getBlock(uint32_t Id) const { return Blocks.at(Id).get(); }
 
+  /// Returns the blocks in this function.
+  const BlockMap &getBlocks() const { return Blocks; }
+
   /// Returns the first block in this function.
   const Block *getFirstBlock() const { return Blocks.at(FirstBlockId).get(); }
 
@@ -56,19 +62,41 @@ public:
   /// Returns the number of parameters in this function.
   size_t getNumParams() const { return Parameters.size(); }
 
+  /// Returns the instructions recorded for this function when it was parsed.
+  const std::vector<uint32_t> &getRecordedInstructions() const
+  {
+    return RecordedInstructions;
+  }
+
+  /// Returns true if the blocks of this function have been built.
+  bool isMaterialized() const { return Materialized; }
+
   /// Sets the ID of the entry block in this function.
   void setFirstBlock(uint32_t Id) { FirstBlockId = Id; }
 
-private:
-  /// A mapping from IDs to Blocks.
-  typedef std::map<uint32_t, std::unique_ptr<Block>> BlockMap;
+  /// Mark the blocks of this function as built.
+  void setMaterialized() { Materialized = true; }
+
+  /// Set the recorded instructions that the blocks of this function will be
+  /// built from when it is first used.
+  void setRecordedInstructions(std::vector<uint32_t> Words)
+  {
+    RecordedInstructions = std::move(Words);
+  }
 
+private:
   uint32_t Id;              ///< The ID of this function.
   const Type *FunctionType; ///< The function type.
   uint32_t FirstBlockId;    ///< The ID of the first block.
   BlockMap Blocks;          ///< The blocks in the function.
 
   std::vector<uint32_t> Parameters; ///< The function parameter IDs.
+
+  /// The instructions recorded when parsing the function, with calls to small
+  /// functions inlined when the module is loaded if TALVOS_INLINE is set.
+  std::vector<uint32_t> RecordedInstructions;
+
+  bool Materialized; ///< True when the blocks have been built.
 };
 
 } // namespace talvos
@@ -10,6 +10,7 @@
 #define TALVOS_GRAPHICSPIPELINE_H
 
 #include <array>
+#include <memory>
 #include <vector>
 
 #include "vulkan/vulkan_core.h"
@@ -36,10 +37,11 @@ class GraphicsPipeline
 {
 public:
   /// Create a graphics pipeline.
-  /// Ownership of any non-null stages is transferred to the pipeline.
+  /// Either stage may be null.
   GraphicsPipeline(
-      VkPrimitiveTopology Topology, PipelineStage *VertexStage,
-      PipelineStage *FragmentStage,
+      VkPrimitiveTopology Topology,
+      std::shared_ptr<const PipelineStage> VertexStage,
+      std::shared_ptr<const PipelineStage> FragmentStage,
       const VertexBindingDescriptionList &VertexBindingDescriptions,
       const VertexAttributeDescriptionList &VertexAttributeDescriptions,
       const VkPipelineRasterizationStateCreateInfo &RasterizationState,
@@ -56,9 +58,6 @@ public:
         BlendConstants(BlendConstants), Viewports(Viewports),
         Scissors(Scissors){};
 
-  /// Destroy the pipeline.
-  ~GraphicsPipeline();
-
   // Do not allow GraphicsPipeline objects to be copied.
   ///\{
   GraphicsPipeline(const GraphicsPipeline &) = delete;
@@ -78,7 +77,10 @@ public:
   }
 
   /// Returns the fragment pipeline stage.
-  const PipelineStage *getFragmentStage() const { return FragmentStage; }
+  const PipelineStage *getFragmentStage() const
+  {
+    return FragmentStage.get();
+  }
 
   /// Returns the rasterization state used by this pipeline.
   const VkPipelineRasterizationStateCreateInfo &getRasterizationState() const
@@ -93,7 +95,7 @@ public:
   VkPrimitiveTopology getTopology() const { return Topology; }
 
   /// Returns the vertex pipeline stage.
-  const PipelineStage *getVertexStage() const { return VertexStage; }
+  const PipelineStage *getVertexStage() const { return VertexStage.get(); }
 
   /// Returns the list of vertex attribute descriptions.
   const VertexAttributeDescriptionList &getVertexAttributeDescriptions() const
@@ -115,10 +117,10 @@ private:
   VkPrimitiveTopology Topology;
 
   /// The vertex pipeline stage in this pipeline.
-  PipelineStage *VertexStage;
+  std::shared_ptr<const PipelineStage> VertexStage;
 
   /// The fragment pipeline stage in this pipeline.
-  PipelineStage *FragmentStage;
+  std::shared_ptr<const PipelineStage> FragmentStage;
 
   /// The vertex binding descriptions.
   VertexBindingDescriptionList VertexBindingDescriptions;
@@ -9,6 +9,7 @@
 #ifndef TALVOS_INVOCATION_H
 #define TALVOS_INVOCATION_H
 
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -25,6 +26,7 @@ class Memory;
 class Module;
 class PipelineStage;
 class Workgroup;
+struct CompiledBlock;
 
 /// This class represents a single execution of a SPIR-V entry point.
 ///
@@ -66,11 +68,36 @@ public:
   ///\}
 
   /// Clear the barrier state, allowing the invocation to continue.
-  void clearBarrier() { AtBarrier = false; }
+  void clearBarrier()
+  {
+    AtBarrier = false;
+    InstructionsSinceBarrier = 0;
+  }
+
+  /// Returns a handler that executes \p Inst with its operands resolved in
+  /// advance. Operands that are non-null in \p Constants are folded into the
+  /// handler. Instructions without a specialized handler are dispatched to
+  /// execute().
+  static std::function<void(Invocation &)>
+  compile(const Instruction *Inst, const std::vector<Object> &Constants);
 
   /// Execute \p Inst in this invocation.
   void execute(const Instruction *Inst);
 
+  /// Returns the most recent barrier instruction executed by this invocation,
+  /// or nullptr if it has not executed a barrier.
+  const Instruction *getBarrier() const { return LastBarrier; }
+
+  /// Returns the number of frames on the function call stack.
+  size_t getCallDepth() const { return CallStack.size(); }
+
+  /// Returns the OpFunctionCall instruction for call stack frame \p Index,
+  /// where frame 0 is the outermost call.
+  const Instruction *getCallSite(size_t Index) const
+  {
+    return CallStack[Index].CallInst;
+  }
+
   /// Returns the instruction that this invocation is executing.
   const Instruction *getCurrentInstruction() const
   {
@@ -80,6 +107,17 @@ public:
   /// Returns the global invocation ID.
   Dim3 getGlobalId() const { return GlobalId; }
 
+  /// Returns the number of instructions executed since the last barrier was
+  /// cleared, including the barrier instruction that this invocation is
+  /// waiting at (if any).
+  uint64_t getInstructionsSinceBarrier() const
+  {
+    return InstructionsSinceBarrier;
+  }
+
+  /// Returns the module containing the current instruction.
+  std::shared_ptr<const Module> getModule() const { return CurrentModule; }
+
   /// Returns the object with the specified ID.
   /// Returns a null object if no object with this ID has been defined.
   Object getObject(uint32_t Id) const;
@@ -202,13 +240,23 @@ private:
   /// The current module.
   std::shared_ptr<const Module> CurrentModule;
 
+  /// The pipeline stage being executed, or nullptr for a standalone
+  /// invocation.
+  const PipelineStage *CurrentStage;
+
   const Function *CurrentFunction;       ///< The current function.
   const Instruction *CurrentInstruction; ///< The current instruction.
   uint32_t CurrentBlock;                 ///< The current block.
   uint32_t PreviousBlock;                ///< The previous block (for OpPhi).
   bool AtBarrier;                        ///< True when at a barrier.
+  const Instruction *LastBarrier;        ///< The last barrier executed.
+  uint64_t InstructionsSinceBarrier;     ///< Instructions since a barrier.
   bool Discarded;                        ///< True when fragment was discarded.
 
+  /// The compiled form of the current block, or nullptr when interpreting.
+  const CompiledBlock *Compiled;
+  size_t CompiledIndex; ///< The index of the next instruction in Compiled.
+
   /// A data structure holding information for a function call.
   struct StackEntry
   {
@@ -217,12 +265,16 @@ private:
     const Function *CallFunc;    ///< The function containing \p CallInst.
     uint32_t CallBlock;          ///< The block containing \p CallInst.
 
-    /// Function scope allocations within this stack frame.
-    std::vector<uint64_t> Allocations;
+    /// The index of the first function scope allocation of this stack frame
+    /// in FunctionAllocations.
+    size_t FirstAllocation;
   };
 
   std::vector<StackEntry> CallStack; ///< The function call stack.
 
+  /// Function scope allocations of every stack frame, innermost last.
+  std::vector<uint64_t> FunctionAllocations;
+
   std::vector<Object> Objects; ///< Set of result objects.
 
   Device &Dev;           ///< The device this invocation is executing on.
@@ -253,6 +305,43 @@ private:
   void executeOpUInt(const Instruction *Inst, const F &&Op);
   ///@}
 
+  /// Helper functions to execute shift instructions, whose shift operand may
+  /// have a different width to the base operand and result.
+  /// \p BaseTy is the C++ scalar type of the base operand.
+  /// \p Signed selects a signed or unsigned type for the base operand.
+  /// \p Op is a lambda that takes a base value and a shift amount.
+  ///@{
+  template <typename BaseTy, typename F>
+  void executeShift(const Instruction *Inst, const F &Op);
+  template <bool Signed, typename F>
+  void executeShiftInt(const Instruction *Inst, const F &&Op);
+  ///@}
+
+  /// Helper functions to compile simple binary instructions whose operands
+  /// have the same type as their result.
+  /// Each returns an empty handler if the result type is not supported.
+  /// \p OpTy is the C++ scalar type of each operand.
+  /// \p Width is the number of vector components.
+  /// \p Op is a lambda that takes two operand values and returns a result.
+  ///@{
+  template <typename OpTy, unsigned Width, typename F>
+  static std::function<void(Invocation &)>
+  compileKernel(const Instruction *Inst, const std::vector<Object> &Constants,
+                const F &Op);
+  template <typename OpTy, typename F>
+  static std::function<void(Invocation &)>
+  compileOp(const Instruction *Inst, const std::vector<Object> &Constants,
+            const F &Op);
+  template <typename F>
+  static std::function<void(Invocation &)>
+  compileOpFP(const Instruction *Inst, const std::vector<Object> &Constants,
+              const F &Op);
+  template <typename F>
+  static std::function<void(Invocation &)>
+  compileOpUInt(const Instruction *Inst, const std::vector<Object> &Constants,
+                const F &Op);
+  ///@}
+
   /// Returns the memory instance associated with \p StorageClass.
   Memory &getMemory(uint32_t StorageClass);
 
@@ -64,6 +64,9 @@ public:
                          uint32_t EqualSemantics, uint32_t UnequalSemantics,
                          uint32_t Value, uint32_t Comparator);
 
+  /// Returns the base address of the allocation that contains \p Address.
+  static uint64_t getBaseAddress(uint64_t Address);
+
   /// Dump the entire contents of this memory to stdout.
   void dump() const;
 
@@ -10,10 +10,13 @@
 #define TALVOS_MODULE_H
 
 #include <cstdint>
+#include <iosfwd>
 #include <map>
 #include <memory>
+#include <shared_mutex>
 #include <spirv-tools/libspirv.hpp>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "talvos/Dim3.h"
@@ -32,6 +35,14 @@ class Variable;
 /// A list of module scope variables.
 typedef std::vector<const Variable *> VariableList;
 
+/// A source location recorded from an OpLine instruction.
+struct SourceLocation
+{
+  uint32_t File;   ///< Result ID of the OpString naming the source file.
+  uint32_t Line;   ///< Line number.
+  uint32_t Column; ///< Column number.
+};
+
 /// This class represents a SPIR-V module.
 ///
 /// This class contains types, functions, global variables, and constant
@@ -65,9 +76,18 @@ public:
 
   void addGlobalSize(uint32_t Entry, Dim3 GlobalSize);
 
+  /// Add an extended instruction set import (from OpExtInstImport).
+  void addExtInstSet(uint32_t Id, const std::string &Name);
+
   /// Add an object to this module.
   void addObject(uint32_t Id, const Object &Obj);
 
+  /// Add a debug string (from OpString) to this module.
+  void addDebugString(uint32_t Id, const std::string &Str);
+
+  /// Associate a source location with an instruction in this module.
+  void addSourceLocation(const Instruction *Inst, const SourceLocation &Loc);
+
   /// Add a specialization constant ID mapping.
   void addSpecConstant(uint32_t SpecId, uint32_t ResultId);
 
@@ -76,11 +96,25 @@ public:
   void addSpecConstantOp(Instruction *Op);
 
   /// Add a type to this module.
+  /// The type is replaced by the canonical instance of an identical type if
+  /// one already exists (see Type::intern).
   void addType(uint32_t Id, std::unique_ptr<Type> Ty);
 
   /// Add a variable to this module, transferring ownership to the module.
   void addVariable(Variable *Var) { Variables.push_back(Var); }
 
+  /// Returns the debug string with the specified ID.
+  /// Returns an empty string if no OpString with this ID is present.
+  const std::string &getDebugString(uint32_t Id) const;
+
+  /// Returns the name of the extended instruction set imported as \p Id.
+  /// Returns an empty string if no OpExtInstImport with this ID is present.
+  const std::string &getExtInstSet(uint32_t Id) const;
+
+  /// Returns the ID of the GLSL.std.450 extended instruction set import, or 0
+  /// if this module does not import it.
+  uint32_t getGLSLExtInstSet() const { return GLSLExtInstSet; }
+
   /// Get the entry point with the specified name and SPIR-V execution model.
   /// Returns nullptr if no entry point called \p Name with a matching execution
   /// model is found.
@@ -108,6 +142,17 @@ public:
   /// Returns a list of all result objects in this module.
   const std::vector<Object> &getObjects() const;
 
+  /// Returns the source location of \p Inst.
+  /// Returns nullptr if no OpLine instruction applies to \p Inst.
+  const SourceLocation *getSourceLocation(const Instruction *Inst) const;
+
+  /// Returns true if any instructions have an associated source location.
+  bool hasSourceLocations() const;
+
+  /// Print the source location of \p Inst to \p O as "file:line:column".
+  /// Returns false (and prints nothing) if \p Inst has no source location.
+  bool printSourceLocation(std::ostream &O, const Instruction *Inst) const;
+
   /// Returns the result ID for the given specialization constant ID.
   /// Returns 0 if no specialization constants with this ID are present.
   uint32_t getSpecConstant(uint32_t SpecId) const;
@@ -131,22 +176,63 @@ public:
   /// Set the ID of the object decorated with WorkgroupSize.
   void setWorkgroupSizeId(uint32_t Id) { WorkgroupSizeId = Id; }
 
+  /// Options that control how a module is loaded from its source.
+  struct LoadOptions
+  {
+    /// SPIRV-Tools optimizer passes to run on the binary before the module is
+    /// built, as spirv-opt flags (e.g. "--ccp").
+    /// The module is not optimized if this is empty.
+    std::vector<std::string> OptimizerPasses;
+
+    /// Returns the options selected by the TALVOS_OPTIMIZE environment
+    /// variable.
+    static LoadOptions getDefault();
+
+    /// Set the optimizer passes from \p Spec, which is "0" to disable the
+    /// optimizer, "1" to select the default passes, or a comma-separated list
+    /// of spirv-opt flags (the leading dashes are optional).
+    /// Returns false if \p Spec is not valid.
+    bool setOptimizerPasses(const std::string &Spec);
+  };
+
+  /// Build the blocks of every function reachable from \p EP.
+  ///
+  /// Function bodies are recorded when a module is loaded, but are only built
+  /// when a pipeline stage first uses an entry point that reaches them, so
+  /// that loading a module with many entry points does not pay for functions
+  /// that are never executed. This may be called while other entry points of
+  /// the same module are executing on different threads.
+  void materialize(const EntryPoint *EP) const;
+
   /// Create a new module from the supplied SPIR-V binary data.
   /// Returns nullptr on failure.
   static std::shared_ptr<Module> load(spvtools::Context &SPVContext,
                                       const uint32_t *Words, size_t NumWords);
 
-  /// Create a new module from the given SPIR-V binary filename.
+  /// Create a new module from the supplied SPIR-V binary or assembly.
+  /// If TALVOS_MODULE_CACHE names a directory, the assembled and validated
+  /// binary is cached there and reused when the same source is loaded again.
   /// Returns nullptr on failure.
-  static std::shared_ptr<Module> load(const std::vector<uint8_t> &Bytes);
+  static std::shared_ptr<Module>
+  load(const std::vector<uint8_t> &Bytes,
+       const LoadOptions &Options = LoadOptions::getDefault());
 
   /// Create a new module from the given SPIR-V binary filename.
   /// Returns nullptr on failure.
-  static std::shared_ptr<Module> load(const std::string &FileName);
+  static std::shared_ptr<Module>
+  load(const std::string &FileName,
+       const LoadOptions &Options = LoadOptions::getDefault());
+
+  /// Create a module from each of the given SPIR-V binary or assembly files,
+  /// loading them in parallel. The result holds the module for each file in
+  /// the same order, or nullptr for any file that failed to load.
+  static std::vector<std::shared_ptr<Module>>
+  loadAll(const std::vector<std::string> &FileNames,
+          const LoadOptions &Options = LoadOptions::getDefault());
 
 public:
-  /// Map from SPIR-V result ID to talvos::Type.
-  typedef std::map<uint32_t, std::unique_ptr<Type>> TypeMap;
+  /// Map from SPIR-V result ID to interned talvos::Type.
+  typedef std::map<uint32_t, const Type *> TypeMap;
 
   /// Map from SPIR-V result ID to talvos::Function.
   typedef std::map<uint32_t, std::unique_ptr<Function>> FunctionMap;
@@ -172,6 +258,23 @@ public:
   /// Module scope variables.
   VariableList Variables;
 
+  /// Debug strings from OpString instructions, keyed by result ID.
+  std::map<uint32_t, std::string> DebugStrings;
+
+  /// Extended instruction set names from OpExtInstImport, keyed by result ID.
+  std::map<uint32_t, std::string> ExtInstSets;
+
+  /// The ID of the GLSL.std.450 extended instruction set import.
+  uint32_t GLSLExtInstSet;
+
+  /// Source locations from OpLine instructions, keyed by instruction.
+  /// Kept out of line so that Instruction objects do not grow.
+  std::unordered_map<const Instruction *, SourceLocation> SourceLocations;
+
+  /// Guards SourceLocations, which grows as function bodies are built while
+  /// other threads may be reporting the locations of executing instructions.
+  mutable std::shared_mutex SourceLocationMutex;
+
   /// Module scoped buffers: a SharedBuffer-like storage class that's allocated
   /// and managed by the Talvos runtime.
   ///
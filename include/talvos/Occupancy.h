@@ -0,0 +1,98 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file Occupancy.h
+/// This file declares the Occupancy class.
+
+#ifndef TALVOS_OCCUPANCY_H
+#define TALVOS_OCCUPANCY_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+
+namespace talvos
+{
+
+class Function;
+class Module;
+class PipelineStage;
+
+/// This class models how many workgroups of a compute shader can be resident
+/// on a core at once.
+///
+/// The resources used by each workgroup are estimated from the module: the
+/// number of 32-bit registers per invocation is the maximum number of values
+/// that are simultaneously live in the entry point (including any functions it
+/// calls), and the workgroup memory is the total size of the Workgroup storage
+/// class variables that they use. These are compared against the per-core
+/// limits of the device to find the resource that limits occupancy.
+class Occupancy
+{
+public:
+  /// The resources available on each core.
+  struct Limits
+  {
+    uint64_t Registers;       ///< Number of 32-bit registers.
+    uint64_t WorkgroupMemory; ///< Bytes of workgroup memory.
+    uint64_t Invocations;     ///< Number of resident invocations.
+    uint64_t Workgroups;      ///< Number of resident workgroups.
+  };
+
+  /// The resource that limits the number of resident workgroups.
+  enum Limiter
+  {
+    REGISTERS,
+    WORKGROUP_MEMORY,
+    INVOCATIONS,
+    WORKGROUPS,
+    LANES,
+  };
+
+  /// Compute the occupancy of \p Stage on a core with resources \p L and
+  /// \p Lanes scheduler lanes.
+  Occupancy(const PipelineStage &Stage, const Limits &L, uint64_t Lanes);
+
+  /// Returns the number of workgroups that can be resident on each core.
+  uint64_t getGroupsPerCore() const { return GroupsPerCore; }
+
+  /// Returns the resource that limits the number of resident workgroups.
+  Limiter getLimiter() const { return Limit; }
+
+  /// Returns the estimated number of registers used by each invocation.
+  uint32_t getRegisters() const { return Registers; }
+
+  /// Returns the fraction of resident invocation slots that are occupied when
+  /// each core holds getGroupsPerCore() workgroups.
+  double getTheoretical() const;
+
+  /// Returns the number of bytes of workgroup memory used by each workgroup.
+  uint64_t getWorkgroupMemory() const { return WorkgroupMemory; }
+
+  /// Print a summary of the occupancy to \p O, given that an average of
+  /// \p ResidentGroups workgroups were resident on each core.
+  void print(std::ostream &O, double ResidentGroups) const;
+
+  /// Estimate the number of registers needed by function \p F in module \p M,
+  /// including the functions that it calls.
+  static uint32_t estimateRegisters(const Module &M, const Function *F);
+
+private:
+  /// Estimate the registers needed by \p F, memoizing results in \p Pressure.
+  static uint32_t
+  estimateRegisters(const Module &M, const Function *F,
+                    std::map<const Function *, uint32_t> &Pressure);
+
+  Limits Resources;          ///< The resources available on each core.
+  uint32_t Registers;        ///< Registers used per invocation.
+  uint64_t WorkgroupMemory;  ///< Workgroup memory used per workgroup.
+  uint64_t GroupInvocations; ///< Invocations per workgroup.
+  uint64_t GroupsPerCore;    ///< Resident workgroups per core.
+  Limiter Limit;             ///< The limiting resource.
+};
+
+} // namespace talvos
+
+#endif
@@ -0,0 +1,156 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file PerformanceCounters.h
+/// This file declares the PerformanceCounters class.
+
+#ifndef TALVOS_PERFORMANCECOUNTERS_H
+#define TALVOS_PERFORMANCECOUNTERS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace talvos
+{
+
+enum class MemoryScope;
+
+/// This class holds a set of device performance counters.
+///
+/// Counters are accumulated into per-thread slots, each padded to a cache line
+/// to avoid false sharing. Each slot is only written by its owning thread, so
+/// increments do not require atomic read-modify-write operations. Reading a
+/// counter sums the values across all slots, and can be done at any time.
+class PerformanceCounters
+{
+public:
+  /// Identifies an individual counter.
+  enum Counter
+  {
+    INSTRUCTIONS_ARITHMETIC,
+    INSTRUCTIONS_MEMORY,
+    INSTRUCTIONS_CONTROL_FLOW,
+    INSTRUCTIONS_ATOMIC,
+    INSTRUCTIONS_BARRIER,
+    INSTRUCTIONS_IMAGE,
+    INSTRUCTIONS_OTHER,
+    FLOPS,
+    BYTES_LOADED_DEVICE,
+    BYTES_LOADED_WORKGROUP,
+    BYTES_LOADED_INVOCATION,
+    BYTES_STORED_DEVICE,
+    BYTES_STORED_WORKGROUP,
+    BYTES_STORED_INVOCATION,
+    ATOMICS,
+    BARRIERS,
+    WORKGROUPS,
+    INVOCATIONS,
+    ALLOCATIONS,
+    MODELED_CYCLES,
+    COMPILED_BLOCKS,
+    NUM_COUNTERS
+  };
+
+  /// A snapshot of the values of every counter.
+  typedef std::array<uint64_t, NUM_COUNTERS> Values;
+
+  /// Create a set of counters, all initialized to zero.
+  PerformanceCounters();
+
+  // Do not allow PerformanceCounters objects to be copied.
+  ///\{
+  PerformanceCounters(const PerformanceCounters &) = delete;
+  PerformanceCounters &operator=(const PerformanceCounters &) = delete;
+  ///\}
+
+  /// Add \p N to counter \p C for the calling thread.
+  void add(Counter C, uint64_t N = 1)
+  {
+    std::atomic<uint64_t> &V = getSlot().Values[C];
+    V.store(V.load(std::memory_order_relaxed) + N, std::memory_order_relaxed);
+  }
+
+  /// Add \p NumBytes to the bytes loaded counter for \p Scope.
+  void addBytesLoaded(MemoryScope Scope, uint64_t NumBytes);
+
+  /// Add \p NumBytes to the bytes stored counter for \p Scope.
+  void addBytesStored(MemoryScope Scope, uint64_t NumBytes);
+
+  /// Increment the instruction counter for the class of \p Opcode.
+  void addInstruction(uint16_t Opcode) { add(getInstructionClass(Opcode)); }
+
+  /// Returns the current value of counter \p C.
+  uint64_t get(Counter C) const;
+
+  /// Returns the current values of all counters.
+  Values getAll() const;
+
+  /// Returns the instruction counter used for \p Opcode.
+  static Counter getInstructionClass(uint16_t Opcode);
+
+  /// Returns the name of counter \p C.
+  static const char *getName(Counter C);
+
+  /// Print the current value of every counter to \p O.
+  void print(std::ostream &O) const;
+
+  /// Fold the calling thread's counts into the totals and free its slot.
+  /// Threads that stop using these counters should call this before exiting.
+  void releaseThread();
+
+  /// Reset all counters to zero.
+  /// This should only be called when no commands are executing.
+  void reset();
+
+private:
+  /// The counter values for a single thread.
+  struct alignas(64) Slot
+  {
+    std::atomic<uint64_t> Values[NUM_COUNTERS];
+  };
+
+  /// Returns the slot for the calling thread, creating it if necessary.
+  Slot &getSlot()
+  {
+    if (CachedSlot.Owner != Id)
+      registerThread();
+    return *CachedSlot.S;
+  }
+
+  /// Create a slot for the calling thread and update its slot cache.
+  void registerThread();
+
+  /// Unique identifier for this set of counters.
+  const uint64_t Id;
+
+  /// List of per-thread slots, with the ID of the thread that owns each.
+  std::vector<std::pair<std::thread::id, std::unique_ptr<Slot>>> Slots;
+
+  /// Counts from threads whose slots have been released.
+  Values Released;
+
+  /// Mutex guarding Slots and Released while threads are registered or
+  /// released, or counters are read.
+  mutable std::mutex SlotsMutex;
+
+  /// Per-thread cache of the slot belonging to the most recently used counters.
+  struct SlotCache
+  {
+    uint64_t Owner; ///< The Id of the counters that owns the slot.
+    Slot *S;        ///< The slot.
+  };
+  static thread_local SlotCache CachedSlot;
+};
+
+} // namespace talvos
+
+#endif
@@ -15,6 +15,7 @@
 #include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
 #include <optional>
 #include <queue>
 #include <thread>
@@ -27,6 +28,7 @@
 namespace talvos
 {
 
+class BarrierReport;
 class Command;
 class Device;
 class DispatchCommand;
@@ -40,6 +42,7 @@ class RenderPassInstance;
 class Type;
 class Variable;
 class Workgroup;
+class WorkgroupReport;
 
 /// Only allow Device objects to create PipelineExecutor instances.
 class PipelineExecutorKey
@@ -90,6 +93,9 @@ public:
   /// Returns the pipeline stage that is currently being executed.
   const PipelineStage &getCurrentStage() const { return *CurrentStage; }
 
+  /// Returns true if interactive debugging is enabled.
+  bool isInteractive() const { return Interactive; }
+
   /// Returns true if the calling thread is a PipelineExecutor worker thread.
   bool isWorkerThread() const;
 
@@ -153,23 +159,17 @@ public:
 
   typedef Dim3 LogCoord;
 
-  // TODO[seth] merge these into one?
-  // TODO[seth] why are these static?
-  static std::map<PhyCoord, LaneState> Lanes; // this is a view
-  static std::map<PhyCoord, LogCoord> Assignments;
-
   struct Core
   {
     const Instruction *PC = nullptr;
     std::queue<std::function<void(const uint64_t)>> Microtasks;
   };
-  static std::vector<Core> Cores;
 
   struct SavedLocals
   {
-    decltype(Lanes) Lanes;
-    decltype(Assignments) Assignments;
-    decltype(Cores) Cores;
+    std::map<PhyCoord, LaneState> Lanes;
+    std::map<PhyCoord, LogCoord> Assignments;
+    std::vector<Core> Cores;
 
     uint64_t ActiveLaneMask;
 
@@ -217,6 +217,10 @@ private:
 
   void startComputeWorker();
   void stepComputeWorker();
+
+  /// Assign the next pending groups to lanes whose groups have completed.
+  void admitPendingGroups();
+
   /// Worker thread entry point for compute shaders.
   void runComputeWorker();
 
@@ -332,6 +336,15 @@ private:
   /// Create a compute shader workgroup and its work-item invocations.
   Workgroup *createWorkgroup(Dim3 GroupId) const;
 
+  /// Record a compute shader workgroup that has completed.
+  void finishWorkgroup(Workgroup *Group);
+
+  /// The per-workgroup report, if enabled with TALVOS_WORKGROUP_REPORT.
+  std::unique_ptr<WorkgroupReport> GroupReport;
+
+  /// The barrier imbalance report, if enabled with TALVOS_BARRIER_REPORT.
+  std::unique_ptr<BarrierReport> BarrierStats;
+
   // Interactive debugging functionality.
   bool Continue;    ///< True when the user has used \p continue command.
   bool Interactive; ///< True when interactive mode is enabled.
@@ -346,12 +359,6 @@ public:
   /// Tokens for the most recent interactive command entered.
   std::vector<std::string> LastLine;
 
-  /// Index of the next breakpoint to create.
-  static uint32_t NextBreakpoint;
-
-  /// Map from breakpoint ID to instruction result ID.
-  static std::map<uint32_t, uint32_t> Breakpoints;
-
   /// \name Interactive command handlers.
   /// Return true when the interpreter should resume executing instructions.
   ///@{
@@ -376,6 +383,21 @@ public:
   // TODO lol
   TickResult tickModel(const uint64_t StepMask);
   Tick::Result doPrepareTick();
+
+  // The scheduler and debugger state belongs to each executor, so that
+  // several devices can execute at the same time. These are declared last to
+  // keep the offsets of the members above stable for the Emscripten ABI.
+
+  // TODO[seth] merge these into one?
+  std::map<PhyCoord, LaneState> Lanes; // this is a view
+  std::map<PhyCoord, LogCoord> Assignments;
+  std::vector<Core> Cores;
+
+  /// Index of the next breakpoint to create.
+  uint32_t NextBreakpoint = 1;
+
+  /// Map from breakpoint ID to instruction result ID.
+  std::map<uint32_t, uint32_t> Breakpoints;
 #ifdef __EMSCRIPTEN__
   class StaticABI;
 #endif
@@ -386,7 +408,7 @@ public:
 #pragma clang diagnostic ignored "-Winvalid-offsetof"
 class PipelineExecutor::StaticABI
 {
-  static_assert(sizeof(talvos::PipelineExecutor) == 272);
+  static_assert(sizeof(talvos::PipelineExecutor) == 336);
   static_assert(offsetof(talvos::PipelineExecutor, Objects) == 32);
 };
 #pragma clang diagnostic pop
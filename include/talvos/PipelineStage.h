@@ -9,8 +9,13 @@
 #ifndef TALVOS_PIPELINESTAGE_H
 #define TALVOS_PIPELINESTAGE_H
 
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <tuple>
 #include <vector>
 
 #include "talvos/Dim3.h"
@@ -21,11 +26,39 @@ namespace talvos
 
 class Device;
 class EntryPoint;
+class Function;
+class Instruction;
+class Invocation;
 class Module;
+class Type;
 
 /// Mapping from specialization constant ID to Object values.
 typedef std::map<uint32_t, Object> SpecConstantMap;
 
+/// The leading constant indices of an access chain, which are applied when a
+/// pipeline stage is created instead of each time the chain is executed.
+struct FoldedAccessChain
+{
+  uint32_t NumIndices;          ///< The number of indices folded.
+  uint64_t Offset;              ///< The byte offset of the folded indices.
+  const Type *Ty;               ///< The type pointed to after folding.
+  PtrMatrixLayout MatrixLayout; ///< The matrix layout after folding.
+};
+
+/// An instruction from a hot function, compiled into a handler that has its
+/// operands already resolved.
+struct CompiledInstruction
+{
+  const Instruction *Inst;                ///< The original instruction.
+  std::function<void(Invocation &)> Exec; ///< The compiled handler.
+};
+
+/// The instructions of a block (excluding its label) from a hot function.
+struct CompiledBlock
+{
+  std::vector<CompiledInstruction> Instructions; ///< The instructions.
+};
+
 /// This class encapsulates information about a pipeline stage.
 class PipelineStage
 {
@@ -47,9 +80,35 @@ public:
   PipelineStage &operator=(const PipelineStage &) = delete;
   ///\}
 
+  /// Destroy this pipeline stage.
+  ~PipelineStage();
+
+  /// Record an entry to function \p F by an invocation of this stage.
+  /// Once a function has been entered enough times, its blocks are compiled.
+  void enterFunction(const Function *F) const;
+
+  /// Returns the compiled form of the block with ID \p Id, or nullptr if the
+  /// function containing it has not been compiled.
+  const CompiledBlock *getCompiledBlock(uint32_t Id) const
+  {
+    return CompiledBlocks[Id].load(std::memory_order_acquire);
+  }
+
+  /// Returns the function called by the OpFunctionCall with result ID \p Id.
+  const Function *getCallee(uint32_t Id) const { return Callees[Id]; }
+
   /// Return the entry point this pipeline stage will invoke.
   const EntryPoint *getEntryPoint() const { return EP; }
 
+  /// Returns the folded constant indices of the access chain with result ID
+  /// \p Id, or nullptr if none of its indices were folded.
+  const FoldedAccessChain *getFoldedAccessChain(uint32_t Id) const
+  {
+    if (Id >= FoldedAccessChains.size() || !FoldedAccessChains[Id].NumIndices)
+      return nullptr;
+    return &FoldedAccessChains[Id];
+  }
+
   /// Return the workgroup size.
   Dim3 getGroupSize() const { return GroupSize; }
 
@@ -60,6 +119,13 @@ public:
   const std::vector<Object> &getObjects() const { return Objects; };
 
 private:
+  /// Compile every block of function \p F.
+  void compile(const Function *F) const;
+
+  /// Fold the leading constant indices of the access chains in the functions
+  /// used by the entry point, and resolve the callee of each function call.
+  void foldAccessChains();
+
   /// The module containing the entry point to invoke.
   std::shared_ptr<const Module> Mod;
 
@@ -68,6 +134,65 @@ private:
 
   /// The result objects in this pipeline stage, after specialization.
   std::vector<Object> Objects;
+
+  /// The functions called by each OpFunctionCall, indexed by result ID.
+  std::vector<const Function *> Callees;
+
+  /// The folded access chains, indexed by result ID.
+  std::vector<FoldedAccessChain> FoldedAccessChains;
+
+  /// The number of entries after which a function is compiled, or zero if
+  /// compilation is disabled.
+  uint32_t CompileThreshold;
+
+  /// The number of times each function has been entered, indexed by ID.
+  mutable std::vector<std::atomic<uint32_t>> EntryCounts;
+
+  /// The compiled blocks, indexed by block ID.
+  mutable std::vector<std::atomic<CompiledBlock *>> CompiledBlocks;
+};
+
+/// This class caches specialized pipeline stages, so that repeated dispatches
+/// of the same entry point with the same specialization constants can share a
+/// single stage instead of building a new one each time.
+///
+/// Cached stages hold a reference to their module, so a module that is still
+/// in the cache cannot be destroyed and its address cannot be reused by a
+/// different module. The oldest stage is evicted when the cache is full.
+class PipelineStageCache
+{
+public:
+  /// Create a cache that holds at most \p Capacity stages.
+  PipelineStageCache(size_t Capacity) : Capacity(Capacity) {}
+
+  // Do not allow PipelineStageCache objects to be copied.
+  ///\{
+  PipelineStageCache(const PipelineStageCache &) = delete;
+  PipelineStageCache &operator=(const PipelineStageCache &) = delete;
+  ///\}
+
+  /// Returns the stage for entry point \p EP of module \p M with the
+  /// specialization constants \p SM, creating it on device \p D if it is not
+  /// already cached.
+  std::shared_ptr<const PipelineStage> get(Device &D,
+                                           std::shared_ptr<const Module> M,
+                                           const EntryPoint *EP,
+                                           const SpecConstantMap &SM);
+
+private:
+  /// The specialization constant IDs and the bytes of their values.
+  typedef std::vector<std::pair<uint32_t, std::vector<uint8_t>>> SpecValues;
+
+  /// A cache key made from the module, entry point, and specialization.
+  typedef std::tuple<const Module *, const EntryPoint *, SpecValues> Key;
+
+  /// A mapping from cache keys to stages.
+  typedef std::map<Key, std::shared_ptr<const PipelineStage>> StageMap;
+
+  size_t Capacity;                      ///< The maximum number of stages.
+  StageMap Stages;                      ///< The cached stages.
+  std::deque<StageMap::iterator> Order; ///< The stages in insertion order.
+  std::mutex Mutex;                     ///< Mutex guarding the cache.
 };
 
 } // namespace talvos
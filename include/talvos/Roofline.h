@@ -0,0 +1,127 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file Roofline.h
+/// This file declares the Roofline class.
+
+#ifndef TALVOS_ROOFLINE_H
+#define TALVOS_ROOFLINE_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "talvos/Dim3.h"
+#include "talvos/PerformanceCounters.h"
+
+namespace talvos
+{
+
+class Command;
+class Instruction;
+class Invocation;
+class TimingModel;
+enum class MemoryScope;
+
+/// This class places compute dispatches on a roofline model of the device.
+///
+/// The floating point operations (FLOPs) and bytes moved in each storage class
+/// are recorded for every dispatch from the device performance counters. The
+/// arithmetic intensity of a storage class is the number of FLOPs per byte
+/// moved. The attainable rate of a dispatch is limited either by the peak
+/// floating point rate of the device, or by the bandwidth of one of the
+/// storage classes, whichever takes longest to service the dispatch.
+///
+/// The device profile (peak rate, bandwidth and clock frequency) is taken from
+/// the parameters of a TimingModel, which can be loaded from a device
+/// description file.
+class Roofline
+{
+public:
+  /// The number of memory storage classes.
+  static const unsigned NUM_SCOPES = 3;
+
+  /// Describes the capabilities of the whole device.
+  struct Profile
+  {
+    double FlopsPerCycle; ///< Peak floating point operations per cycle.
+    double ClockMHz;      ///< Clock frequency in MHz.
+
+    /// Bytes transferred per cycle for each storage class (0 for unlimited).
+    double Bandwidth[NUM_SCOPES];
+  };
+
+  /// The work done by a single dispatch.
+  struct Dispatch
+  {
+    std::string EntryName;  ///< The name of the entry point.
+    Dim3 NumGroups;         ///< The number of workgroups dispatched.
+    uint64_t Flops;         ///< The number of floating point operations.
+    uint64_t ModeledCycles; ///< Cycles from the timing model, or 0.
+
+    /// Bytes loaded and stored for each storage class.
+    ///\{
+    uint64_t BytesLoaded[NUM_SCOPES];
+    uint64_t BytesStored[NUM_SCOPES];
+    ///\}
+
+    /// Returns the number of bytes moved in storage class \p Scope.
+    uint64_t getBytes(MemoryScope Scope) const;
+
+    /// Returns the FLOPs per byte moved in \p Scope, or 0 if none were moved.
+    double getIntensity(MemoryScope Scope) const;
+  };
+
+  /// Create a roofline model for a device with the parameters of \p Model.
+  Roofline(const TimingModel &Model);
+
+  // Do not allow Roofline objects to be copied.
+  ///\{
+  Roofline(const Roofline &) = delete;
+  Roofline &operator=(const Roofline &) = delete;
+  ///\}
+
+  /// Discard the dispatches recorded so far.
+  void clear() { Dispatches.clear(); }
+
+  /// Start recording \p Cmd, if it is a dispatch, with the current values of
+  /// \p Counters as the baseline.
+  void commandBegin(const Command *Cmd, const PerformanceCounters &Counters);
+
+  /// Finish recording \p Cmd, if it is a dispatch.
+  void commandComplete(const Command *Cmd, const PerformanceCounters &Counters);
+
+  /// Returns the number of floating point operations performed by \p Inst,
+  /// which has just been executed by \p Invoc.
+  static uint64_t countFlops(const Invocation *Invoc, const Instruction *Inst);
+
+  /// Returns the attainable FLOPs per cycle for \p D.
+  /// \p Bound is set to the storage class that limits the rate, or to -1 if
+  /// the dispatch is compute bound.
+  double getAttainable(const Dispatch &D, int &Bound) const;
+
+  /// Returns the dispatches recorded since the last call to clear().
+  const std::vector<Dispatch> &getDispatches() const { return Dispatches; }
+
+  /// Returns the device profile.
+  const Profile &getProfile() const { return DeviceProfile; }
+
+  /// Print the device profile and recorded dispatches to \p O as JSON.
+  void printJSON(std::ostream &O) const;
+
+private:
+  Profile DeviceProfile; ///< The device profile.
+
+  /// The counter values at the start of the current dispatch.
+  PerformanceCounters::Values Baseline;
+
+  /// The dispatches recorded since the last call to clear().
+  std::vector<Dispatch> Dispatches;
+};
+
+} // namespace talvos
+
+#endif
@@ -0,0 +1,111 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file SamplingProfiler.h
+/// This file declares the SamplingProfiler class.
+
+#ifndef TALVOS_SAMPLINGPROFILER_H
+#define TALVOS_SAMPLINGPROFILER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace talvos
+{
+
+class Command;
+class Instruction;
+class Invocation;
+class Module;
+
+/// This class implements a statistical profiler for shader execution.
+///
+/// A watcher thread periodically advances a tick counter. Worker threads poll
+/// the counter in Invocation::step(), and each worker that has not yet sampled
+/// the current tick records the current instruction and call stack of its
+/// invocation into a fixed-size lock-free buffer, so every active worker is
+/// sampled on each tick. Each worker also takes a sample the first time it
+/// steps an invocation for a profiler. Samples are aggregated and reported
+/// when each command completes.
+class SamplingProfiler
+{
+public:
+  /// The maximum number of call frames recorded per sample.
+  static const unsigned MAX_STACK_DEPTH = 8;
+
+  /// Create a profiler that samples every \p Interval microseconds, storing up
+  /// to \p Capacity samples per command.
+  SamplingProfiler(uint64_t Interval, size_t Capacity);
+
+  /// Stop the watcher thread and destroy the profiler.
+  ~SamplingProfiler();
+
+  // Do not allow SamplingProfiler objects to be copied.
+  ///\{
+  SamplingProfiler(const SamplingProfiler &) = delete;
+  SamplingProfiler &operator=(const SamplingProfiler &) = delete;
+  ///\}
+
+  /// Aggregate the samples taken while running \p Cmd and print a report.
+  void commandComplete(const Command *Cmd);
+
+  /// Returns true if the calling thread has not yet sampled the current tick.
+  bool isSampleRequested() const
+  {
+    return LastSample.Owner != Id ||
+           LastSample.Tick != Tick.load(std::memory_order_relaxed);
+  }
+
+  /// Record a sample of the current state of \p Invoc.
+  void sample(const Invocation *Invoc);
+
+private:
+  /// A single profiling sample.
+  struct Sample
+  {
+    const Module *Mod;       ///< The module being executed.
+    const Instruction *Inst; ///< The current instruction.
+    uint32_t Depth;          ///< The number of call frames recorded.
+
+    /// The call instructions for each frame, outermost first.
+    const Instruction *Stack[MAX_STACK_DEPTH];
+  };
+
+  /// Print an aggregated report of \p NumSamples samples to \p O.
+  void report(std::ostream &O, size_t NumSamples) const;
+
+  /// Entry point for the watcher thread.
+  void watch();
+
+  const uint64_t Id; ///< Unique identifier for this profiler.
+  uint64_t Interval; ///< The sampling interval in microseconds.
+  size_t Capacity;   ///< The maximum number of samples per command.
+
+  std::unique_ptr<Sample[]> Samples; ///< The sample buffer.
+  std::atomic<size_t> NextSample;    ///< Index of the next free sample.
+  std::atomic<uint64_t> Tick;         ///< Advanced by the watcher thread.
+
+  /// Per-thread record of the last tick sampled by the calling thread.
+  struct SampleCache
+  {
+    uint64_t Owner; ///< The Id of the profiler that was sampled.
+    uint64_t Tick;  ///< The tick that was sampled.
+  };
+  static thread_local SampleCache LastSample;
+
+  std::thread Watcher;                ///< The watcher thread.
+  std::mutex WatcherMutex;            ///< Mutex for the stop signal.
+  std::condition_variable StopSignal; ///< Used to wake the watcher thread.
+  bool Stop;                          ///< True when the watcher should exit.
+};
+
+} // namespace talvos
+
+#endif
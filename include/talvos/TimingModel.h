@@ -0,0 +1,244 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file TimingModel.h
+/// This file declares the TimingModel class.
+
+#ifndef TALVOS_TIMINGMODEL_H
+#define TALVOS_TIMINGMODEL_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "talvos/Occupancy.h"
+#include "talvos/PerformanceCounters.h"
+
+namespace talvos
+{
+
+enum class MemoryScope;
+class PipelineStage;
+
+/// This class models the execution time of a compute dispatch in cycles.
+///
+/// Each core issues up to IssueWidth instructions per cycle, taken from the
+/// lanes that the tick scheduler steps on that core. A lane cannot issue its
+/// next instruction until the previous one has completed, so instruction
+/// latency is only hidden by interleaving other lanes. Memory accesses occupy a
+/// channel for their storage class for NumBytes / Bandwidth cycles, and then
+/// complete after a further fixed latency. Device memory has a single channel
+/// shared by all cores, while other storage classes have a channel per core.
+///
+/// The parameters of the model are read from a device description file, which
+/// contains one parameter per line:
+/// \code
+/// # Comments begin with '#'.
+/// issue_width 2            # Instructions issued per core per cycle.
+/// issue_width 1 3          # Override the issue width for core 3.
+/// latency arithmetic 4     # Latency of an instruction class.
+/// memory device latency 400
+/// memory device bandwidth 64   # Bytes per cycle (0 for unlimited).
+/// core registers 65536     # Resources available on each core.
+/// core workgroup_memory 49152
+/// core invocations 2048
+/// core workgroups 32
+/// flops_per_cycle 16       # Peak floating point operations per core per cycle.
+/// clock_mhz 1000           # Clock frequency, used to report absolute rates.
+/// \endcode
+///
+/// The instruction classes are those used by PerformanceCounters (arithmetic,
+/// memory, control_flow, atomic, barrier, image, other), and the storage
+/// classes are device, workgroup and invocation. The core resources are used to
+/// compute the Occupancy of each dispatch, which limits the number of
+/// workgroups that the scheduler admits onto each core. The peak floating point
+/// rate and clock frequency are not used by the timing model itself, but
+/// describe the device for the Roofline analysis.
+///
+/// The timing model is not thread-safe, and relies on the pipeline executor
+/// stepping a single lane at a time.
+class TimingModel
+{
+public:
+  /// Parameters for a memory storage class.
+  struct MemoryParams
+  {
+    uint64_t Latency;   ///< Cycles from transfer completion to data ready.
+    uint64_t Bandwidth; ///< Bytes transferred per cycle, or 0 for unlimited.
+  };
+
+  /// The number of instruction classes (see PerformanceCounters).
+  static const unsigned NUM_CLASSES =
+      PerformanceCounters::INSTRUCTIONS_OTHER + 1;
+
+  /// The number of memory storage classes.
+  static const unsigned NUM_SCOPES = 3;
+
+  /// Create a timing model for \p NumCores cores with \p NumLanes lanes each,
+  /// using default parameters.
+  TimingModel(uint64_t NumCores, uint64_t NumLanes);
+
+  // Do not allow TimingModel objects to be copied.
+  ///\{
+  TimingModel(const TimingModel &) = delete;
+  TimingModel &operator=(const TimingModel &) = delete;
+  ///\}
+
+  /// Compute the occupancy of \p Stage for a dispatch of \p NumGroups
+  /// workgroups, and return the number of workgroups that may be resident on
+  /// each core.
+  uint64_t admitDispatch(const PipelineStage &Stage, uint64_t NumGroups);
+
+  /// Reset the model state at the start of a dispatch.
+  void beginDispatch();
+
+  /// Finish modeling the current dispatch, and return its duration in cycles.
+  uint64_t endDispatch();
+
+  /// Extrapolate the duration of the current dispatch, of which only a sample
+  /// of the workgroups were admitted, to a dispatch of \p NumGroups workgroups.
+  void extrapolate(uint64_t NumGroups) { TotalGroups = NumGroups; }
+
+  /// Returns the clock frequency of the device in MHz.
+  uint64_t getClockMHz() const { return ClockMHz; }
+
+  /// Returns the resources available on each core.
+  const Occupancy::Limits &getCoreLimits() const { return CoreLimits; }
+
+  /// Returns the core that instructions are currently being issued on.
+  uint64_t getCurrentCore() const { return CurrentLane / NumLanes; }
+
+  /// Returns the peak number of floating point operations per core per cycle.
+  uint64_t getFlopsPerCycle() const { return FlopsPerCycle; }
+
+  /// Returns the issue width of \p Core.
+  uint64_t getIssueWidth(uint64_t Core) const { return IssueWidth[Core]; }
+
+  /// Returns the latency of instruction class \p Class.
+  uint64_t getLatency(PerformanceCounters::Counter Class) const
+  {
+    return Latency[Class];
+  }
+
+  /// Returns the parameters for memory with storage class \p Scope.
+  const MemoryParams &getMemoryParams(MemoryScope Scope) const
+  {
+    return Memory[(unsigned)Scope];
+  }
+
+  /// Returns the number of cores being modeled.
+  uint64_t getNumCores() const { return NumCores; }
+
+  /// Returns the number of cycles modeled so far in the current dispatch.
+  uint64_t getCycles() const;
+
+  /// Returns the duration of the current dispatch in cycles, extrapolated to
+  /// the number of workgroups given to extrapolate().
+  uint64_t getDispatchCycles() const;
+
+  /// Returns the number of instructions issued in the current dispatch.
+  uint64_t getNumIssued() const { return NumIssued; }
+
+  /// Load model parameters from the device description file \p FileName.
+  /// Returns false and prints an error message if the file is invalid.
+  bool load(const std::string &FileName);
+
+  /// Record a memory access made by the instruction currently executing.
+  /// The access is charged when the instruction is issued.
+  void memoryAccess(MemoryScope Scope, uint64_t NumBytes);
+
+  /// Issue an instruction with opcode \p Opcode on the current lane.
+  void issue(uint16_t Opcode);
+
+  /// Print the model results for the current dispatch to \p O.
+  void print(std::ostream &O) const;
+
+  /// Set the latency of the accesses to storage class \p Scope made by the
+  /// instruction currently executing, overriding the latency of the storage
+  /// class. This allows plugins that model caches to report hit latencies.
+  /// If set more than once for an instruction, the largest latency is used.
+  void setAccessLatency(MemoryScope Scope, uint64_t Latency);
+
+  /// Select the core and lane that subsequent instructions are issued on.
+  void setCurrentLane(uint64_t Core, uint64_t Lane)
+  {
+    CurrentLane = Core * NumLanes + Lane;
+  }
+
+private:
+  /// The number of cores being modeled.
+  const uint64_t NumCores;
+
+  /// The number of lanes per core.
+  const uint64_t NumLanes;
+
+  /// Instructions issued per cycle, for each core.
+  std::vector<uint64_t> IssueWidth;
+
+  /// Latency for each instruction class.
+  uint64_t Latency[NUM_CLASSES];
+
+  /// Parameters for each memory storage class.
+  MemoryParams Memory[NUM_SCOPES];
+
+  /// The resources available on each core.
+  Occupancy::Limits CoreLimits;
+
+  /// Peak floating point operations per core per cycle.
+  uint64_t FlopsPerCycle;
+
+  /// The clock frequency of the device in MHz.
+  uint64_t ClockMHz;
+
+  /// The occupancy of the current dispatch, if it has been admitted.
+  std::unique_ptr<Occupancy> CurrentOccupancy;
+
+  /// The number of workgroups admitted in the current dispatch.
+  uint64_t AdmittedGroups;
+
+  /// The number of workgroups that the current dispatch is extrapolated to.
+  uint64_t TotalGroups;
+
+  /// Issue state for a core.
+  struct CoreState
+  {
+    uint64_t Cycle;  ///< The cycle that the next instruction can issue in.
+    uint64_t Issued; ///< The number of instructions issued in that cycle.
+
+    /// The cycle each per-core memory channel is next free.
+    uint64_t ChannelFree[NUM_SCOPES];
+  };
+
+  /// State for each core.
+  std::vector<CoreState> Cores;
+
+  /// The cycle that each lane's previous instruction completes.
+  std::vector<uint64_t> LaneReady;
+
+  /// The cycle that the device memory channel is next free.
+  uint64_t DeviceChannelFree;
+
+  /// Bytes accessed by the instruction currently executing, per storage class.
+  uint64_t PendingBytes[NUM_SCOPES];
+
+  /// Latency of the accesses made by the instruction currently executing, per
+  /// storage class, or -1 to use the default latency.
+  uint64_t PendingLatency[NUM_SCOPES];
+
+  /// Bytes transferred in the current dispatch, per storage class.
+  uint64_t TotalBytes[NUM_SCOPES];
+
+  /// The index of the lane currently being stepped.
+  uint64_t CurrentLane;
+
+  /// The number of instructions issued in the current dispatch.
+  uint64_t NumIssued;
+};
+
+} // namespace talvos
+
+#endif
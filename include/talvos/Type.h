@@ -20,6 +20,7 @@ namespace talvos
 {
 
 class Type;
+struct PtrMatrixLayout;
 
 /// A list of types used for structure members.
 /// The second value for each entry is a map of decorations for the member.
@@ -67,6 +68,11 @@ public:
   /// Valid for array, pointer, runtime array, struct, and vector types.
   size_t getElementOffset(uint64_t Index) const;
 
+  /// Returns the byte offset of the element at \p Index, for an access chain
+  /// step through a pointer to this type with matrix layout \p Layout.
+  /// \p Layout is updated with the layout decorations of a structure member.
+  size_t getElementOffset(uint64_t Index, PtrMatrixLayout &Layout) const;
+
   /// Returns the type of the element at \p Index.
   /// Valid for array, pointer, runtime array, struct, and vector types.
   /// For non-structure types, the value of \p Index is ignored.
@@ -127,6 +133,14 @@ public:
   /// Returns \p true if this is a vector type.
   bool isVector() const { return Id == VECTOR; }
 
+  /// Returns the canonical instance of the type \p Ty.
+  ///
+  /// Types are interned across every module, so that identical types share a
+  /// single instance and its precomputed layout. If no identical type has been
+  /// interned yet, \p Ty becomes the canonical instance. Interned types are
+  /// never destroyed.
+  static const Type *intern(std::unique_ptr<Type> Ty);
+
   /// Allow a Type to be inserted into an output stream.
   /// Converts the type to a human readable format.
   friend std::ostream &operator<<(std::ostream &Stream, const Type *Ty);
@@ -190,8 +204,30 @@ private:
   {
     this->Id = Id;
     this->ByteSize = ByteSize;
-    ElementCount = 1;
+    BitWidth = 0;
+    StorageClass = 0;
     ElementType = nullptr;
+    ElementCount = 1;
+    ArrayStride = 0;
+    ElementStride = 0;
+    ReturnType = nullptr;
+    Dimensionality = 0;
+    Depth = 0;
+    Arrayed = false;
+    Multisampled = false;
+    Sampled = 0;
+    Format = 0;
+  };
+
+  /// Returns \p true if this type is identical to \p Other.
+  bool isIdentical(const Type &Other) const;
+
+  /// The matrix layout of a structure member, from its MatrixStride and
+  /// RowMajor/ColMajor decorations.
+  struct MemberLayout
+  {
+    uint32_t MatrixStride : 31; ///< The stride, or zero if not decorated.
+    uint32_t ColMajor : 1;      ///< 1 if column major, 0 if row major.
   };
 
   TypeId Id; ///< The ID of this type.
@@ -206,8 +242,13 @@ private:
   uint32_t ElementCount;   ///< Valid for composite types.
   uint32_t ArrayStride;    ///< Valid for array and pointer types.
 
+  /// The byte offset between consecutive elements.
+  /// Valid for array, matrix, pointer, runtime array, and vector types.
+  uint32_t ElementStride;
+
   StructElementTypeList ElementTypes; ///< Valid for struct types.
   std::vector<size_t> ElementOffsets; ///< Valid for struct types.
+  std::vector<MemberLayout> Layouts;  ///< Valid for struct types.
 
   const Type *ReturnType;                  ///< Valid for function types.
   std::vector<const Type *> ArgumentTypes; ///< Valid for function types.
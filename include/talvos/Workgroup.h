@@ -9,6 +9,8 @@
 #ifndef TALVOS_WORKGROUP_H
 #define TALVOS_WORKGROUP_H
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -45,12 +47,30 @@ public:
   Workgroup &operator=(const Workgroup &) = delete;
   ///\}
 
+  /// Record that the invocations of this group have cleared a barrier.
+  void addBarrier() { NumBarriers++; }
+
+  /// Record that an invocation of this group has executed an instruction.
+  void addInstruction() { NumInstructions++; }
+
   /// Add a work-item invocation to this group, transferring ownership.
   void addWorkItem(std::unique_ptr<Invocation> WorkItem);
 
   /// Returns the group ID of this workgroup.
   Dim3 getGroupId() const { return GroupId; }
 
+  /// Returns the number of barriers that this group has cleared.
+  uint32_t getNumBarriers() const { return NumBarriers; }
+
+  /// Returns the number of instructions executed by this group.
+  uint64_t getNumInstructions() const { return NumInstructions; }
+
+  /// Returns the time at which this group was created.
+  std::chrono::steady_clock::time_point getStartTime() const
+  {
+    return StartTime;
+  }
+
   /// Returns the local memory instance associated with this workgroup.
   Memory &getLocalMemory() { return *LocalMemory; }
 
@@ -68,6 +88,12 @@ private:
   WorkItemList WorkItems; ///< List of work items in this workgroup.
 
   VariableList Variables; ///< Workgroup scope OpVariable allocations.
+
+  uint64_t NumInstructions; ///< Instructions executed by the group.
+  uint32_t NumBarriers;     ///< Barriers cleared by the group.
+
+  /// The time at which the group was created.
+  std::chrono::steady_clock::time_point StartTime;
 };
 
 } // namespace talvos
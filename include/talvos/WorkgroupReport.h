@@ -0,0 +1,73 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file WorkgroupReport.h
+/// This file declares the WorkgroupReport class.
+
+#ifndef TALVOS_WORKGROUPREPORT_H
+#define TALVOS_WORKGROUPREPORT_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+#include "talvos/Dim3.h"
+
+namespace talvos
+{
+
+class Workgroup;
+
+/// This class records the work done by each workgroup of a compute dispatch,
+/// to expose load imbalance between workgroups.
+///
+/// When the dispatch completes, the report shows a histogram of the number of
+/// instructions executed by each workgroup, the workgroups that executed the
+/// most instructions, and a heat map of instructions over the X and Y
+/// dimensions of the dispatch grid.
+class WorkgroupReport
+{
+public:
+  /// The work done by a single workgroup.
+  struct Record
+  {
+    Dim3 GroupId;          ///< The group ID.
+    uint64_t Instructions; ///< The number of instructions executed.
+    uint64_t WallTime;     ///< Nanoseconds from creation to completion.
+    uint32_t Barriers;     ///< The number of barriers cleared.
+  };
+
+  /// Create a report that lists the \p NumTop workgroups with the most
+  /// instructions.
+  WorkgroupReport(unsigned NumTop);
+
+  // Do not allow WorkgroupReport objects to be copied.
+  ///\{
+  WorkgroupReport(const WorkgroupReport &) = delete;
+  WorkgroupReport &operator=(const WorkgroupReport &) = delete;
+  ///\}
+
+  /// Start recording a dispatch of \p NumGroups groups from \p BaseGroup.
+  void begin(Dim3 BaseGroup, Dim3 NumGroups);
+
+  /// Returns the records of the workgroups that have completed.
+  const std::vector<Record> &getRecords() const { return Records; }
+
+  /// Print the report for the current dispatch to \p O and discard it.
+  void print(std::ostream &O);
+
+  /// Record the completion of \p Group.
+  void record(const Workgroup &Group);
+
+private:
+  unsigned NumTop;             ///< The number of workgroups to list.
+  Dim3 BaseGroup;              ///< The base group of the dispatch.
+  Dim3 NumGroups;              ///< The number of groups in the dispatch.
+  std::vector<Record> Records; ///< The record of each completed workgroup.
+};
+
+} // namespace talvos
+
+#endif
@@ -0,0 +1,113 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file WorkgroupSampler.h
+/// This file declares the WorkgroupSampler class.
+
+#ifndef TALVOS_WORKGROUPSAMPLER_H
+#define TALVOS_WORKGROUPSAMPLER_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <vector>
+
+#include "talvos/Dim3.h"
+#include "talvos/PerformanceCounters.h"
+
+namespace talvos
+{
+
+class Command;
+class Workgroup;
+
+/// This class executes a sample of the workgroups of each compute dispatch.
+///
+/// The workgroups of a dispatch are split into equally sized strata in
+/// launch order, and one workgroup is chosen from each stratum using a
+/// deterministic pseudo-random sequence derived from a seed. The performance
+/// counters that accumulate per workgroup are scaled up to the full number of
+/// workgroups before the dispatch is reported (the timing model extrapolates
+/// the modeled cycles separately), and the number of instructions executed by
+/// each sampled workgroup is used to bound the error of the extrapolated
+/// instruction count.
+///
+/// Workgroups that are not sampled are never executed, so the memory that
+/// they would have written is left untouched.
+class WorkgroupSampler
+{
+public:
+  /// Create a sampler that executes \p Count workgroups of each dispatch if
+  /// \p Count is non-zero, or \p Fraction of the workgroups otherwise, with
+  /// the sample chosen using \p Seed.
+  WorkgroupSampler(uint64_t Count, double Fraction, uint64_t Seed);
+
+  // Do not allow WorkgroupSampler objects to be copied.
+  ///\{
+  WorkgroupSampler(const WorkgroupSampler &) = delete;
+  WorkgroupSampler &operator=(const WorkgroupSampler &) = delete;
+  ///\}
+
+  /// Record the current value of \p Counters at the start of \p Cmd.
+  void commandBegin(const Command *Cmd, const PerformanceCounters &Counters);
+
+  /// Extrapolate the counters for \p Cmd to the full dispatch and print a
+  /// summary of the sample.
+  void commandComplete(const Command *Cmd, PerformanceCounters &Counters);
+
+  /// Returns the number of workgroups in the current dispatch.
+  uint64_t getNumGroups() const { return NumGroups; }
+
+  /// Returns the number of workgroups sampled from the current dispatch.
+  uint64_t getNumSampled() const { return NumSampled; }
+
+  /// Record an instruction executed by \p Group.
+  void instructionExecuted(const Workgroup *Group)
+  {
+    if (!Sampling)
+      return;
+    if (Group != LastGroup)
+    {
+      LastGroup = Group;
+      LastCount = &RunningGroups[Group];
+    }
+    ++*LastCount;
+  }
+
+  /// Replace \p Groups, the workgroups of a dispatch in launch order, with a
+  /// sample of them.
+  void select(std::vector<Dim3> &Groups);
+
+  /// Record the completion of \p Group.
+  void workgroupComplete(const Workgroup *Group);
+
+private:
+  uint64_t Count;  ///< The number of workgroups to sample, or 0.
+  double Fraction; ///< The fraction of workgroups to sample.
+  uint64_t Seed;   ///< The seed for choosing workgroups.
+
+  uint64_t NumGroups;  ///< The number of workgroups in the dispatch.
+  uint64_t NumSampled; ///< The number of workgroups sampled.
+  bool Sampling;       ///< True if the current dispatch is being sampled.
+
+  /// The counter values at the start of the current dispatch.
+  PerformanceCounters::Values Baseline;
+
+  /// The instructions executed by each running workgroup.
+  std::map<const Workgroup *, uint64_t> RunningGroups;
+
+  /// The workgroup that most recently executed an instruction.
+  const Workgroup *LastGroup;
+
+  /// The instruction count of LastGroup.
+  uint64_t *LastCount;
+
+  /// The instructions executed by each completed workgroup.
+  std::vector<uint64_t> GroupInstructions;
+};
+
+} // namespace talvos
+
+#endif
@@ -0,0 +1,165 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file BarrierReport.cpp
+/// This file defines the BarrierReport class.
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "talvos/BarrierReport.h"
+#include "talvos/Instruction.h"
+#include "talvos/Invocation.h"
+#include "talvos/Module.h"
+#include "talvos/Workgroup.h"
+
+namespace talvos
+{
+
+BarrierReport::BarrierReport(unsigned NumTop) : NumTop(NumTop)
+{
+  NumGroups = 0;
+  CriticalPath = 0;
+  MaxCriticalPath = 0;
+}
+
+void BarrierReport::barrier(const Workgroup &Group)
+{
+  const Workgroup::WorkItemList &WorkItems = Group.getWorkItems();
+  if (WorkItems.empty())
+    return;
+  recordSegment(Group, WorkItems.front()->getBarrier());
+}
+
+void BarrierReport::complete(const Workgroup &Group)
+{
+  // The end of the workgroup acts as an implicit barrier.
+  recordSegment(Group, nullptr);
+
+  auto G = RunningGroups.find(&Group);
+  if (G == RunningGroups.end())
+    return;
+  NumGroups++;
+  CriticalPath += G->second;
+  MaxCriticalPath = std::max(MaxCriticalPath, G->second);
+  RunningGroups.erase(G);
+}
+
+void BarrierReport::print(std::ostream &O)
+{
+  if (!NumGroups)
+    return;
+
+  uint64_t TotalInstructions = 0, TotalIdle = 0;
+  size_t NumBarriers = 0;
+  std::vector<std::pair<const Instruction *, Record>> Sorted;
+  for (auto &R : Records)
+  {
+    TotalInstructions += R.second.Instructions;
+    TotalIdle += R.second.IdleLaneCycles;
+    if (R.first)
+      NumBarriers++;
+    Sorted.push_back(R);
+  }
+
+  // Sort barriers by idle lane-cycles, then by the work done before them.
+  std::stable_sort(Sorted.begin(), Sorted.end(), [](auto &A, auto &B) {
+    if (A.second.IdleLaneCycles != B.second.IdleLaneCycles)
+      return A.second.IdleLaneCycles > B.second.IdleLaneCycles;
+    return A.second.Instructions > B.second.Instructions;
+  });
+
+  std::ostringstream SS;
+  SS << std::fixed << std::setprecision(1);
+  SS << std::endl
+     << "Barrier report: " << NumBarriers << " barriers, " << NumGroups
+     << " workgroups" << std::endl;
+  SS << "  Critical path: mean " << (double)CriticalPath / NumGroups
+     << ", max " << MaxCriticalPath << " instructions per workgroup"
+     << std::endl;
+  SS << "  Lane utilization: "
+     << 100.0 * TotalInstructions / (TotalInstructions + TotalIdle) << "% ("
+     << TotalInstructions << " instructions, " << TotalIdle
+     << " idle lane-cycles)" << std::endl;
+
+  SS << "  Barriers by idle lane-cycles:" << std::endl;
+  for (size_t i = 0; i < Sorted.size() && i < NumTop; i++)
+  {
+    const Instruction *Inst = Sorted[i].first;
+    const Record &R = Sorted[i].second;
+
+    SS << "    " << (i + 1) << ". ";
+    if (Inst)
+    {
+      Inst->print(SS, false);
+      std::ostringstream Loc;
+      if (R.Mod->printSourceLocation(Loc, Inst))
+        SS << "  [" << Loc.str() << "]";
+    }
+    else
+      SS << "End of workgroup";
+    SS << std::endl;
+
+    SS << "       " << R.Phases << " phases, " << R.Arrivals << " arrivals, "
+       << R.IdleLaneCycles << " idle lane-cycles";
+    if (TotalIdle)
+      SS << " (" << 100.0 * R.IdleLaneCycles / TotalIdle << "%)";
+    SS << std::endl;
+    SS << "       Instructions since previous barrier: min "
+       << R.MinInstructions << ", mean "
+       << (double)R.Instructions / R.Arrivals << ", max "
+       << R.MaxInstructions << std::endl;
+    SS << "       Arrival spread: mean " << (double)R.TotalSpread / R.Phases
+       << ", max " << R.MaxSpread << " instructions" << std::endl;
+  }
+  O << SS.str();
+
+  Records.clear();
+  RunningGroups.clear();
+  NumGroups = 0;
+  CriticalPath = 0;
+  MaxCriticalPath = 0;
+}
+
+void BarrierReport::recordSegment(const Workgroup &Group,
+                                  const Instruction *Inst)
+{
+  const Workgroup::WorkItemList &WorkItems = Group.getWorkItems();
+  if (WorkItems.empty())
+    return;
+
+  // Find the earliest and latest arrival at the barrier.
+  uint64_t Min = UINT64_MAX, Max = 0, Total = 0;
+  for (auto &WI : WorkItems)
+  {
+    uint64_t Count = WI->getInstructionsSinceBarrier();
+    Min = std::min(Min, Count);
+    Max = std::max(Max, Count);
+    Total += Count;
+  }
+
+  Record &R = Records[Inst];
+  if (!R.Phases)
+  {
+    R.Mod = WorkItems.front()->getModule().get();
+    R.MinInstructions = Min;
+  }
+  R.Phases++;
+  R.Arrivals += WorkItems.size();
+  R.Instructions += Total;
+  R.MinInstructions = std::min(R.MinInstructions, Min);
+  R.MaxInstructions = std::max(R.MaxInstructions, Max);
+  R.TotalSpread += Max - Min;
+  R.MaxSpread = std::max(R.MaxSpread, Max - Min);
+  R.IdleLaneCycles += Max * WorkItems.size() - Total;
+
+  // The workgroup cannot proceed until the last invocation arrives.
+  RunningGroups[&Group] += Max;
+}
+
+} // namespace talvos
@@ -22,4 +22,36 @@ Block::Block(uint32_t Id)
 
 Block::~Block() {}
 
+std::vector<uint32_t> Block::getSuccessors() const
+{
+  const Instruction *Inst = getTerminator();
+  if (!Inst)
+    return {};
+
+  switch (Inst->getOpcode())
+  {
+  case SpvOpBranch:
+    return {Inst->getOperand(0)};
+  case SpvOpBranchConditional:
+    return {Inst->getOperand(1), Inst->getOperand(2)};
+  case SpvOpSwitch:
+  {
+    std::vector<uint32_t> Successors = {Inst->getOperand(1)};
+    for (unsigned i = 3; i < Inst->getNumOperands(); i += 2)
+      Successors.push_back(Inst->getOperand(i));
+    return Successors;
+  }
+  default:
+    return {};
+  }
+}
+
+const Instruction *Block::getTerminator() const
+{
+  const Instruction *Last = nullptr;
+  for (const Instruction *I = Label->next(); I; I = I->next())
+    Last = I;
+  return Last;
+}
+
 } // namespace talvos
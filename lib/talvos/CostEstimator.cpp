@@ -0,0 +1,500 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file CostEstimator.cpp
+/// This file defines the CostEstimator class.
+
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include <spirv/unified1/spirv.h>
+
+#include "Utils.h"
+#include "talvos/Block.h"
+#include "talvos/CostEstimator.h"
+#include "talvos/EntryPoint.h"
+#include "talvos/Function.h"
+#include "talvos/Instruction.h"
+#include "talvos/Memory.h"
+#include "talvos/Module.h"
+#include "talvos/Object.h"
+#include "talvos/PipelineStage.h"
+#include "talvos/TimingModel.h"
+#include "talvos/Type.h"
+#include "talvos/Variable.h"
+
+namespace talvos
+{
+
+/// The largest trip count that will be computed for a loop.
+static const uint64_t MAX_TRIPS = 1 << 24;
+
+/// Structural information about a loop.
+struct CostEstimator::Loop
+{
+  const Function *Func;    ///< The function containing the loop.
+  uint32_t Header;         ///< The loop header block.
+  uint32_t Merge;          ///< The merge block.
+  std::set<uint32_t> Body; ///< The blocks in the loop, including the header.
+
+  /// The only block that branches out of the loop, or 0 if there are several.
+  uint32_t ExitBlock;
+};
+
+/// Evaluate the integer comparison \p Opcode on \p Width bit operands.
+/// Returns false if \p Opcode is not an integer comparison.
+static bool compare(uint16_t Opcode, uint64_t A, uint64_t B, unsigned Width,
+                    bool &Result)
+{
+  // Sign-extend operands for signed comparisons.
+  int64_t SA = (int64_t)(A << (64 - Width)) >> (64 - Width);
+  int64_t SB = (int64_t)(B << (64 - Width)) >> (64 - Width);
+  switch (Opcode)
+  {
+  case SpvOpIEqual:
+    Result = A == B;
+    break;
+  case SpvOpINotEqual:
+    Result = A != B;
+    break;
+  case SpvOpSGreaterThan:
+    Result = SA > SB;
+    break;
+  case SpvOpSGreaterThanEqual:
+    Result = SA >= SB;
+    break;
+  case SpvOpSLessThan:
+    Result = SA < SB;
+    break;
+  case SpvOpSLessThanEqual:
+    Result = SA <= SB;
+    break;
+  case SpvOpUGreaterThan:
+    Result = A > B;
+    break;
+  case SpvOpUGreaterThanEqual:
+    Result = A >= B;
+    break;
+  case SpvOpULessThan:
+    Result = A < B;
+    break;
+  case SpvOpULessThanEqual:
+    Result = A <= B;
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+/// Returns the memory scope used for \p StorageClass.
+static MemoryScope getScope(uint32_t StorageClass)
+{
+  switch (StorageClass)
+  {
+  case SpvStorageClassWorkgroup:
+    return MemoryScope::Workgroup;
+  case SpvStorageClassFunction:
+  case SpvStorageClassInput:
+  case SpvStorageClassOutput:
+  case SpvStorageClassPrivate:
+    return MemoryScope::Invocation;
+  default:
+    return MemoryScope::Device;
+  }
+}
+
+CostEstimator::CostEstimator(const PipelineStage &Stage,
+                             const TimingModel &Model)
+    : Mod(*Stage.getModule()), Objects(Stage.getObjects()), Model(Model),
+      Stage(Stage)
+{
+  DefaultTrips = getEnvUInt("TALVOS_COST_LOOP_TRIPS", 16);
+
+  for (const Variable *V : Mod.getVariables())
+    StorageClasses[V->getId()] = V->getType()->getStorageClass();
+
+  InvocationCost = analyzeFunction(Stage.getEntryPoint()->getFunction());
+}
+
+double CostEstimator::analyzeFunction(const Function *F)
+{
+  // Return the memoized cost, or zero for a recursive call.
+  auto Itr = FunctionCosts.find(F);
+  if (Itr != FunctionCosts.end())
+    return Itr->second;
+  FunctionCosts[F] = 0;
+
+  // Record the definition of each result and the storage class of pointers.
+  std::map<uint32_t, uint32_t> DefBlocks;
+  std::map<uint32_t, std::vector<uint32_t>> Predecessors;
+  for (auto &B : F->getBlocks())
+  {
+    for (const Instruction *I = B.second->getLabel().next(); I; I = I->next())
+    {
+      const Type *Ty = I->getResultType();
+      if (!Ty)
+        continue;
+      Defs[I->getOperand(1)] = I;
+      DefBlocks[I->getOperand(1)] = B.first;
+      if (Ty->isPointer())
+        StorageClasses[I->getOperand(1)] = Ty->getStorageClass();
+    }
+    for (uint32_t S : B.second->getSuccessors())
+      Predecessors[S].push_back(B.first);
+  }
+
+  // Find the blocks of each structured loop. The body of a loop is the header
+  // and every block that can reach a back edge without passing the header.
+  std::map<uint32_t, Loop> LoopMap;
+  for (auto &B : F->getBlocks())
+  {
+    const Instruction *Terminator = B.second->getTerminator();
+    const Instruction *Merge = Terminator ? Terminator->previous() : nullptr;
+    if (!Merge || Merge->getOpcode() != SpvOpLoopMerge)
+      continue;
+
+    Loop &L = LoopMap[B.first];
+    L.Func = F;
+    L.Header = B.first;
+    L.Merge = Merge->getOperand(0);
+
+    // Find the blocks reachable from the continue target within the loop.
+    std::set<uint32_t> FromContinue;
+    std::vector<uint32_t> Worklist = {Merge->getOperand(1)};
+    while (!Worklist.empty())
+    {
+      uint32_t Id = Worklist.back();
+      Worklist.pop_back();
+      if (Id == L.Header || Id == L.Merge || !FromContinue.insert(Id).second)
+        continue;
+      for (uint32_t S : F->getBlock(Id)->getSuccessors())
+        Worklist.push_back(S);
+    }
+
+    // Walk backwards from the back edges to the header.
+    L.Body.insert(L.Header);
+    for (uint32_t P : Predecessors[L.Header])
+      if (FromContinue.count(P) || P == L.Header)
+        Worklist.push_back(P);
+    while (!Worklist.empty())
+    {
+      uint32_t Id = Worklist.back();
+      Worklist.pop_back();
+      if (!L.Body.insert(Id).second)
+        continue;
+      for (uint32_t P : Predecessors[Id])
+        Worklist.push_back(P);
+    }
+
+    // Find the block that exits the loop, if there is only one.
+    L.ExitBlock = 0;
+    for (uint32_t Id : L.Body)
+    {
+      for (uint32_t S : F->getBlock(Id)->getSuccessors())
+      {
+        if (L.Body.count(S) || L.ExitBlock == Id)
+          continue;
+        L.ExitBlock = L.ExitBlock ? (uint32_t)-1 : Id;
+      }
+    }
+    if (L.ExitBlock == (uint32_t)-1)
+      L.ExitBlock = 0;
+  }
+
+  // Order the blocks so that each block follows its predecessors, ignoring
+  // back edges.
+  std::vector<uint32_t> Order;
+  std::set<uint32_t> Visited;
+  std::function<void(uint32_t)> Visit = [&](uint32_t Id) {
+    if (!Visited.insert(Id).second)
+      return;
+    for (uint32_t S : F->getBlock(Id)->getSuccessors())
+      Visit(S);
+    Order.push_back(Id);
+  };
+  Visit(F->getFirstBlockId());
+  std::reverse(Order.begin(), Order.end());
+
+  // Returns the innermost loop that contains block Id, or nullptr.
+  auto GetLoop = [&](uint32_t Id) {
+    const Loop *Innermost = nullptr;
+    for (auto &L : LoopMap)
+      if (L.second.Body.count(Id) &&
+          (!Innermost || Innermost->Body.size() > L.second.Body.size()))
+        Innermost = &L.second;
+    return Innermost;
+  };
+
+  // Propagate execution frequencies through the function.
+  std::map<uint32_t, double> Incoming;
+  std::map<uint32_t, double> Frequency;
+  Incoming[F->getFirstBlockId()] = 1;
+  double Cost = 0;
+  for (uint32_t Id : Order)
+  {
+    const Block *B = F->getBlock(Id);
+    double Freq = Incoming[Id];
+
+    auto LItr = LoopMap.find(Id);
+    if (LItr != LoopMap.end())
+    {
+      // Execute the header for each iteration, and reach the merge block once
+      // per entry to the loop.
+      uint64_t Trips = computeTrips(LItr->second);
+      Loops.push_back({F, Id, Trips ? Trips : DefaultTrips, Trips != 0});
+      Incoming[LItr->second.Merge] += Freq;
+      Freq *= Loops.back().Trips;
+    }
+    Frequency[Id] = Freq;
+
+    // Compute the cost of the block, including any functions that it calls.
+    uint64_t BlockCost = 0;
+    double CalleeCost = 0;
+    for (const Instruction *I = B->getLabel().next(); I; I = I->next())
+    {
+      BlockCost += getInstructionCost(I);
+      if (I->getOpcode() == SpvOpFunctionCall)
+        CalleeCost += analyzeFunction(Mod.getFunction(I->getOperand(2)));
+    }
+    Blocks.push_back({F, Id, Freq, BlockCost});
+    Cost += Freq * (BlockCost + CalleeCost);
+
+    // Distribute the frequency of this block between its successors. Edges
+    // that leave the innermost loop are given the frequency of entering the
+    // loop if they are its only exit, and back edges are dropped.
+    const Loop *L = GetLoop(Id);
+    std::vector<uint32_t> Successors = B->getSuccessors();
+    std::vector<uint32_t> Inside;
+    double Remaining = Freq;
+    for (uint32_t S : Successors)
+    {
+      if (!L || L->Body.count(S))
+        Inside.push_back(S);
+      else if (L->ExitBlock == Id)
+        Remaining -= std::min(Remaining, Incoming[L->Header]);
+      else
+        Remaining -= Freq / Successors.size();
+    }
+    for (uint32_t S : Inside)
+    {
+      bool BackEdge = LoopMap.count(S) && LoopMap.at(S).Body.count(Id);
+      if (!BackEdge)
+        Incoming[S] += Remaining / Inside.size();
+    }
+  }
+
+  FunctionCosts[F] = Cost;
+  return Cost;
+}
+
+uint64_t CostEstimator::computeTrips(const Loop &L) const
+{
+  auto GetDef = [this](uint32_t Id) -> const Instruction * {
+    auto Itr = Defs.find(Id);
+    return Itr == Defs.end() ? nullptr : Itr->second;
+  };
+
+  // Find the condition that keeps execution inside the loop.
+  if (!L.ExitBlock)
+    return 0;
+  const Instruction *Branch = L.Func->getBlock(L.ExitBlock)->getTerminator();
+  if (Branch->getOpcode() != SpvOpBranchConditional)
+    return 0;
+  bool ContinueIf = L.Body.count(Branch->getOperand(1)) != 0;
+  const Instruction *Cond = GetDef(Branch->getOperand(0));
+  while (Cond && Cond->getOpcode() == SpvOpLogicalNot)
+  {
+    ContinueIf = !ContinueIf;
+    Cond = GetDef(Cond->getOperand(2));
+  }
+  if (!Cond || Cond->getNumOperands() != 4)
+    return 0;
+
+  // Returns the header phi that Inst adds a constant step to, or nullptr.
+  auto GetIncrement = [&](const Instruction *Inst, uint64_t &Step) {
+    if (!Inst || (Inst->getOpcode() != SpvOpIAdd &&
+                  Inst->getOpcode() != SpvOpISub))
+      return (const Instruction *)nullptr;
+    for (unsigned i = 2; i < 4; i++)
+    {
+      const Instruction *Phi = GetDef(Inst->getOperand(i));
+      if (!Phi || Phi->getOpcode() != SpvOpPhi ||
+          !getConstant(Inst->getOperand(5 - i), Step))
+        continue;
+      if (Inst->getOpcode() == SpvOpISub)
+      {
+        if (i != 2)
+          continue;
+        Step = -Step;
+      }
+      return Phi;
+    }
+    return (const Instruction *)nullptr;
+  };
+
+  // Find the induction variable and the bound it is compared against.
+  for (unsigned Side = 2; Side < 4; Side++)
+  {
+    uint64_t Bound;
+    if (!getConstant(Cond->getOperand(5 - Side), Bound))
+      continue;
+
+    // The condition may test the value of the phi or its next value.
+    uint64_t Step = 0;
+    const Instruction *Compared = GetDef(Cond->getOperand(Side));
+    const Instruction *Phi = Compared;
+    bool UsesNext = false;
+    if (!Phi || Phi->getOpcode() != SpvOpPhi)
+    {
+      Phi = GetIncrement(Compared, Step);
+      UsesNext = true;
+    }
+    if (!Phi || Phi->getNumOperands() != 6)
+      continue;
+
+    // Find the initial value and the update of the phi.
+    uint64_t Init;
+    unsigned InitIndex = L.Body.count(Phi->getOperand(3)) ? 4 : 2;
+    unsigned NextIndex = InitIndex == 2 ? 4 : 2;
+    if (L.Body.count(Phi->getOperand(InitIndex + 1)) ||
+        !L.Body.count(Phi->getOperand(NextIndex + 1)) ||
+        !getConstant(Phi->getOperand(InitIndex), Init))
+      continue;
+    const Instruction *Next = GetDef(Phi->getOperand(NextIndex));
+    if (GetIncrement(Next, Step) != Phi || (UsesNext && Next != Compared))
+      continue;
+
+    // Simulate the loop, counting the executions of the header.
+    unsigned Width = Phi->getResultType()->getBitWidth();
+    uint64_t Mask = Width < 64 ? (1ULL << Width) - 1 : (uint64_t)-1;
+    uint64_t Value = Init & Mask;
+    Bound &= Mask;
+    for (uint64_t Trips = 1; Trips <= MAX_TRIPS; Trips++)
+    {
+      uint64_t Tested = UsesNext ? (Value + Step) & Mask : Value;
+      bool Result;
+      if (!compare(Cond->getOpcode(), Side == 2 ? Tested : Bound,
+                   Side == 2 ? Bound : Tested, Width, Result))
+        return 0;
+      if (Result != ContinueIf)
+        return Trips;
+      Value = (Value + Step) & Mask;
+    }
+    return 0;
+  }
+
+  return 0;
+}
+
+bool CostEstimator::getConstant(uint32_t Id, uint64_t &Value) const
+{
+  if (Id >= Objects.size() || !Objects[Id])
+    return false;
+
+  const Type *Ty = Objects[Id].getType();
+  if (!Ty || !Ty->isInt())
+    return false;
+  if (Ty->getBitWidth() == 64)
+    Value = Objects[Id].get<uint64_t>();
+  else if (Ty->getBitWidth() == 32)
+    Value = Objects[Id].get<uint32_t>();
+  else if (Ty->getBitWidth() == 16)
+    Value = Objects[Id].get<uint16_t>();
+  else
+    return false;
+  return true;
+}
+
+uint64_t CostEstimator::getInstructionCost(const Instruction *Inst) const
+{
+  uint16_t Opcode = Inst->getOpcode();
+  uint64_t Cost =
+      Model.getLatency(PerformanceCounters::getInstructionClass(Opcode));
+
+  // Add the latency of memory accesses.
+  switch (Opcode)
+  {
+  case SpvOpLoad:
+  case SpvOpAtomicLoad:
+  case SpvOpAtomicAnd:
+  case SpvOpAtomicCompareExchange:
+  case SpvOpAtomicExchange:
+  case SpvOpAtomicIAdd:
+  case SpvOpAtomicIDecrement:
+  case SpvOpAtomicIIncrement:
+  case SpvOpAtomicISub:
+  case SpvOpAtomicOr:
+  case SpvOpAtomicSMax:
+  case SpvOpAtomicSMin:
+  case SpvOpAtomicUMax:
+  case SpvOpAtomicUMin:
+  case SpvOpAtomicXor:
+    Cost += getMemoryLatency(Inst->getOperand(2));
+    break;
+  case SpvOpStore:
+  case SpvOpAtomicStore:
+    Cost += getMemoryLatency(Inst->getOperand(0));
+    break;
+  case SpvOpCopyMemory:
+    Cost += getMemoryLatency(Inst->getOperand(0));
+    Cost += getMemoryLatency(Inst->getOperand(1));
+    break;
+  default:
+    break;
+  }
+  return Cost;
+}
+
+uint64_t CostEstimator::getMemoryLatency(uint32_t Id) const
+{
+  // Assume that pointers of unknown origin (e.g. function parameters) point
+  // to device memory.
+  auto Itr = StorageClasses.find(Id);
+  MemoryScope Scope = Itr == StorageClasses.end() ? MemoryScope::Device
+                                                  : getScope(Itr->second);
+  return Model.getMemoryParams(Scope).Latency;
+}
+
+void CostEstimator::print(std::ostream &O, uint64_t NumInvocations) const
+{
+  std::ostringstream SS;
+  SS << std::fixed << std::setprecision(1);
+  SS << "Static cost estimate for entry point '"
+     << Stage.getEntryPoint()->getName() << "':" << std::endl;
+  SS << "  Per invocation: " << InvocationCost << " cycles" << std::endl;
+  SS << "  Per dispatch: " << NumInvocations << " invocations, "
+     << InvocationCost * NumInvocations << " cycles" << std::endl;
+
+  if (!Loops.empty())
+  {
+    SS << "  Loops:" << std::endl;
+    for (const LoopTrips &L : Loops)
+    {
+      SS << "    %" << L.Header << " in function %" << L.Func->getId() << ": ";
+      if (L.Known)
+        SS << L.Trips << " header executions" << std::endl;
+      else
+        SS << "unknown, assuming " << L.Trips << " header executions"
+           << std::endl;
+    }
+  }
+
+  SS << "  Blocks:" << std::endl;
+  for (const BlockCost &B : Blocks)
+  {
+    SS << "    %" << B.Id << " in function %" << B.Func->getId() << ": "
+       << B.Frequency << " executions per call, " << B.Cost << " cycles each"
+       << std::endl;
+  }
+
+  O << SS.str();
+}
+
+} // namespace talvos
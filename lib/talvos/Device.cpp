@@ -6,7 +6,6 @@
 /// \file Device.cpp
 /// This file defines the Device class.
 
-#include <atomic>
 #include <cassert>
 #include <chrono>
 #include <condition_variable> // for condition_variable
@@ -29,15 +28,22 @@
 #endif
 
 #include "Utils.h"
+#include "talvos/Commands.h"
 #include "talvos/Device.h"
 #include "talvos/Dim3.h"
 #include "talvos/EntryPoint.h"
 #include "talvos/Instruction.h"
 #include "talvos/Invocation.h"
 #include "talvos/Memory.h"
+#include "talvos/Module.h"
+#include "talvos/PerformanceCounters.h"
 #include "talvos/PipelineExecutor.h"
 #include "talvos/PipelineStage.h"
 #include "talvos/Plugin.h"
+#include "talvos/Roofline.h"
+#include "talvos/SamplingProfiler.h"
+#include "talvos/TimingModel.h"
+#include "talvos/WorkgroupSampler.h"
 #include "talvos/Workgroup.h"
 
 namespace talvos
@@ -51,11 +57,9 @@ namespace talvos
 typedef Plugin *(*CreatePluginFunc)(const Device *);
 typedef void (*DestroyPluginFunc)(Plugin *);
 
-// Counter for the number of errors reported.
-static std::atomic<size_t> NumErrors;
-
 Device::Device(uint64_t Cores, uint64_t Lanes) : Cores(Cores), Lanes(Lanes)
 {
+  Counters = new PerformanceCounters;
   GlobalMemory = new Memory(*this, MemoryScope::Device);
 
   // Load plugins from dynamic libraries.
@@ -114,6 +118,51 @@ Device::Device(uint64_t Cores, uint64_t Lanes) : Cores(Cores), Lanes(Lanes)
 
   NumErrors = 0;
   MaxErrors = getEnvUInt("TALVOS_MAX_ERRORS", 100);
+
+  // Create sampling profiler if requested.
+  Profiler = nullptr;
+  if (uint64_t Interval = getEnvUInt("TALVOS_PROFILE_INTERVAL", 0))
+    Profiler = new SamplingProfiler(
+        Interval, getEnvUInt("TALVOS_PROFILE_BUFFER_SIZE", 65536));
+
+  // Create timing model if a device description file was provided.
+  Timing = nullptr;
+  if (const char *DeviceFile = getenv("TALVOS_DEVICE_FILE"))
+  {
+    Timing = new TimingModel(Cores, Lanes);
+    if (!Timing->load(DeviceFile))
+      abort();
+  }
+
+  // Create roofline model if requested, using the default device parameters if
+  // no device description file was provided.
+  RooflineModel = nullptr;
+  if (checkEnv("TALVOS_ROOFLINE", false))
+  {
+    if (Timing)
+      RooflineModel = new Roofline(*Timing);
+    else
+      RooflineModel = new Roofline(TimingModel(Cores, Lanes));
+  }
+
+  // Create workgroup sampler if requested.
+  Sampler = nullptr;
+  uint64_t SampleGroups = getEnvUInt("TALVOS_SAMPLE_GROUPS", 0);
+  double SampleFraction = getEnvDouble("TALVOS_SAMPLE_FRACTION", 1.0);
+  if (SampleFraction <= 0 || SampleFraction > 1)
+  {
+    std::cerr << std::endl
+              << "ERROR: TALVOS_SAMPLE_FRACTION must be in the range (0, 1]"
+              << std::endl;
+    abort();
+  }
+  if (SampleGroups || SampleFraction < 1)
+    Sampler = new WorkgroupSampler(SampleGroups, SampleFraction,
+                                   getEnvUInt("TALVOS_SAMPLE_SEED", 1));
+
+  // A stage cache size of zero disables the cache.
+  StageCache = new PipelineStageCache(
+      getEnvUInt("TALVOS_STAGE_CACHE_SIZE", 64, true));
 }
 
 Device::~Device()
@@ -134,8 +183,14 @@ Device::~Device()
 #endif
   }
 
+  delete StageCache;
+  delete Sampler;
+  delete RooflineModel;
+  delete Timing;
+  delete Profiler;
   delete Executor;
   delete GlobalMemory;
+  delete Counters;
 }
 
 bool Device::isThreadSafe() const
@@ -204,6 +259,12 @@ void Device::reportError(const std::string &Error, bool Fatal)
       // Show current instruction.
       std::cerr << "      ";
       Inv->getCurrentInstruction()->print(std::cerr, false);
+
+      // Show source location if the module has line information.
+      std::ostringstream Loc;
+      if (Stage.getModule()->printSourceLocation(
+              Loc, Inv->getCurrentInstruction()))
+        std::cerr << std::endl << "    Source: " << Loc.str();
     }
     else
     {
@@ -246,27 +307,63 @@ void Device::reportAtomicAccess(const Memory *Mem, uint64_t Address,
 {
   const Invocation *Invoc = Executor->getCurrentInvocation();
   assert(Invoc);
+  Counters->add(PerformanceCounters::ATOMICS);
+  if (Timing)
+    Timing->memoryAccess(Mem->getScope(), NumBytes);
   REPORT(atomicAccess, Mem, Address, NumBytes, Opcode, Scope, Semantics, Invoc);
 }
 
 void Device::reportCommandBegin(const Command *Cmd)
 {
+  if (Timing && Cmd->getType() == Command::DISPATCH)
+    Timing->beginDispatch();
+  if (Sampler)
+    Sampler->commandBegin(Cmd, *Counters);
+  if (RooflineModel)
+    RooflineModel->commandBegin(Cmd, *Counters);
   REPORT(commandBegin, Cmd);
 }
 
 void Device::reportCommandComplete(const Command *Cmd)
 {
+  if (Profiler)
+    Profiler->commandComplete(Cmd);
+
+  // Extrapolate a sampled dispatch before anything reports on it.
+  if (Sampler)
+    Sampler->commandComplete(Cmd, *Counters);
+  if (Timing && Cmd->getType() == Command::DISPATCH)
+  {
+    if (Sampler)
+      Timing->extrapolate(Sampler->getNumGroups());
+    std::cerr << std::endl;
+    Timing->print(std::cerr);
+    Counters->add(PerformanceCounters::MODELED_CYCLES, Timing->endDispatch());
+  }
+  if (RooflineModel)
+    RooflineModel->commandComplete(Cmd, *Counters);
   REPORT(commandComplete, Cmd);
 }
 
 void Device::reportInstructionExecuted(const Invocation *Invoc,
                                        const Instruction *Inst)
 {
+  Counters->addInstruction(Inst->getOpcode());
+  if (RooflineModel)
+  {
+    if (uint64_t Flops = Roofline::countFlops(Invoc, Inst))
+      Counters->add(PerformanceCounters::FLOPS, Flops);
+  }
+  if (Timing && Executor->isWorkerThread())
+    Timing->issue(Inst->getOpcode());
+  if (Sampler)
+    Sampler->instructionExecuted(Executor->getCurrentWorkgroup());
   REPORT(instructionExecuted, Invoc, Inst);
 }
 
 void Device::reportInvocationBegin(const Invocation *Invoc)
 {
+  Counters->add(PerformanceCounters::INVOCATIONS);
   REPORT(invocationBegin, Invoc);
 }
 
@@ -282,6 +379,9 @@ void Device::reportMemoryLoad(const Memory *Mem, uint64_t Address,
   {
     // TODO: Workgroup/subgroup level accesses?
     // TODO: Workgroup/Invocation scope initialization is not covered.
+    Counters->addBytesLoaded(Mem->getScope(), NumBytes);
+    if (Timing)
+      Timing->memoryAccess(Mem->getScope(), NumBytes);
     if (auto *I = Executor->getCurrentInvocation())
       REPORT(memoryLoad, Mem, Address, NumBytes, I);
   }
@@ -304,6 +404,9 @@ void Device::reportMemoryStore(const Memory *Mem, uint64_t Address,
   {
     // TODO: Workgroup/subgroup level accesses?
     // TODO: Workgroup/Invocation scope initialization is not covered.
+    Counters->addBytesStored(Mem->getScope(), NumBytes);
+    if (Timing)
+      Timing->memoryAccess(Mem->getScope(), NumBytes);
     if (auto *I = Executor->getCurrentInvocation())
       REPORT(memoryStore, Mem, Address, NumBytes, Data, I);
   }
@@ -320,16 +423,20 @@ void Device::reportMemoryUnmap(const Memory *Memory, uint64_t Base)
 
 void Device::reportWorkgroupBegin(const Workgroup *Group)
 {
+  Counters->add(PerformanceCounters::WORKGROUPS);
   REPORT(workgroupBegin, Group);
 }
 
 void Device::reportWorkgroupBarrier(const Workgroup *Group)
 {
+  Counters->add(PerformanceCounters::BARRIERS);
   REPORT(workgroupBarrier, Group);
 }
 
 void Device::reportWorkgroupComplete(const Workgroup *Group)
 {
+  if (Sampler)
+    Sampler->workgroupComplete(Group);
   REPORT(workgroupComplete, Group);
 }
 
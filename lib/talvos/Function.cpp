@@ -19,6 +19,7 @@ Function::Function(uint32_t Id, const Type *FuncType)
 {
   this->Id = Id;
   this->FunctionType = FuncType;
+  this->Materialized = false;
 }
 
 void Function::addBlock(std::unique_ptr<Block> B)
@@ -10,8 +10,10 @@
 #include <cassert>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <sstream>
+#include <type_traits>
 
 #include <spirv/unified1/GLSL.std.450.h>
 #include <spirv/unified1/spirv.h>
@@ -27,9 +29,11 @@
 #include "talvos/Invocation.h"
 #include "talvos/Memory.h"
 #include "talvos/Module.h"
+#include "talvos/PerformanceCounters.h"
 #include "talvos/PipelineContext.h"
 #include "talvos/PipelineExecutor.h"
 #include "talvos/PipelineStage.h"
+#include "talvos/SamplingProfiler.h"
 #include "talvos/Type.h"
 #include "talvos/Variable.h"
 #include "talvos/Workgroup.h"
@@ -44,6 +48,9 @@ Invocation::Invocation(Device &Dev, const std::vector<Object> &InitialObjects)
     : Dev(Dev)
 {
   CurrentInstruction = nullptr;
+  CurrentStage = nullptr;
+  Compiled = nullptr;
+  Group = nullptr;
   PrivateMemory = nullptr;
   PipelineMemory = nullptr;
   Objects = InitialObjects;
@@ -58,9 +65,13 @@ Invocation::Invocation(Device &Dev, const PipelineStage &Stage,
   PrivateMemory = new Memory(Dev, MemoryScope::Invocation);
 
   AtBarrier = false;
+  LastBarrier = nullptr;
+  InstructionsSinceBarrier = 0;
   Discarded = false;
+  CurrentStage = &Stage;
   CurrentModule = Stage.getModule();
   CurrentFunction = Stage.getEntryPoint()->getFunction();
+  Stage.enterFunction(CurrentFunction);
   moveToBlock(CurrentFunction->getFirstBlockId());
 
   // Clone initial object values.
@@ -312,8 +323,23 @@ void Invocation::executeAccessChain(const Instruction *Inst)
     }
   }
 
-  // Loop over indices.
-  for (uint32_t i = FirstIndexOperand; i < Inst->getNumOperands(); i++)
+  // Apply the leading constant indices that were folded when the pipeline
+  // stage was created.
+  uint32_t FirstDynamicOperand = FirstIndexOperand;
+  if (CurrentStage && !Base.getDescriptorElements())
+  {
+    const FoldedAccessChain *Folded = CurrentStage->getFoldedAccessChain(Id);
+    if (Folded)
+    {
+      Result += Folded->Offset;
+      Ty = Folded->Ty;
+      MatrixLayout = Folded->MatrixLayout;
+      FirstDynamicOperand += Folded->NumIndices;
+    }
+  }
+
+  // Loop over remaining indices.
+  for (uint32_t i = FirstDynamicOperand; i < Inst->getNumOperands(); i++)
   {
     uint64_t Index;
     const Object &IndexObj = Objects[Inst->getOperand(i)];
@@ -348,45 +374,9 @@ void Invocation::executeAccessChain(const Instruction *Inst)
         Result = 0;
       }
     }
-    else if (Ty->isMatrix() && MatrixLayout)
-    {
-      // Special case for matrix pointers with non-default layouts.
-      if (MatrixLayout.Order == PtrMatrixLayout::COL_MAJOR)
-        Result += Index * MatrixLayout.Stride;
-      else
-        Result += Index * ElemTy->getElementType()->getSize();
-    }
-    else if (Ty->isVector() && MatrixLayout)
-    {
-      // Special case for vector pointers with non-default layouts.
-      if (MatrixLayout.Order == PtrMatrixLayout::COL_MAJOR)
-        Result += Index * ElemTy->getSize();
-      else
-        Result += Index * MatrixLayout.Stride;
-    }
     else
     {
-      Result += Ty->getElementOffset(Index);
-    }
-
-    // Check for structure member decorations that affect memory layout.
-    if (Ty->getTypeId() == Type::STRUCT)
-    {
-      auto &Decorations = Ty->getStructMemberDecorations((uint32_t)Index);
-      if (Decorations.count(SpvDecorationMatrixStride))
-      {
-        // Track matrix layout.
-        MatrixLayout.Stride = Decorations.at(SpvDecorationMatrixStride);
-        if (Decorations.count(SpvDecorationColMajor))
-        {
-          MatrixLayout.Order = PtrMatrixLayout::COL_MAJOR;
-        }
-        else
-        {
-          assert(Decorations.count(SpvDecorationRowMajor));
-          MatrixLayout.Order = PtrMatrixLayout::ROW_MAJOR;
-        }
-      }
+      Result += Ty->getElementOffset(Index, MatrixLayout);
     }
 
     Ty = ElemTy;
@@ -548,6 +538,7 @@ void Invocation::executeControlBarrier(const Instruction *Inst)
   // TODO: Handle other execution scopes
   assert(Objects[Inst->getOperand(0)].get<uint32_t>() == SpvScopeWorkgroup);
   AtBarrier = true;
+  LastBarrier = Inst;
 }
 
 void Invocation::executeConvertFToS(const Instruction *Inst)
@@ -643,11 +634,12 @@ void Invocation::executeDispatch_Talvos(const Instruction *Inst)
 {
   static int cnt = 0;
 
-  talvos::PipelineStage *Stage = new talvos::PipelineStage(
-      Dev, CurrentModule,
-      CurrentModule->getEntryPoint(cnt++ ? "FILL" : "SERIES",
-                                   6 /*EXEC_MODEL_GLCOMPUTE*/),
-      {});
+  std::shared_ptr<const talvos::PipelineStage> Stage =
+      Dev.getPipelineStageCache().get(
+          Dev, CurrentModule,
+          CurrentModule->getEntryPoint(cnt++ ? "FILL" : "SERIES",
+                                       6 /*EXEC_MODEL_GLCOMPUTE*/),
+          {});
 
   talvos::ComputePipeline ComputePipeline(Stage);
 
@@ -876,7 +868,9 @@ void Invocation::executeFSub(const Instruction *Inst)
 
 void Invocation::executeFunctionCall(const Instruction *Inst)
 {
-  const Function *Func = CurrentModule->getFunction(Inst->getOperand(2));
+  const Function *Func = CurrentStage
+                             ? CurrentStage->getCallee(Inst->getOperand(1))
+                             : CurrentModule->getFunction(Inst->getOperand(2));
 
   // Copy function parameters.
   assert(Inst->getNumOperands() == Func->getNumParams() + 3);
@@ -888,10 +882,13 @@ void Invocation::executeFunctionCall(const Instruction *Inst)
   SE.CallInst = Inst;
   SE.CallFunc = CurrentFunction;
   SE.CallBlock = CurrentBlock;
+  SE.FirstAllocation = FunctionAllocations.size();
   CallStack.push_back(SE);
 
   // Move to first block of callee function.
   CurrentFunction = Func;
+  if (CurrentStage)
+    CurrentStage->enterFunction(Func);
   moveToBlock(CurrentFunction->getFirstBlockId());
 }
 
@@ -1294,12 +1291,13 @@ void Invocation::executeReturn(const Instruction *Inst)
   if (CallStack.empty())
     return;
 
-  StackEntry SE = CallStack.back();
+  const StackEntry SE = CallStack.back();
   CallStack.pop_back();
 
   // Release function scope allocations.
-  for (uint64_t Address : SE.Allocations)
-    PrivateMemory->release(Address);
+  for (size_t i = SE.FirstAllocation; i < FunctionAllocations.size(); i++)
+    PrivateMemory->release(FunctionAllocations[i]);
+  FunctionAllocations.resize(SE.FirstAllocation);
 
   // Return to calling function.
   CurrentFunction = SE.CallFunc;
@@ -1311,15 +1309,16 @@ void Invocation::executeReturnValue(const Instruction *Inst)
 {
   assert(!CallStack.empty());
 
-  StackEntry SE = CallStack.back();
+  const StackEntry SE = CallStack.back();
   CallStack.pop_back();
 
   // Set return value.
   Objects[SE.CallInst->getOperand(1)] = Objects[Inst->getOperand(0)];
 
   // Release function scope allocations.
-  for (uint64_t Address : SE.Allocations)
-    PrivateMemory->release(Address);
+  for (size_t i = SE.FirstAllocation; i < FunctionAllocations.size(); i++)
+    PrivateMemory->release(FunctionAllocations[i]);
+  FunctionAllocations.resize(SE.FirstAllocation);
 
   // Return to calling function.
   CurrentFunction = SE.CallFunc;
@@ -1402,17 +1401,20 @@ void Invocation::executeSGreaterThanEqual(const Instruction *Inst)
 
 void Invocation::executeShiftLeftLogical(const Instruction *Inst)
 {
-  executeOpUInt<2>(Inst, [](auto A, auto B) -> decltype(A) { return A << B; });
+  executeShiftInt<false>(
+      Inst, [](auto A, uint64_t B) -> decltype(A) { return A << B; });
 }
 
 void Invocation::executeShiftRightArithmetic(const Instruction *Inst)
 {
-  executeOpSInt<2>(Inst, [](auto A, auto B) -> decltype(A) { return A >> B; });
+  executeShiftInt<true>(
+      Inst, [](auto A, uint64_t B) -> decltype(A) { return A >> B; });
 }
 
 void Invocation::executeShiftRightLogical(const Instruction *Inst)
 {
-  executeOpUInt<2>(Inst, [](auto A, auto B) -> decltype(A) { return A >> B; });
+  executeShiftInt<false>(
+      Inst, [](auto A, uint64_t B) -> decltype(A) { return A >> B; });
 }
 
 void Invocation::executeSLessThan(const Instruction *Inst)
@@ -1542,7 +1544,7 @@ void Invocation::executeVariable(const Instruction *Inst)
 
   // Track function scope allocations.
   if (!CallStack.empty())
-    CallStack.back().Allocations.push_back(Address);
+    FunctionAllocations.push_back(Address);
 }
 
 void Invocation::executeVectorExtractDynamic(const Instruction *Inst)
@@ -1725,6 +1727,10 @@ void Invocation::moveToBlock(uint32_t Id)
   CurrentInstruction = B->getLabel().next();
   PreviousBlock = CurrentBlock;
   CurrentBlock = Id;
+  Compiled = CurrentStage ? CurrentStage->getCompiledBlock(Id) : nullptr;
+  CompiledIndex = 0;
+  if (Compiled)
+    Dev.getCounters().add(PerformanceCounters::COMPILED_BLOCKS);
 }
 
 void Invocation::step()
@@ -1734,6 +1740,10 @@ void Invocation::step()
 
   const Instruction *I = CurrentInstruction;
 
+  // Record a profiling sample if one has been requested.
+  if (Dev.getProfiler() && Dev.getProfiler()->isSampleRequested())
+    Dev.getProfiler()->sample(this);
+
   if (!PhiTemps.empty() && I->getOpcode() != SpvOpPhi &&
       I->getOpcode() != SpvOpLine)
   {
@@ -1742,14 +1752,28 @@ void Invocation::step()
     PhiTemps.clear();
   }
 
-  execute(I);
+  // Use the compiled handler if this invocation is still following the
+  // compiled block, which it leaves when returning from a function call.
+  if (Compiled && CompiledIndex < Compiled->Instructions.size() &&
+      Compiled->Instructions[CompiledIndex].Inst == I)
+  {
+    Compiled->Instructions[CompiledIndex++].Exec(*this);
+  }
+  else
+  {
+    Compiled = nullptr;
+    execute(I);
+  }
 
   // Move program counter to next instruction, unless a terminator instruction
   // was executed.
   if (I == CurrentInstruction)
     CurrentInstruction = CurrentInstruction->next();
 
+  InstructionsSinceBarrier++;
   Dev.reportInstructionExecuted(this, I);
+  if (Group)
+    Group->addInstruction();
 
   if (getState() == FINISHED)
     Dev.reportInvocationComplete(this);
@@ -1775,22 +1799,79 @@ static auto apply(const std::array<OpTy, 3> Operands, const F &Op)
   return Op(Operands[0], Operands[1], Operands[2]);
 }
 
+/// Apply \p Op to each of the \p Width components of \p N operands.
+/// The vector width is a compile-time constant, so that each instantiation
+/// (e.g. FAdd on float x 4) becomes straight-line code that the compiler can
+/// unroll and vectorize.
+template <typename OpTy, unsigned N, unsigned Width, typename F>
+static void applyKernel(uint8_t *Result,
+                        const std::array<const uint8_t *, N> &Data,
+                        const F &Op)
+{
+  typedef decltype(apply(std::array<OpTy, N>(), Op)) ResultTy;
+
+  std::array<std::array<OpTy, Width>, N> Operands;
+  for (unsigned j = 0; j < N; j++)
+    memcpy(Operands[j].data(), Data[j], sizeof(OpTy) * Width);
+
+  std::array<ResultTy, Width> Results;
+  for (unsigned i = 0; i < Width; i++)
+  {
+    std::array<OpTy, N> Args;
+    for (unsigned j = 0; j < N; j++)
+      Args[j] = Operands[j][i];
+    Results[i] = apply(Args, Op);
+  }
+
+  memcpy(Result, Results.data(), sizeof(ResultTy) * Width);
+}
+
 template <typename OpTy, unsigned N, unsigned Offset, typename F>
 void Invocation::executeOp(const Instruction *Inst, const F &Op)
 {
   uint32_t Id = Inst->getOperand(1);
   Object Result(Inst->getResultType());
-  std::array<OpTy, N> Operands;
+  uint32_t NumElements = Inst->getResultType()->getElementCount();
 
-  // Loop over each vector component.
-  for (uint32_t i = 0; i < Inst->getResultType()->getElementCount(); i++)
+  std::array<const uint8_t *, N> Data;
+  for (unsigned j = 0; j < N; j++)
   {
-    // Gather operands.
-    for (unsigned j = 0; j < N; j++)
-      Operands[j] = Objects[Inst->getOperand(Offset + j)].get<OpTy>(i);
+    const Object &Operand = Objects[Inst->getOperand(Offset + j)];
+    assert(Operand.getType()->getScalarType()->getSize() == sizeof(OpTy));
+    assert(Operand.getType()->getElementCount() == NumElements);
+    Data[j] = Operand.getData();
+  }
 
-    // Apply lambda and set result.
-    Result.set(apply(Operands, Op), i);
+  // Select a kernel specialized for the vector width.
+  switch (NumElements)
+  {
+  case 1:
+    applyKernel<OpTy, N, 1>(Result.getData(), Data, Op);
+    break;
+  case 2:
+    applyKernel<OpTy, N, 2>(Result.getData(), Data, Op);
+    break;
+  case 3:
+    applyKernel<OpTy, N, 3>(Result.getData(), Data, Op);
+    break;
+  case 4:
+    applyKernel<OpTy, N, 4>(Result.getData(), Data, Op);
+    break;
+  default:
+  {
+    // Loop over each vector component.
+    std::array<OpTy, N> Operands;
+    for (uint32_t i = 0; i < NumElements; i++)
+    {
+      // Gather operands.
+      for (unsigned j = 0; j < N; j++)
+        Operands[j] = Objects[Inst->getOperand(Offset + j)].get<OpTy>(i);
+
+      // Apply lambda and set result.
+      Result.set(apply(Operands, Op), i);
+    }
+    break;
+  }
   }
 
   Objects[Id] = Result;
@@ -1849,20 +1930,246 @@ void Invocation::executeOpUInt(const Instruction *Inst, const F &&Op)
   switch (OpType->getBitWidth())
   {
   case 8:
-    executeOp<uint8_t, N>(Inst, Op);
+    executeOp<uint8_t, N, Offset>(Inst, Op);
     break;
   case 16:
-    executeOp<uint16_t, N>(Inst, Op);
+    executeOp<uint16_t, N, Offset>(Inst, Op);
     break;
   case 32:
-    executeOp<uint32_t, N>(Inst, Op);
+    executeOp<uint32_t, N, Offset>(Inst, Op);
     break;
   case 64:
-    executeOp<uint64_t, N>(Inst, Op);
+    executeOp<uint64_t, N, Offset>(Inst, Op);
     break;
   default:
     assert(false && "Unhandled binary operation integer width");
   }
 }
 
+template <typename BaseTy, typename F>
+void Invocation::executeShift(const Instruction *Inst, const F &Op)
+{
+  uint32_t Id = Inst->getOperand(1);
+  const Object &Base = Objects[Inst->getOperand(2)];
+  const Object &Shift = Objects[Inst->getOperand(3)];
+  Object Result(Inst->getResultType());
+
+  // Read each shift amount at the width of the shift operand, which is not
+  // required to match the width of the base.
+  uint32_t ShiftWidth = Shift.getType()->getScalarType()->getBitWidth();
+  for (uint32_t i = 0; i < Inst->getResultType()->getElementCount(); i++)
+  {
+    uint64_t Amount;
+    switch (ShiftWidth)
+    {
+    case 8:
+      Amount = Shift.get<uint8_t>(i);
+      break;
+    case 16:
+      Amount = Shift.get<uint16_t>(i);
+      break;
+    case 32:
+      Amount = Shift.get<uint32_t>(i);
+      break;
+    case 64:
+      Amount = Shift.get<uint64_t>(i);
+      break;
+    default:
+      assert(false && "Unhandled shift operand integer width");
+      Amount = 0;
+    }
+    Result.set<BaseTy>(Op(Base.get<BaseTy>(i), Amount), i);
+  }
+
+  Objects[Id] = Result;
+}
+
+template <bool Signed, typename F>
+void Invocation::executeShiftInt(const Instruction *Inst, const F &&Op)
+{
+  const Type *BaseType = Objects[Inst->getOperand(2)].getType();
+  BaseType = BaseType->getScalarType();
+  assert(BaseType->isInt());
+  switch (BaseType->getBitWidth())
+  {
+  case 8:
+    executeShift<std::conditional_t<Signed, int8_t, uint8_t>>(Inst, Op);
+    break;
+  case 16:
+    executeShift<std::conditional_t<Signed, int16_t, uint16_t>>(Inst, Op);
+    break;
+  case 32:
+    executeShift<std::conditional_t<Signed, int32_t, uint32_t>>(Inst, Op);
+    break;
+  case 64:
+    executeShift<std::conditional_t<Signed, int64_t, uint64_t>>(Inst, Op);
+    break;
+  default:
+    assert(false && "Unhandled shift operation integer width");
+  }
+}
+
+// Private helper functions for compiling simple instructions.
+
+std::function<void(Invocation &)>
+Invocation::compile(const Instruction *Inst,
+                    const std::vector<Object> &Constants)
+{
+  std::function<void(Invocation &)> Handler;
+  switch (Inst->getOpcode())
+  {
+  case SpvOpBranch:
+  {
+    uint32_t Target = Inst->getOperand(0);
+    Handler = [Target](Invocation &Invoc) { Invoc.moveToBlock(Target); };
+    break;
+  }
+  case SpvOpBranchConditional:
+  {
+    uint32_t Condition = Inst->getOperand(0);
+    uint32_t TrueTarget = Inst->getOperand(1);
+    uint32_t FalseTarget = Inst->getOperand(2);
+    Handler = [=](Invocation &Invoc) {
+      bool Taken = Invoc.Objects[Condition].get<bool>();
+      Invoc.moveToBlock(Taken ? TrueTarget : FalseTarget);
+    };
+    break;
+  }
+  case SpvOpFAdd:
+    Handler = compileOpFP(Inst, Constants, [](auto A, auto B) -> decltype(A) {
+      return A + B;
+    });
+    break;
+  case SpvOpFDiv:
+    Handler = compileOpFP(Inst, Constants, [](auto A, auto B) -> decltype(A) {
+      return A / B;
+    });
+    break;
+  case SpvOpFMul:
+    Handler = compileOpFP(Inst, Constants, [](auto A, auto B) -> decltype(A) {
+      return A * B;
+    });
+    break;
+  case SpvOpFSub:
+    Handler = compileOpFP(Inst, Constants, [](auto A, auto B) -> decltype(A) {
+      return A - B;
+    });
+    break;
+  case SpvOpIAdd:
+    Handler = compileOpUInt(Inst, Constants, [](auto A, auto B) -> decltype(A) {
+      return A + B;
+    });
+    break;
+  case SpvOpIMul:
+    Handler = compileOpUInt(Inst, Constants, [](auto A, auto B) -> decltype(A) {
+      return A * B;
+    });
+    break;
+  case SpvOpISub:
+    Handler = compileOpUInt(Inst, Constants, [](auto A, auto B) -> decltype(A) {
+      return A - B;
+    });
+    break;
+  case SpvOpLine:
+  case SpvOpLoopMerge:
+  case SpvOpNoLine:
+  case SpvOpNop:
+  case SpvOpSelectionMerge:
+    Handler = [](Invocation &) {};
+    break;
+  default:
+    break;
+  }
+
+  // Fall back to the interpreter.
+  if (!Handler)
+    Handler = [Inst](Invocation &Invoc) { Invoc.execute(Inst); };
+  return Handler;
+}
+
+template <typename OpTy, unsigned Width, typename F>
+std::function<void(Invocation &)>
+Invocation::compileKernel(const Instruction *Inst,
+                          const std::vector<Object> &Constants, const F &Op)
+{
+  const Type *ResultType = Inst->getResultType();
+  uint32_t ResultId = Inst->getOperand(1);
+
+  // Resolve each operand to either a result ID or a folded constant.
+  std::array<uint32_t, 2> Ids;
+  std::array<Object, 2> Values;
+  for (unsigned j = 0; j < 2; j++)
+  {
+    Ids[j] = Inst->getOperand(2 + j);
+    if (Constants[Ids[j]])
+      Values[j] = Constants[Ids[j]];
+  }
+
+  return [=](Invocation &Invoc) {
+    std::array<const uint8_t *, 2> Data;
+    for (unsigned j = 0; j < 2; j++)
+      Data[j] =
+          Values[j] ? Values[j].getData() : Invoc.Objects[Ids[j]].getData();
+
+    // Write the result in place, reusing the object from a previous
+    // execution of this instruction if there is one.
+    Object &Result = Invoc.Objects[ResultId];
+    if (!Result)
+      Result = Object(ResultType);
+    applyKernel<OpTy, 2, Width>(Result.getData(), Data, Op);
+  };
+}
+
+template <typename OpTy, typename F>
+std::function<void(Invocation &)>
+Invocation::compileOp(const Instruction *Inst,
+                      const std::vector<Object> &Constants, const F &Op)
+{
+  switch (Inst->getResultType()->getElementCount())
+  {
+  case 1:
+    return compileKernel<OpTy, 1>(Inst, Constants, Op);
+  case 2:
+    return compileKernel<OpTy, 2>(Inst, Constants, Op);
+  case 3:
+    return compileKernel<OpTy, 3>(Inst, Constants, Op);
+  case 4:
+    return compileKernel<OpTy, 4>(Inst, Constants, Op);
+  default:
+    return nullptr;
+  }
+}
+
+template <typename F>
+std::function<void(Invocation &)>
+Invocation::compileOpFP(const Instruction *Inst,
+                        const std::vector<Object> &Constants, const F &Op)
+{
+  switch (Inst->getResultType()->getScalarType()->getBitWidth())
+  {
+  case 32:
+    return compileOp<float>(Inst, Constants, Op);
+  case 64:
+    return compileOp<double>(Inst, Constants, Op);
+  default:
+    return nullptr;
+  }
+}
+
+template <typename F>
+std::function<void(Invocation &)>
+Invocation::compileOpUInt(const Instruction *Inst,
+                          const std::vector<Object> &Constants, const F &Op)
+{
+  switch (Inst->getResultType()->getScalarType()->getBitWidth())
+  {
+  case 32:
+    return compileOp<uint32_t>(Inst, Constants, Op);
+  case 64:
+    return compileOp<uint64_t>(Inst, Constants, Op);
+  default:
+    return nullptr;
+  }
+}
+
 } // namespace talvos
@@ -17,6 +17,7 @@
 
 #include "talvos/Device.h"
 #include "talvos/Memory.h"
+#include "talvos/PerformanceCounters.h"
 
 // TODO: Allow different number of buffer bits depending on address space
 
@@ -59,6 +60,8 @@ uint64_t Memory::allocate(uint64_t NumBytes)
 {
   std::lock_guard<std::mutex> Lock(Mutex);
 
+  Dev.getCounters().add(PerformanceCounters::ALLOCATIONS);
+
   // Allocate buffer.
   Alloc B;
   B.NumBytes = NumBytes;
@@ -264,6 +267,11 @@ bool Memory::isAccessValid(uint64_t Address, uint64_t NumBytes) const
   return true;
 }
 
+uint64_t Memory::getBaseAddress(uint64_t Address)
+{
+  return (Address >> OFFSET_BITS) << OFFSET_BITS;
+}
+
 void Memory::load(uint8_t *Data, uint64_t Address, uint64_t NumBytes) const
 {
   uint64_t Id = (Address >> OFFSET_BITS);
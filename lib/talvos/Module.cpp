@@ -8,15 +8,22 @@
 
 #include "talvos/Buffer.h"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <mutex>
 #include <optional>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
 #include <spirv-tools/libspirv.h>
 #include <spirv-tools/libspirv.hpp>
+#include <spirv-tools/optimizer.hpp>
 
 #define SPV_ENABLE_UTILITY_CODE
 #include <spirv/unified1/spirv.h>
@@ -30,10 +37,470 @@
 #include "talvos/Type.h"
 #include "talvos/Variable.h"
 #include "talvos/gdb.h"
+#include "Utils.h"
 
 namespace talvos
 {
 
+/// An instruction recorded by ModuleBuilder, from which the blocks of a
+/// function are built when it is first used.
+///
+/// Each instruction is recorded as a word holding the opcode in the lower 16
+/// bits and the number of operands in the upper 16 bits, followed by the
+/// result type ID (or 0), a bit mask marking the operands that are IDs (one
+/// word per 32 operands), and the operand words.
+struct RecordedInstruction
+{
+  uint16_t Opcode;                ///< The opcode.
+  uint32_t TypeId;                ///< The result type ID, or 0.
+  std::vector<uint32_t> Operands; ///< The operand words.
+  std::vector<bool> IsId;         ///< True for each operand that is an ID.
+
+  /// Returns the result ID of this instruction, or 0 if it has none.
+  uint32_t getResultId() const
+  {
+    if (Opcode == SpvOpLabel)
+      return Operands[0];
+    return TypeId ? Operands[1] : 0;
+  }
+};
+
+/// Decode the instructions recorded in \p Words.
+static std::vector<RecordedInstruction>
+decodeInstructions(const std::vector<uint32_t> &Words)
+{
+  std::vector<RecordedInstruction> Instructions;
+  for (size_t i = 0; i < Words.size();)
+  {
+    RecordedInstruction I;
+    I.Opcode = Words[i] & 0xFFFF;
+    uint16_t NumOperands = Words[i] >> 16;
+    I.TypeId = Words[i + 1];
+    const uint32_t *Mask = Words.data() + i + 2;
+    const uint32_t *Operands = Mask + (NumOperands + 31) / 32;
+    for (uint16_t o = 0; o < NumOperands; o++)
+    {
+      I.Operands.push_back(Operands[o]);
+      I.IsId.push_back(Mask[o / 32] & (1u << (o % 32)));
+    }
+    i = Operands + NumOperands - Words.data();
+    Instructions.push_back(std::move(I));
+  }
+  return Instructions;
+}
+
+/// Encode \p Instructions in the form recorded by ModuleBuilder.
+static std::vector<uint32_t>
+encodeInstructions(const std::vector<RecordedInstruction> &Instructions)
+{
+  std::vector<uint32_t> Words;
+  for (const RecordedInstruction &I : Instructions)
+  {
+    uint16_t NumOperands = I.Operands.size();
+    Words.push_back(I.Opcode | (NumOperands << 16));
+    Words.push_back(I.TypeId);
+    size_t Mask = Words.size();
+    Words.resize(Mask + (NumOperands + 31) / 32);
+    for (uint16_t o = 0; o < NumOperands; o++)
+      if (I.IsId[o])
+        Words[Mask + o / 32] |= 1u << (o % 32);
+    Words.insert(Words.end(), I.Operands.begin(), I.Operands.end());
+  }
+  return Words;
+}
+
+/// Returns true if \p Opcode terminates a block.
+static bool isTerminator(uint16_t Opcode)
+{
+  switch (Opcode)
+  {
+  case SpvOpBranch:
+  case SpvOpBranchConditional:
+  case SpvOpKill:
+  case SpvOpReturn:
+  case SpvOpReturnValue:
+  case SpvOpSwitch:
+  case SpvOpTerminateInvocation:
+  case SpvOpUnreachable:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// Internal class used to build the blocks of a function from the instructions
+/// recorded by ModuleBuilder.
+class FunctionBuilder
+{
+public:
+  /// Create a builder for \p Func in \p Mod.
+  FunctionBuilder(Module &Mod, Function &Func) : Mod(Mod), Func(Func)
+  {
+    PreviousInstruction = nullptr;
+  }
+
+  /// Build the blocks of the function from \p Instructions, and append the
+  /// IDs of the functions that it calls to \p Callees.
+  void build(const std::vector<RecordedInstruction> &Instructions,
+             std::vector<uint32_t> &Callees)
+  {
+    for (const RecordedInstruction &I : Instructions)
+    {
+      if (I.Opcode == SpvOpFunctionCall)
+        Callees.push_back(I.Operands[2]);
+      processInstruction(I);
+    }
+
+    assert(CurrentBlock);
+    Func.addBlock(std::move(CurrentBlock));
+    Func.setMaterialized();
+  }
+
+private:
+  /// Process a recorded instruction.
+  void processInstruction(const RecordedInstruction &RI)
+  {
+    const uint32_t *Operands = RI.Operands.data();
+    if (RI.Opcode == SpvOpLabel)
+    {
+      if (CurrentBlock)
+        // Add previous block to function.
+        Func.addBlock(std::move(CurrentBlock));
+      else
+        // First block - set as entry block.
+        Func.setFirstBlock(Operands[0]);
+
+      // Create new block.
+      CurrentBlock = std::make_unique<Block>(Operands[0]);
+      PreviousInstruction = &CurrentBlock->getLabel();
+      return;
+    }
+
+    // Track OpLine/OpNoLine instructions instead of creating them.
+    if (RI.Opcode == SpvOpLine)
+    {
+      CurrentLine = SourceLocation{Operands[0], Operands[1], Operands[2]};
+      return;
+    }
+    if (RI.Opcode == SpvOpNoLine)
+    {
+      CurrentLine.reset();
+      return;
+    }
+
+    // Create the instruction.
+    const Type *ResultType = RI.TypeId ? Mod.getType(RI.TypeId) : nullptr;
+    Instruction *I = new Instruction(RI.Opcode, RI.Operands.size(), Operands,
+                                     ResultType);
+
+    // Insert this instruction into the current block.
+    assert(PreviousInstruction);
+    I->insertAfter(PreviousInstruction);
+    PreviousInstruction = I;
+
+    // Record source location, which ends at the end of each block.
+    if (CurrentLine)
+      Mod.addSourceLocation(I, *CurrentLine);
+    if (isTerminator(RI.Opcode))
+      CurrentLine.reset();
+  }
+
+  /// Internal FunctionBuilder variables.
+  ///\{
+  Module &Mod;
+  Function &Func;
+  std::unique_ptr<Block> CurrentBlock;
+  Instruction *PreviousInstruction;
+  std::optional<SourceLocation> CurrentLine;
+  ///\}
+};
+
+/// Internal class used to inline calls to small functions in the recorded
+/// instructions of their callers when a module is loaded.
+///
+/// The body of the callee replaces the call, with its results and blocks
+/// renamed to fresh IDs and its parameters replaced by the call arguments.
+/// The block containing the call is split, and each return from the callee
+/// branches to the new block that continues the caller, where an OpPhi
+/// selects the return value. Function scope variables of the callee are moved
+/// to the entry block of the caller.
+class FunctionInliner
+{
+public:
+  /// Create an inliner for \p Mod that inlines functions with at most
+  /// \p Threshold instructions.
+  FunctionInliner(Module &Mod, uint64_t Threshold)
+      : Mod(Mod), Threshold(Threshold)
+  {}
+
+  /// Returns the instructions of \p Func with calls to small functions
+  /// inlined.
+  const std::vector<RecordedInstruction> &expand(const Function *Func);
+
+private:
+  /// Returns a fresh ID.
+  uint32_t allocateId() { return Mod.IdBound++; }
+
+  /// Returns the expanded instructions of function \p Id if calls to it can
+  /// be inlined, or nullptr otherwise.
+  const std::vector<RecordedInstruction> *getInlinable(uint32_t Id);
+
+  /// Inline the function body \p Callee in place of \p Call, appending the
+  /// instructions to \p Out and the function scope variables to \p Hoisted.
+  /// Returns the ID of the block that continues the caller.
+  uint32_t inlineCall(const RecordedInstruction &Call,
+                      const std::vector<RecordedInstruction> &Callee,
+                      std::vector<RecordedInstruction> &Out,
+                      std::vector<RecordedInstruction> &Hoisted);
+
+  /// Internal FunctionInliner variables.
+  ///\{
+  Module &Mod;
+  uint64_t Threshold;
+  std::map<uint32_t, std::vector<RecordedInstruction>> Expanded;
+  std::set<uint32_t> InProgress;
+  ///\}
+};
+
+/// Create an unconditional branch to \p Target.
+static RecordedInstruction makeBranch(uint32_t Target)
+{
+  return RecordedInstruction{SpvOpBranch, 0, {Target}, {true}};
+}
+
+/// Create a label for block \p Id.
+static RecordedInstruction makeLabel(uint32_t Id)
+{
+  return RecordedInstruction{SpvOpLabel, 0, {Id}, {true}};
+}
+
+const std::vector<RecordedInstruction> &
+FunctionInliner::expand(const Function *Func)
+{
+  auto Itr = Expanded.find(Func->getId());
+  if (Itr != Expanded.end())
+    return Itr->second;
+
+  InProgress.insert(Func->getId());
+
+  std::vector<RecordedInstruction> Body =
+      decodeInstructions(Func->getRecordedInstructions());
+  std::vector<RecordedInstruction> Out, Hoisted;
+
+  // The block that ends each block that was split by inlining.
+  std::map<uint32_t, uint32_t> LastBlocks;
+
+  // The line that applies to the next instruction of the caller.
+  const RecordedInstruction *Line = nullptr;
+  auto Emit = [&](const RecordedInstruction &I) {
+    if (I.Opcode == SpvOpLine)
+      Line = &I;
+    else if (I.Opcode == SpvOpNoLine || isTerminator(I.Opcode))
+      Line = nullptr;
+    Out.push_back(I);
+  };
+
+  size_t i = 0;
+  while (i < Body.size() && Body[i].Opcode != SpvOpLabel)
+    Emit(Body[i++]);
+  while (i < Body.size())
+  {
+    size_t End = i + 1;
+    while (End < Body.size() && Body[End].Opcode != SpvOpLabel)
+      End++;
+
+    // Check for calls that will be inlined and for a loop header.
+    bool Inlining = false;
+    const RecordedInstruction *LoopMerge = nullptr;
+    for (size_t k = i; k < End; k++)
+    {
+      if (Body[k].Opcode == SpvOpFunctionCall &&
+          getInlinable(Body[k].Operands[2]))
+        Inlining = true;
+      else if (Body[k].Opcode == SpvOpLoopMerge)
+        LoopMerge = &Body[k];
+    }
+    if (!Inlining)
+    {
+      for (; i < End; i++)
+        Emit(Body[i]);
+      continue;
+    }
+
+    uint32_t BlockId = Body[i].Operands[0];
+    uint32_t Current = BlockId;
+    Emit(Body[i++]);
+
+    // Keep a loop header intact by moving the rest of its instructions into a
+    // new block, so that the header still holds the OpLoopMerge.
+    if (LoopMerge)
+    {
+      for (; i < End; i++)
+      {
+        if (Body[i].Opcode != SpvOpPhi && Body[i].Opcode != SpvOpLine &&
+            Body[i].Opcode != SpvOpNoLine)
+          break;
+        Emit(Body[i]);
+      }
+      const RecordedInstruction *HeaderLine = Line;
+      Out.push_back(*LoopMerge);
+      Current = allocateId();
+      Emit(makeBranch(Current));
+      Emit(makeLabel(Current));
+      if (HeaderLine)
+        Emit(*HeaderLine);
+    }
+
+    for (; i < End; i++)
+    {
+      const RecordedInstruction &I = Body[i];
+      if (&I == LoopMerge)
+        continue;
+
+      const std::vector<RecordedInstruction> *Callee = nullptr;
+      if (I.Opcode == SpvOpFunctionCall)
+        Callee = getInlinable(I.Operands[2]);
+      if (!Callee)
+      {
+        Emit(I);
+        continue;
+      }
+
+      // Continue with the line of the call after the inlined body.
+      const RecordedInstruction *CallLine = Line;
+      Current = inlineCall(I, *Callee, Out, Hoisted);
+      Line = nullptr;
+      if (CallLine)
+        Emit(*CallLine);
+    }
+    LastBlocks[BlockId] = Current;
+  }
+
+  // Blocks that were split now reach their successors from their last block.
+  for (RecordedInstruction &I : Out)
+  {
+    if (I.Opcode != SpvOpPhi)
+      continue;
+    for (size_t o = 3; o < I.Operands.size(); o += 2)
+      if (LastBlocks.count(I.Operands[o]))
+        I.Operands[o] = LastBlocks[I.Operands[o]];
+  }
+
+  // Move the variables of inlined functions to the entry block.
+  auto Entry = std::find_if(Out.begin(), Out.end(), [](auto &I) {
+    return I.Opcode == SpvOpLabel;
+  });
+  assert(Entry != Out.end());
+  Out.insert(Entry + 1, Hoisted.begin(), Hoisted.end());
+
+  InProgress.erase(Func->getId());
+  return Expanded[Func->getId()] = std::move(Out);
+}
+
+const std::vector<RecordedInstruction> *
+FunctionInliner::getInlinable(uint32_t Id)
+{
+  // Recursive calls are never inlined.
+  const Function *Func = Mod.getFunction(Id);
+  if (!Func || InProgress.count(Id))
+    return nullptr;
+
+  const std::vector<RecordedInstruction> &Body = expand(Func);
+  uint64_t Size = 0;
+  for (const RecordedInstruction &I : Body)
+  {
+    switch (I.Opcode)
+    {
+    case SpvOpLabel:
+    case SpvOpLine:
+    case SpvOpNoLine:
+      break;
+    case SpvOpVariable:
+      // Initializers would be applied once at the entry of the caller.
+      if (I.Operands.size() > 3)
+        return nullptr;
+      Size++;
+      break;
+    default:
+      Size++;
+      break;
+    }
+  }
+  if (Size > Threshold)
+    return nullptr;
+  return &Body;
+}
+
+uint32_t
+FunctionInliner::inlineCall(const RecordedInstruction &Call,
+                            const std::vector<RecordedInstruction> &Callee,
+                            std::vector<RecordedInstruction> &Out,
+                            std::vector<RecordedInstruction> &Hoisted)
+{
+  // Replace parameters with arguments, and give each result a fresh ID.
+  std::map<uint32_t, uint32_t> Names;
+  const Function *Func = Mod.getFunction(Call.Operands[2]);
+  assert(Call.Operands.size() == Func->getNumParams() + 3);
+  for (size_t p = 0; p < Func->getNumParams(); p++)
+    Names[Func->getParamId(p)] = Call.Operands[3 + p];
+  for (const RecordedInstruction &I : Callee)
+    if (uint32_t Result = I.getResultId())
+      Names[Result] = allocateId();
+  uint32_t Continue = allocateId();
+
+  // Branch to the entry block of the callee.
+  auto Entry = std::find_if(Callee.begin(), Callee.end(), [](auto &I) {
+    return I.Opcode == SpvOpLabel;
+  });
+  assert(Entry != Callee.end());
+  Out.push_back(makeBranch(Names.at(Entry->Operands[0])));
+
+  // Copy the body, with returns branching to the continuation block.
+  std::vector<uint32_t> Returns;
+  uint32_t CurrentBlock = 0;
+  for (RecordedInstruction I : Callee)
+  {
+    for (size_t o = 0; o < I.Operands.size(); o++)
+    {
+      auto Name = Names.find(I.Operands[o]);
+      if (I.IsId[o] && Name != Names.end())
+        I.Operands[o] = Name->second;
+    }
+
+    switch (I.Opcode)
+    {
+    case SpvOpLabel:
+      CurrentBlock = I.Operands[0];
+      break;
+    case SpvOpVariable:
+      Hoisted.push_back(std::move(I));
+      continue;
+    case SpvOpReturnValue:
+      Returns.insert(Returns.end(), {I.Operands[0], CurrentBlock});
+      // Fall through.
+    case SpvOpReturn:
+      I = makeBranch(Continue);
+      break;
+    default:
+      break;
+    }
+    Out.push_back(std::move(I));
+  }
+
+  // Select the return value in the continuation block.
+  Out.push_back(makeLabel(Continue));
+  if (!Returns.empty())
+  {
+    RecordedInstruction Phi{SpvOpPhi, Call.TypeId,
+                            {Call.Operands[0], Call.Operands[1]},
+                            {true, true}};
+    Phi.Operands.insert(Phi.Operands.end(), Returns.begin(), Returns.end());
+    Phi.IsId.resize(Phi.Operands.size(), true);
+    Out.push_back(std::move(Phi));
+  }
+  return Continue;
+}
+
 /// Internal class used to construct a Module during SPIRV-Tools parsing.
 class ModuleBuilder
 {
@@ -44,8 +511,7 @@ public:
     assert(!Mod && "Module already initialized");
     Mod = std::unique_ptr<Module>(new Module(IdBound));
     CurrentFunction = nullptr;
-    CurrentBlock = nullptr;
-    PreviousInstruction = nullptr;
+    CurrentLine.reset();
   }
 
   /// Process a parsed SPIR-V instruction.
@@ -60,6 +526,13 @@ public:
           Mod->getType(Inst->words[Inst->operands[3].offset]);
       CurrentFunction = std::make_unique<Function>(Inst->result_id, FuncType);
 
+      // A line that precedes the function applies to its first instructions.
+      if (CurrentLine)
+        PendingInstructions.insert(PendingInstructions.end(),
+                                   {SpvOpLine | (3 << 16), 0, 1,
+                                    CurrentLine->File, CurrentLine->Line,
+                                    CurrentLine->Column});
+
       // Check if this is an entry point.
       if (EntryPoints.count(Inst->result_id))
       {
@@ -86,55 +559,46 @@ public:
     else if (Inst->opcode == SpvOpFunctionEnd)
     {
       assert(CurrentFunction);
-      assert(CurrentBlock);
-      CurrentFunction->addBlock(std::move(CurrentBlock));
+      CurrentFunction->setRecordedInstructions(std::move(PendingInstructions));
+      PendingInstructions.clear();
       Mod->addFunction(std::move(CurrentFunction));
       CurrentFunction = nullptr;
-      CurrentBlock = nullptr;
+      CurrentLine.reset();
     }
     else if (Inst->opcode == SpvOpFunctionParameter)
     {
       CurrentFunction->addParam(Inst->result_id);
     }
-    else if (Inst->opcode == SpvOpLabel)
-    {
-      if (CurrentBlock)
-        // Add previous block to function.
-        CurrentFunction->addBlock(std::move(CurrentBlock));
-      else
-        // First block - set as entry block.
-        CurrentFunction->setFirstBlock(Inst->result_id);
-
-      // Create new block.
-      CurrentBlock = std::make_unique<Block>(Inst->result_id);
-      PreviousInstruction = &CurrentBlock->getLabel();
-    }
     else if (CurrentFunction)
     {
-      // Skip OpLine/OpNoLine instructions.
-      if (Inst->opcode == SpvOpLine || Inst->opcode == SpvOpNoLine)
-        return;
-
-      // Create an array of operand values.
-      uint32_t *Operands = new uint32_t[Inst->num_operands];
+      // Record the instruction so that the function body can be built when a
+      // pipeline stage first uses it (see Module::materialize).
+      PendingInstructions.push_back(Inst->opcode | (Inst->num_operands << 16));
+      PendingInstructions.push_back(Inst->type_id);
+      size_t Mask = PendingInstructions.size();
+      PendingInstructions.resize(Mask + (Inst->num_operands + 31) / 32);
+      for (int i = 0; i < Inst->num_operands; i++)
+      {
+        switch (Inst->operands[i].type)
+        {
+        case SPV_OPERAND_TYPE_ID:
+        case SPV_OPERAND_TYPE_TYPE_ID:
+        case SPV_OPERAND_TYPE_RESULT_ID:
+        case SPV_OPERAND_TYPE_MEMORY_SEMANTICS_ID:
+        case SPV_OPERAND_TYPE_SCOPE_ID:
+        case SPV_OPERAND_TYPE_OPTIONAL_ID:
+          PendingInstructions[Mask + i / 32] |= 1u << (i % 32);
+          break;
+        default:
+          break;
+        }
+      }
       for (int i = 0; i < Inst->num_operands; i++)
       {
         // TODO: Handle larger operands
         assert(Inst->operands[i].num_words == 1);
-        Operands[i] = Inst->words[Inst->operands[i].offset];
+        PendingInstructions.push_back(Inst->words[Inst->operands[i].offset]);
       }
-
-      // Create the instruction.
-      const Type *ResultType =
-          Inst->type_id ? Mod->getType(Inst->type_id) : nullptr;
-      Instruction *I = new Instruction(Inst->opcode, Inst->num_operands,
-                                       Operands, ResultType);
-      delete[] Operands;
-
-      // Insert this instruction into the current block.
-      assert(PreviousInstruction);
-      I->insertAfter(PreviousInstruction);
-      PreviousInstruction = I;
     }
     else
     {
@@ -428,7 +892,6 @@ public:
       }
       case SpvOpExtInstImport:
       {
-        // TODO: Store the mapping from result ID to set for later use
         char *ExtInstSet = (char *)(Inst->words + Inst->operands[1].offset);
         if (strcmp(ExtInstSet, "GLSL.std.450"))
         {
@@ -436,10 +899,11 @@ public:
                     << std::endl;
           abort();
         }
+        Mod->addExtInstSet(Inst->result_id, ExtInstSet);
         break;
       }
       case SpvOpLine:
-        // TODO: Do something with this
+        setLine(Inst);
         break;
       case SpvOpMemberDecorate:
       {
@@ -505,7 +969,7 @@ public:
         // TODO: Do something with this
         break;
       case SpvOpNoLine:
-        // TODO: Do something with this
+        CurrentLine.reset();
         break;
       case SpvOpSpecConstantComposite:
       {
@@ -552,7 +1016,9 @@ public:
       case SpvOpSourceExtension:
         break;
       case SpvOpString:
-        // TODO: Do something with this
+        Mod->addDebugString(
+            Inst->result_id,
+            (const char *)(Inst->words + Inst->operands[1].offset));
         break;
       case SpvOpTypeArray:
       {
@@ -739,12 +1205,20 @@ public:
   std::shared_ptr<Module> getModule() { return Mod; }
 
 private:
+  /// Set the current source location from an OpLine instruction.
+  void setLine(const spv_parsed_instruction_t *Inst)
+  {
+    CurrentLine = SourceLocation{Inst->words[Inst->operands[0].offset],
+                                 Inst->words[Inst->operands[1].offset],
+                                 Inst->words[Inst->operands[2].offset]};
+  }
+
   /// Internal ModuleBuilder variables.
   ///\{
   std::shared_ptr<Module> Mod;
   std::unique_ptr<Function> CurrentFunction;
-  std::unique_ptr<Block> CurrentBlock;
-  Instruction *PreviousInstruction;
+  std::vector<uint32_t> PendingInstructions;
+  std::optional<SourceLocation> CurrentLine;
   std::map<uint32_t, uint32_t> ArrayStrides;
   std::map<std::pair<uint32_t, uint32_t>, std::map<uint32_t, uint32_t>>
       MemberDecorations;
@@ -780,11 +1254,208 @@ HandleInstruction(void *user_data,
   return SPV_SUCCESS;
 }
 
+/// Parse a SPIR-V binary that has already been validated.
+/// Returns nullptr on failure.
+static std::shared_ptr<Module> parseBinary(spvtools::Context &SPVContext,
+                                           const uint32_t *Words,
+                                           size_t NumWords)
+{
+  spv_diagnostic Diagnostic = nullptr;
+  ModuleBuilder MB;
+  spvBinaryParse(SPVContext.CContext(), &MB, Words, NumWords, HandleHeader,
+                 HandleInstruction, &Diagnostic);
+  if (Diagnostic)
+  {
+    spvDiagnosticPrint(Diagnostic);
+    spvDiagnosticDestroy(Diagnostic);
+    return nullptr;
+  }
+  std::shared_ptr<Module> Mod = MB.getModule();
+
+  // Inline small functions if enabled. This is done before the module is
+  // returned, so that building function bodies never changes IDs.
+  if (checkEnv("TALVOS_INLINE", false))
+  {
+    FunctionInliner Inliner(*Mod, getEnvUInt("TALVOS_INLINE_THRESHOLD", 32));
+    for (auto &Func : Mod->Functions)
+      Func.second->setRecordedInstructions(
+          encodeInstructions(Inliner.expand(Func.second.get())));
+
+    // Inlining may have allocated new IDs.
+    Mod->Objects.resize(Mod->IdBound);
+  }
+
+  return Mod;
+}
+
+/// Magic number identifying a module cache entry ("TVMC").
+#define MODULE_CACHE_MAGIC 0x434D5654
+
+/// Version of the module cache entry format, which is also part of the name
+/// of each entry so that builds using different formats do not share entries.
+#define MODULE_CACHE_VERSION 2
+
+/// The header of a module cache entry, which is followed by the key of the
+/// entry and then the assembled and validated SPIR-V binary.
+struct ModuleCacheHeader
+{
+  uint32_t Magic;     ///< Always MODULE_CACHE_MAGIC.
+  uint32_t Version;   ///< Always MODULE_CACHE_VERSION.
+  uint32_t TargetEnv; ///< The SPIRV-Tools target environment.
+  uint32_t Reserved;  ///< Padding, always zero.
+  uint64_t KeySize;   ///< The size of the key in bytes.
+  uint64_t NumWords;  ///< The number of words in the binary.
+};
+
+/// Returns the path of the module cache entry for the module source \p Bytes
+/// loaded with \p Options, or an empty string if TALVOS_MODULE_CACHE is not
+/// set. The key of the entry is written to \p Key.
+static std::string getModuleCachePath(const std::vector<uint8_t> &Bytes,
+                                      const Module::LoadOptions &Options,
+                                      std::vector<uint8_t> &Key)
+{
+  const char *Dir = getenv("TALVOS_MODULE_CACHE");
+  if (!Dir || !*Dir)
+    return "";
+
+  // The key is the module source followed by the optimizer passes that were
+  // run on it. Entries are named after a 64-bit FNV-1a hash of the key, and
+  // store the whole key so that a hash collision is never mistaken for a hit.
+  Key = Bytes;
+  for (const std::string &Pass : Options.OptimizerPasses)
+  {
+    Key.push_back(0);
+    Key.insert(Key.end(), Pass.begin(), Pass.end());
+  }
+
+  uint64_t Hash = 0xcbf29ce484222325;
+  for (uint8_t Byte : Key)
+  {
+    Hash ^= Byte;
+    Hash *= 0x100000001b3;
+  }
+
+  char Name[40];
+  snprintf(Name, sizeof(Name), "%016llx-v%d.spvc", (unsigned long long)Hash,
+           MODULE_CACHE_VERSION);
+  return std::string(Dir) + "/" + Name;
+}
+
+/// Read the module cache entry at \p Path into \p Words and \p TargetEnv.
+/// Returns false if there is no valid entry with key \p Key.
+static bool readModuleCache(const std::string &Path,
+                            const std::vector<uint8_t> &Key,
+                            std::vector<uint32_t> &Words,
+                            spv_target_env &TargetEnv)
+{
+  FILE *CacheFile = fopen(Path.c_str(), "rb");
+  if (!CacheFile)
+    return false;
+
+  ModuleCacheHeader Header;
+  bool Valid = fread(&Header, sizeof(Header), 1, CacheFile) == 1 &&
+               Header.Magic == MODULE_CACHE_MAGIC &&
+               Header.Version == MODULE_CACHE_VERSION &&
+               Header.KeySize == Key.size() && Header.NumWords > 0;
+  if (Valid)
+  {
+    std::vector<uint8_t> EntryKey(Key.size());
+    Valid = fread(EntryKey.data(), 1, EntryKey.size(), CacheFile) ==
+                EntryKey.size() &&
+            EntryKey == Key;
+  }
+  if (Valid)
+  {
+    Words.resize(Header.NumWords);
+    Valid = fread(Words.data(), sizeof(uint32_t), Words.size(), CacheFile) ==
+            Words.size();
+    TargetEnv = (spv_target_env)Header.TargetEnv;
+  }
+  fclose(CacheFile);
+  return Valid;
+}
+
+/// Write a module cache entry with key \p Key to \p Path.
+static void writeModuleCache(const std::string &Path,
+                             const std::vector<uint8_t> &Key,
+                             spv_target_env TargetEnv, const uint32_t *Words,
+                             size_t NumWords)
+{
+  // Write to a temporary file and then rename it, so that concurrent loads
+  // never see a partially written entry.
+  std::string TempPath = Path + "." + std::to_string(std::random_device()());
+  FILE *CacheFile = fopen(TempPath.c_str(), "wb");
+  if (!CacheFile)
+  {
+    std::cerr << "Talvos: Failed to write module cache entry '" << Path << "'"
+              << std::endl;
+    return;
+  }
+
+  ModuleCacheHeader Header = {MODULE_CACHE_MAGIC, MODULE_CACHE_VERSION,
+                              (uint32_t)TargetEnv, 0, Key.size(), NumWords};
+  bool Written =
+      fwrite(&Header, sizeof(Header), 1, CacheFile) == 1 &&
+      fwrite(Key.data(), 1, Key.size(), CacheFile) == Key.size() &&
+      fwrite(Words, sizeof(uint32_t), NumWords, CacheFile) == NumWords;
+  Written = fclose(CacheFile) == 0 && Written;
+  if (!Written || rename(TempPath.c_str(), Path.c_str()))
+  {
+    remove(TempPath.c_str());
+    return;
+  }
+
+  if (checkEnv("TALVOS_MODULE_CACHE_VERBOSE", false))
+    std::cerr << "Talvos: Wrote module cache entry '" << Path << "'"
+              << std::endl;
+}
+
+/// Run the optimizer passes in \p Options on a SPIR-V binary, and then
+/// validate it and build a module from it.
+/// If \p CachePath is not empty, the binary that the module was built from is
+/// written to the module cache with key \p CacheKey.
+/// Returns nullptr on failure.
+static std::shared_ptr<Module>
+buildModule(spvtools::Context &SPVContext, spv_target_env TargetEnv,
+            const uint32_t *Words, size_t NumWords,
+            const Module::LoadOptions &Options, const std::string &CachePath,
+            const std::vector<uint8_t> &CacheKey)
+{
+  std::vector<uint32_t> Optimized;
+  if (!Options.OptimizerPasses.empty())
+  {
+    spvtools::Optimizer Opt(TargetEnv);
+    Opt.SetMessageConsumer([](spv_message_level_t Level, const char *,
+                              const spv_position_t &, const char *Message) {
+      if (Level <= SPV_MSG_WARNING)
+        std::cerr << Message << std::endl;
+    });
+    if (!Opt.RegisterPassesFromFlags(Options.OptimizerPasses))
+    {
+      std::cerr << "Invalid SPIR-V optimizer pass list" << std::endl;
+      return nullptr;
+    }
+    if (!Opt.Run(Words, NumWords, &Optimized))
+    {
+      std::cerr << "Failed to optimize SPIR-V module" << std::endl;
+      return nullptr;
+    }
+    Words = Optimized.data();
+    NumWords = Optimized.size();
+  }
+
+  std::shared_ptr<Module> M = Module::load(SPVContext, Words, NumWords);
+  if (M && !CachePath.empty())
+    writeModuleCache(CachePath, CacheKey, TargetEnv, Words, NumWords);
+  return M;
+}
+
 Module::Module(uint32_t IdBound)
 {
   this->IdBound = IdBound;
   this->Objects.resize(IdBound);
   WorkgroupSizeId = 0;
+  GLSLExtInstSet = 0;
 }
 
 Module::~Module()
@@ -799,6 +1470,18 @@ Module::~Module()
     delete Var;
 }
 
+void Module::addDebugString(uint32_t Id, const std::string &Str)
+{
+  DebugStrings[Id] = Str;
+}
+
+void Module::addExtInstSet(uint32_t Id, const std::string &Name)
+{
+  ExtInstSets[Id] = Name;
+  if (Name == "GLSL.std.450")
+    GLSLExtInstSet = Id;
+}
+
 void Module::addEntryPoint(EntryPoint *EP)
 {
   assert(getEntryPoint(EP->getName(), EP->getExecutionModel()) == nullptr);
@@ -829,6 +1512,13 @@ void Module::addObject(uint32_t Id, const Object &Obj)
   Objects[Id] = Obj;
 }
 
+void Module::addSourceLocation(const Instruction *Inst,
+                               const SourceLocation &Loc)
+{
+  std::unique_lock<std::shared_mutex> Lock(SourceLocationMutex);
+  SourceLocations[Inst] = Loc;
+}
+
 void Module::addSpecConstant(uint32_t SpecId, uint32_t ResultId)
 {
   // TODO: Allow the same SpecId to apply to multiple results.
@@ -844,7 +1534,25 @@ void Module::addSpecConstantOp(Instruction *Op)
 void Module::addType(uint32_t Id, std::unique_ptr<Type> Ty)
 {
   assert(!Types.count(Id));
-  Types[Id] = std::move(Ty);
+  Types[Id] = Type::intern(std::move(Ty));
+}
+
+const std::string &Module::getDebugString(uint32_t Id) const
+{
+  static const std::string Empty;
+  auto Itr = DebugStrings.find(Id);
+  if (Itr == DebugStrings.end())
+    return Empty;
+  return Itr->second;
+}
+
+const std::string &Module::getExtInstSet(uint32_t Id) const
+{
+  static const std::string Empty;
+  auto Itr = ExtInstSets.find(Id);
+  if (Itr == ExtInstSets.end())
+    return Empty;
+  return Itr->second;
 }
 
 const EntryPoint *Module::getEntryPoint(const std::string &Name,
@@ -860,9 +1568,10 @@ const EntryPoint *Module::getEntryPoint(const std::string &Name,
 
 const Function *Module::getFunction(uint32_t Id) const
 {
-  if (!Functions.count(Id))
+  auto Itr = Functions.find(Id);
+  if (Itr == Functions.end())
     return nullptr;
-  return Functions.at(Id).get();
+  return Itr->second.get();
 }
 
 Dim3 Module::getLocalSize(uint32_t Entry) const
@@ -885,6 +1594,39 @@ const Object &Module::getObject(uint32_t Id) const { return Objects.at(Id); }
 
 const std::vector<Object> &Module::getObjects() const { return Objects; }
 
+const SourceLocation *Module::getSourceLocation(const Instruction *Inst) const
+{
+  // Elements are never removed, and do not move when the table grows, so the
+  // result remains valid after the lock is released.
+  std::shared_lock<std::shared_mutex> Lock(SourceLocationMutex);
+  auto Itr = SourceLocations.find(Inst);
+  if (Itr == SourceLocations.end())
+    return nullptr;
+  return &Itr->second;
+}
+
+bool Module::hasSourceLocations() const
+{
+  std::shared_lock<std::shared_mutex> Lock(SourceLocationMutex);
+  return !SourceLocations.empty();
+}
+
+bool Module::printSourceLocation(std::ostream &O,
+                                 const Instruction *Inst) const
+{
+  const SourceLocation *Loc = getSourceLocation(Inst);
+  if (!Loc)
+    return false;
+
+  const std::string &File = getDebugString(Loc->File);
+  if (File.empty())
+    O << "%" << Loc->File;
+  else
+    O << File;
+  O << ":" << Loc->Line << ":" << Loc->Column;
+  return true;
+}
+
 uint32_t Module::getSpecConstant(uint32_t SpecId) const
 {
   if (SpecConstants.count(SpecId) == 0)
@@ -899,11 +1641,139 @@ const std::vector<Instruction *> &Module::getSpecConstantOps() const
 
 const Type *Module::getType(uint32_t Id) const
 {
-  if (Types.count(Id) == 0)
+  auto Itr = Types.find(Id);
+  if (Itr == Types.end())
     return nullptr;
-  return Types.at(Id).get();
+  return Itr->second;
+}
+
+/// Serializes the building of function bodies, since pipeline stages for the
+/// same module may be created on different threads.
+static std::mutex MaterializeMutex;
+
+void Module::materialize(const EntryPoint *EP) const
+{
+  std::lock_guard<std::mutex> Lock(MaterializeMutex);
+
+  // Building a function body only adds blocks to a function that nothing has
+  // observed yet, so the module appears unchanged to any existing user.
+  Module &Mod = const_cast<Module &>(*this);
+
+  // Build every function reachable from the entry point.
+  std::vector<uint32_t> Worklist = {EP->getFunction()->getId()};
+  while (!Worklist.empty())
+  {
+    uint32_t Id = Worklist.back();
+    Worklist.pop_back();
+    Function *Func = Functions.at(Id).get();
+    if (!Func->isMaterialized())
+      FunctionBuilder(Mod, *Func).build(
+          decodeInstructions(Func->getRecordedInstructions()), Worklist);
+  }
 }
 
+Module::LoadOptions Module::LoadOptions::getDefault()
+{
+  LoadOptions Options;
+  const char *Spec = getenv("TALVOS_OPTIMIZE");
+  if (Spec && !Options.setOptimizerPasses(Spec))
+  {
+    std::cerr << std::endl
+              << "ERROR: Invalid value for TALVOS_OPTIMIZE environment variable"
+              << std::endl;
+    abort();
+  }
+  return Options;
+}
+
+bool Module::LoadOptions::setOptimizerPasses(const std::string &Spec)
+{
+  OptimizerPasses.clear();
+  if (Spec == "0")
+    return true;
+  if (Spec == "1")
+  {
+    // Inline functions, promote function scope variables to SSA values, and
+    // then fold constants and remove the code that no longer has any effect.
+    OptimizerPasses = {
+        "--inline-entry-points-exhaustive",
+        "--convert-local-access-chains",
+        "--scalar-replacement",
+        "--ssa-rewrite",
+        "--ccp",
+        "--eliminate-dead-branches",
+        "--eliminate-dead-code-aggressive",
+    };
+    return true;
+  }
+
+  std::istringstream SS(Spec);
+  std::string Pass;
+  while (std::getline(SS, Pass, ','))
+  {
+    if (Pass.empty())
+      return false;
+    if (Pass[0] != '-')
+      Pass = "--" + Pass;
+    OptimizerPasses.push_back(Pass);
+  }
+  return !OptimizerPasses.empty();
+}
+
+/// Mutex guarding ContextPool.
+static std::mutex ContextPoolMutex;
+
+/// SPIRV-Tools contexts that are not in use, for each target environment.
+/// Creating a context is expensive compared to loading a small module, so
+/// contexts are reused across loads instead of being created for each one.
+static std::map<spv_target_env, std::vector<std::unique_ptr<spvtools::Context>>>
+    ContextPool;
+
+/// Internal class used to borrow a SPIRV-Tools context from the pool for the
+/// duration of a load. A context is only ever used by one thread at a time.
+class ContextLease
+{
+public:
+  /// Borrow a context for \p TargetEnv, creating one if none are free.
+  ContextLease(spv_target_env TargetEnv) : TargetEnv(TargetEnv)
+  {
+    {
+      std::lock_guard<std::mutex> Lock(ContextPoolMutex);
+      auto &Free = ContextPool[TargetEnv];
+      if (!Free.empty())
+      {
+        Context = std::move(Free.back());
+        Free.pop_back();
+      }
+    }
+    if (!Context)
+      Context = std::make_unique<spvtools::Context>(TargetEnv);
+  }
+
+  /// Return the context to the pool.
+  ~ContextLease()
+  {
+    std::lock_guard<std::mutex> Lock(ContextPoolMutex);
+    ContextPool[TargetEnv].push_back(std::move(Context));
+  }
+
+  // Do not allow ContextLease objects to be copied.
+  ///\{
+  ContextLease(const ContextLease &) = delete;
+  ContextLease &operator=(const ContextLease &) = delete;
+  ///\}
+
+  /// Returns the borrowed context.
+  ///\{
+  spvtools::Context &operator*() const { return *Context; }
+  spvtools::Context *operator->() const { return Context.get(); }
+  ///\}
+
+private:
+  spv_target_env TargetEnv;                   ///< The target environment.
+  std::unique_ptr<spvtools::Context> Context; ///< The borrowed context.
+};
+
 std::shared_ptr<Module> Module::load(spvtools::Context &SPVContext,
                                      const uint32_t *Words, size_t NumWords)
 {
@@ -917,19 +1787,11 @@ std::shared_ptr<Module> Module::load(spvtools::Context &SPVContext,
   }
 
   // Parse binary.
-  ModuleBuilder MB;
-  spvBinaryParse(SPVContext.CContext(), &MB, Words, NumWords, HandleHeader,
-                 HandleInstruction, &Diagnostic);
-  if (Diagnostic)
-  {
-    spvDiagnosticPrint(Diagnostic);
-    return nullptr;
-  }
-
-  return MB.getModule();
+  return parseBinary(SPVContext, Words, NumWords);
 }
 
-std::shared_ptr<Module> Module::load(const std::string &FileName)
+std::shared_ptr<Module> Module::load(const std::string &FileName,
+                                     const LoadOptions &Options)
 {
   // Open file.
   FILE *SPVFile = fopen(FileName.c_str(), "rb");
@@ -948,20 +1810,66 @@ std::shared_ptr<Module> Module::load(const std::string &FileName)
   fread(Bytes.data(), 1, NumBytes, SPVFile);
   fclose(SPVFile);
 
-  return Module::load(Bytes);
+  return Module::load(Bytes, Options);
 }
 
-std::shared_ptr<Module> Module::load(const std::vector<uint8_t> &Bytes)
+std::vector<std::shared_ptr<Module>>
+Module::loadAll(const std::vector<std::string> &FileNames,
+                const LoadOptions &Options)
+{
+  std::vector<std::shared_ptr<Module>> Modules(FileNames.size());
+
+  // Load modules on a pool of worker threads, each taking the next file.
+  std::atomic<size_t> NextFile(0);
+  auto Worker = [&]() {
+    for (size_t i = NextFile++; i < FileNames.size(); i = NextFile++)
+      Modules[i] = load(FileNames[i], Options);
+  };
+
+  size_t NumThreads = 1;
+#ifndef __EMSCRIPTEN__
+  NumThreads = std::min<size_t>(
+      FileNames.size(), std::max(1u, std::thread::hardware_concurrency()));
+#endif
+  std::vector<std::thread> Threads;
+  for (size_t t = 1; t < NumThreads; t++)
+    Threads.push_back(std::thread(Worker));
+  Worker();
+  for (std::thread &T : Threads)
+    T.join();
+
+  return Modules;
+}
+
+std::shared_ptr<Module> Module::load(const std::vector<uint8_t> &Bytes,
+                                     const LoadOptions &Options)
 {
   spv_target_env target_env = SPV_ENV_UNIVERSAL_1_6;
   // spv_target_env target_env = SPV_ENV_VULKAN_1_0; // TODO
   auto NumBytes = Bytes.size();
 
+  // Skip assembly and validation if the module is in the cache.
+  std::vector<uint8_t> CacheKey;
+  std::string CachePath = getModuleCachePath(Bytes, Options, CacheKey);
+  if (!CachePath.empty())
+  {
+    std::vector<uint32_t> Words;
+    if (readModuleCache(CachePath, CacheKey, Words, target_env))
+    {
+      if (checkEnv("TALVOS_MODULE_CACHE_VERBOSE", false))
+        std::cerr << "Talvos: Loaded module from cache entry '" << CachePath
+                  << "'" << std::endl;
+      ContextLease SPVContext(target_env);
+      return parseBinary(*SPVContext, Words.data(), Words.size());
+    }
+  }
+
   // Check for SPIR-V magic number.
   if (((uint32_t *)Bytes.data())[0] == 0x07230203)
   {
-    spvtools::Context SPVContext(target_env); // TODO?
-    return load(SPVContext, (uint32_t *)Bytes.data(), NumBytes / 4);
+    ContextLease SPVContext(target_env);
+    return buildModule(*SPVContext, target_env, (uint32_t *)Bytes.data(),
+                       NumBytes / 4, Options, CachePath, CacheKey);
   }
 
   // Assume file is in textual SPIR-V format.
@@ -1009,9 +1917,9 @@ std::shared_ptr<Module> Module::load(const std::vector<uint8_t> &Bytes)
     // otherwise, go with default
   }
 
-  spvtools::Context SPVContext(target_env);
+  ContextLease SPVContext(target_env);
   auto result = spvTextToBinaryWithOptions(
-      SPVContext.CContext(), (const char *)Bytes.data(), NumBytes,
+      SPVContext->CContext(), (const char *)Bytes.data(), NumBytes,
       SPV_TEXT_TO_BINARY_OPTION_PRESERVE_NUMERIC_IDS, &Binary, &Diagnostic);
   if (Diagnostic)
   {
@@ -1023,7 +1931,9 @@ std::shared_ptr<Module> Module::load(const std::vector<uint8_t> &Bytes)
   }
 
   // Load and return Module.
-  std::shared_ptr<Module> M = load(SPVContext, Binary->code, Binary->wordCount);
+  std::shared_ptr<Module> M =
+      buildModule(*SPVContext, target_env, Binary->code, Binary->wordCount,
+                  Options, CachePath, CacheKey);
   spvBinaryDestroy(Binary);
   return M;
 }
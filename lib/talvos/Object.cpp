@@ -52,7 +52,18 @@ Object::Object(const Object &Src)
 
 Object &Object::operator=(const Object &Src)
 {
-  if (this != &Src)
+  if (this == &Src)
+    return *this;
+
+  if (Data && Src && Ty == Src.Ty)
+  {
+    // Reuse the existing storage when the type is unchanged, as it is when an
+    // argument is copied to a parameter on each call to a function.
+    memcpy(Data, Src.Data, Ty->getSize());
+    MatrixLayout = Src.MatrixLayout;
+    DescriptorElements = Src.DescriptorElements;
+  }
+  else
   {
     Object Tmp(Src);
     std::swap(Data, Tmp.Data);
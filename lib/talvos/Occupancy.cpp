@@ -0,0 +1,271 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file Occupancy.cpp
+/// This file defines the Occupancy class.
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include <spirv/unified1/spirv.h>
+
+#include "talvos/Block.h"
+#include "talvos/EntryPoint.h"
+#include "talvos/Function.h"
+#include "talvos/Instruction.h"
+#include "talvos/Module.h"
+#include "talvos/Occupancy.h"
+#include "talvos/PipelineStage.h"
+#include "talvos/Type.h"
+#include "talvos/Variable.h"
+
+namespace talvos
+{
+
+/// Returns the number of 32-bit registers needed to hold a value of type \p Ty.
+static uint32_t getNumRegisters(const Type *Ty)
+{
+  if (Ty->isPointer())
+    return 2;
+  return std::max<uint32_t>(1, (uint32_t)((Ty->getSize() + 3) / 4));
+}
+
+Occupancy::Occupancy(const PipelineStage &Stage, const Limits &L,
+                     uint64_t Lanes)
+    : Resources(L)
+{
+  const Module &M = *Stage.getModule();
+  Registers = estimateRegisters(M, Stage.getEntryPoint()->getFunction());
+
+  // Only count the Workgroup variables that are referenced by the entry point
+  // or the functions it calls. Any operand that matches the ID of a variable is
+  // treated as a reference, which may overestimate slightly.
+  std::map<uint32_t, uint64_t> GroupVariables;
+  for (const Variable *V : M.getVariables())
+  {
+    const Type *Ty = V->getType();
+    if (Ty->getStorageClass() == SpvStorageClassWorkgroup)
+      GroupVariables[V->getId()] = Ty->getElementType()->getSize();
+  }
+  std::set<uint32_t> UsedVariables;
+  std::vector<const Function *> Worklist = {
+      Stage.getEntryPoint()->getFunction()};
+  std::set<const Function *> Visited(Worklist.begin(), Worklist.end());
+  while (!GroupVariables.empty() && !Worklist.empty())
+  {
+    const Function *F = Worklist.back();
+    Worklist.pop_back();
+    for (auto &B : F->getBlocks())
+    {
+      for (const Instruction *I = B.second->getLabel().next(); I; I = I->next())
+      {
+        for (unsigned i = 0; i < I->getNumOperands(); i++)
+          if (GroupVariables.count(I->getOperand(i)))
+            UsedVariables.insert(I->getOperand(i));
+        if (I->getOpcode() == SpvOpFunctionCall)
+        {
+          const Function *Callee = M.getFunction(I->getOperand(2));
+          if (Visited.insert(Callee).second)
+            Worklist.push_back(Callee);
+        }
+      }
+    }
+  }
+  WorkgroupMemory = 0;
+  for (uint32_t Id : UsedVariables)
+    WorkgroupMemory += GroupVariables[Id];
+
+  Dim3 GroupSize = Stage.getGroupSize();
+  GroupInvocations = (uint64_t)GroupSize.X * GroupSize.Y * GroupSize.Z;
+
+  // Find the resource that allows the fewest resident workgroups.
+  GroupsPerCore = Lanes;
+  Limit = LANES;
+  auto Check = [this](uint64_t N, Limiter Lim) {
+    if (N < GroupsPerCore || (N == GroupsPerCore && Lim < Limit))
+    {
+      GroupsPerCore = N;
+      Limit = Lim;
+    }
+  };
+  Check(L.Registers / (Registers * GroupInvocations), REGISTERS);
+  if (WorkgroupMemory)
+    Check(L.WorkgroupMemory / WorkgroupMemory, WORKGROUP_MEMORY);
+  Check(L.Invocations / GroupInvocations, INVOCATIONS);
+  Check(L.Workgroups, WORKGROUPS);
+
+  // A workgroup that exceeds the resources of a core would fail to launch on
+  // real hardware, but we still allow it to run.
+  if (GroupsPerCore == 0)
+  {
+    std::cerr << "WARNING: Workgroup exceeds the resources of a core"
+              << std::endl;
+    GroupsPerCore = 1;
+  }
+}
+
+uint32_t Occupancy::estimateRegisters(const Module &M, const Function *F)
+{
+  std::map<const Function *, uint32_t> Pressure;
+  return estimateRegisters(M, F, Pressure);
+}
+
+uint32_t
+Occupancy::estimateRegisters(const Module &M, const Function *F,
+                             std::map<const Function *, uint32_t> &Pressure)
+{
+  auto Itr = Pressure.find(F);
+  if (Itr != Pressure.end())
+    return Itr->second;
+  Pressure[F] = 0;
+
+  // Find the number of registers needed by each value defined in F.
+  std::map<uint32_t, uint32_t> Weights;
+  for (size_t i = 0; i < F->getNumParams(); i++)
+    Weights[F->getParamId((uint32_t)i)] = 1;
+  for (auto &B : F->getBlocks())
+  {
+    for (const Instruction *I = B.second->getLabel().next(); I; I = I->next())
+    {
+      const Type *Ty = I->getResultType();
+      if (!Ty)
+        continue;
+
+      // Assume that function variables will be promoted to registers.
+      if (I->getOpcode() == SpvOpVariable)
+        Ty = Ty->getElementType();
+      Weights[I->getOperand(1)] = getNumRegisters(Ty);
+    }
+  }
+
+  // Compute the values used before being defined in each block.
+  // Any operand that matches the ID of a value defined in the function is
+  // treated as a use, which may overestimate register pressure slightly.
+  struct BlockInfo
+  {
+    std::set<uint32_t> Uses, Defs, LiveIn, LiveOut;
+    std::vector<uint32_t> Successors;
+    const Instruction *Last = nullptr;
+  };
+  std::map<uint32_t, BlockInfo> Info;
+  for (auto &B : F->getBlocks())
+  {
+    BlockInfo &BI = Info[B.first];
+    for (const Instruction *I = B.second->getLabel().next(); I; I = I->next())
+    {
+      unsigned FirstOperand = I->getResultType() ? 2 : 0;
+      for (unsigned i = FirstOperand; i < I->getNumOperands(); i++)
+      {
+        uint32_t Op = I->getOperand(i);
+        if (Weights.count(Op) && !BI.Defs.count(Op))
+          BI.Uses.insert(Op);
+      }
+      if (I->getResultType())
+        BI.Defs.insert(I->getOperand(1));
+    }
+    BI.Last = B.second->getTerminator();
+    BI.Successors = B.second->getSuccessors();
+  }
+
+  // Iterate to a fixed point to find the values live into each block.
+  bool Changed = true;
+  while (Changed)
+  {
+    Changed = false;
+    for (auto B = Info.rbegin(); B != Info.rend(); B++)
+    {
+      BlockInfo &BI = B->second;
+      for (uint32_t S : BI.Successors)
+      {
+        auto SI = Info.find(S);
+        if (SI != Info.end())
+          BI.LiveOut.insert(SI->second.LiveIn.begin(), SI->second.LiveIn.end());
+      }
+
+      std::set<uint32_t> LiveIn = BI.Uses;
+      for (uint32_t V : BI.LiveOut)
+        if (!BI.Defs.count(V))
+          LiveIn.insert(V);
+      if (LiveIn != BI.LiveIn)
+      {
+        BI.LiveIn = std::move(LiveIn);
+        Changed = true;
+      }
+    }
+  }
+
+  // Walk backwards through each block to find the peak register pressure.
+  uint32_t Max = 0;
+  for (auto &B : Info)
+  {
+    std::set<uint32_t> Live = B.second.LiveOut;
+    uint32_t LiveWeight = 0;
+    for (uint32_t V : Live)
+      LiveWeight += Weights[V];
+    Max = std::max(Max, LiveWeight);
+
+    for (const Instruction *I = B.second.Last; I && I->getOpcode() != SpvOpLabel;
+         I = I->previous())
+    {
+      uint32_t Result = I->getResultType() ? I->getOperand(1) : 0;
+
+      // Values that are live across a call are held while the callee runs.
+      if (I->getOpcode() == SpvOpFunctionCall)
+      {
+        uint32_t Callee =
+            estimateRegisters(M, M.getFunction(I->getOperand(2)), Pressure);
+        uint32_t Held = LiveWeight - (Live.count(Result) ? Weights[Result] : 0);
+        Max = std::max(Max, Held + Callee);
+      }
+
+      if (Result && Live.erase(Result))
+        LiveWeight -= Weights[Result];
+      unsigned FirstOperand = I->getResultType() ? 2 : 0;
+      for (unsigned i = FirstOperand; i < I->getNumOperands(); i++)
+      {
+        uint32_t Op = I->getOperand(i);
+        if (Weights.count(Op) && Live.insert(Op).second)
+          LiveWeight += Weights[Op];
+      }
+      Max = std::max(Max, LiveWeight);
+    }
+  }
+
+  Pressure[F] = std::max<uint32_t>(Max, 1);
+  return Pressure[F];
+}
+
+double Occupancy::getTheoretical() const
+{
+  return std::min(1.0, (double)(GroupsPerCore * GroupInvocations) /
+                           Resources.Invocations);
+}
+
+void Occupancy::print(std::ostream &O, double ResidentGroups) const
+{
+  static const char *LimiterNames[] = {
+      "registers", "workgroup memory", "invocations", "workgroups", "lanes",
+  };
+
+  double Achieved = std::min(1.0, ResidentGroups * GroupInvocations /
+                                      Resources.Invocations);
+
+  std::ostringstream Percentages;
+  Percentages << std::fixed << std::setprecision(1)
+              << "theoretical " << (100.0 * getTheoretical()) << "%, achieved "
+              << (100.0 * Achieved) << "%";
+
+  O << "  Occupancy: " << GroupsPerCore << " workgroups per core (limited by "
+    << LimiterNames[Limit] << "), " << Percentages.str() << std::endl;
+  O << "    Registers per invocation: " << Registers << std::endl;
+  O << "    Workgroup memory per group: " << WorkgroupMemory << " bytes"
+    << std::endl;
+}
+
+} // namespace talvos
@@ -0,0 +1,245 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file PerformanceCounters.cpp
+/// This file defines the PerformanceCounters class.
+
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+
+#include <spirv/unified1/spirv.h>
+
+#include "talvos/Memory.h"
+#include "talvos/PerformanceCounters.h"
+
+namespace talvos
+{
+
+/// Source of unique identifiers for PerformanceCounters instances.
+static std::atomic<uint64_t> NextCountersId(1);
+
+thread_local PerformanceCounters::SlotCache PerformanceCounters::CachedSlot;
+
+PerformanceCounters::PerformanceCounters() : Id(NextCountersId++), Released{} {}
+
+void PerformanceCounters::addBytesLoaded(MemoryScope Scope, uint64_t NumBytes)
+{
+  switch (Scope)
+  {
+  case MemoryScope::Device:
+    add(BYTES_LOADED_DEVICE, NumBytes);
+    break;
+  case MemoryScope::Workgroup:
+    add(BYTES_LOADED_WORKGROUP, NumBytes);
+    break;
+  case MemoryScope::Invocation:
+    add(BYTES_LOADED_INVOCATION, NumBytes);
+    break;
+  }
+}
+
+void PerformanceCounters::addBytesStored(MemoryScope Scope, uint64_t NumBytes)
+{
+  switch (Scope)
+  {
+  case MemoryScope::Device:
+    add(BYTES_STORED_DEVICE, NumBytes);
+    break;
+  case MemoryScope::Workgroup:
+    add(BYTES_STORED_WORKGROUP, NumBytes);
+    break;
+  case MemoryScope::Invocation:
+    add(BYTES_STORED_INVOCATION, NumBytes);
+    break;
+  }
+}
+
+uint64_t PerformanceCounters::get(Counter C) const
+{
+  assert(C < NUM_COUNTERS);
+  std::lock_guard<std::mutex> Lock(SlotsMutex);
+  uint64_t Total = Released[C];
+  for (auto &S : Slots)
+    Total += S.second->Values[C].load(std::memory_order_relaxed);
+  return Total;
+}
+
+PerformanceCounters::Values PerformanceCounters::getAll() const
+{
+  std::lock_guard<std::mutex> Lock(SlotsMutex);
+  Values Totals = Released;
+  for (auto &S : Slots)
+    for (unsigned C = 0; C < NUM_COUNTERS; C++)
+      Totals[C] += S.second->Values[C].load(std::memory_order_relaxed);
+  return Totals;
+}
+
+PerformanceCounters::Counter
+PerformanceCounters::getInstructionClass(uint16_t Opcode)
+{
+  switch (Opcode)
+  {
+  case SpvOpAccessChain:
+  case SpvOpCopyMemory:
+  case SpvOpInBoundsAccessChain:
+  case SpvOpLoad:
+  case SpvOpPtrAccessChain:
+  case SpvOpStore:
+  case SpvOpVariable:
+    return INSTRUCTIONS_MEMORY;
+  case SpvOpAtomicAnd:
+  case SpvOpAtomicCompareExchange:
+  case SpvOpAtomicExchange:
+  case SpvOpAtomicIAdd:
+  case SpvOpAtomicIDecrement:
+  case SpvOpAtomicIIncrement:
+  case SpvOpAtomicISub:
+  case SpvOpAtomicLoad:
+  case SpvOpAtomicOr:
+  case SpvOpAtomicSMax:
+  case SpvOpAtomicSMin:
+  case SpvOpAtomicStore:
+  case SpvOpAtomicUMax:
+  case SpvOpAtomicUMin:
+  case SpvOpAtomicXor:
+    return INSTRUCTIONS_ATOMIC;
+  case SpvOpBranch:
+  case SpvOpBranchConditional:
+  case SpvOpDispatchTALVOS:
+  case SpvOpFunctionCall:
+  case SpvOpKill:
+  case SpvOpLoopMerge:
+  case SpvOpPhi:
+  case SpvOpReturn:
+  case SpvOpReturnValue:
+  case SpvOpSelectionMerge:
+  case SpvOpSwitch:
+  case SpvOpUnreachable:
+    return INSTRUCTIONS_CONTROL_FLOW;
+  case SpvOpControlBarrier:
+  case SpvOpMemoryBarrier:
+    return INSTRUCTIONS_BARRIER;
+  case SpvOpImage:
+  case SpvOpImageFetch:
+  case SpvOpImageQuerySize:
+  case SpvOpImageQuerySizeLod:
+  case SpvOpImageRead:
+  case SpvOpImageSampleExplicitLod:
+  case SpvOpImageWrite:
+  case SpvOpSampledImage:
+    return INSTRUCTIONS_IMAGE;
+  case SpvOpCopyObject:
+  case SpvOpLine:
+  case SpvOpNoLine:
+  case SpvOpNop:
+  case SpvOpUndef:
+    return INSTRUCTIONS_OTHER;
+  default:
+    return INSTRUCTIONS_ARITHMETIC;
+  }
+}
+
+const char *PerformanceCounters::getName(Counter C)
+{
+  switch (C)
+  {
+#define CASE(X)                                                                \
+  case X:                                                                      \
+    return #X
+    CASE(INSTRUCTIONS_ARITHMETIC);
+    CASE(INSTRUCTIONS_MEMORY);
+    CASE(INSTRUCTIONS_CONTROL_FLOW);
+    CASE(INSTRUCTIONS_ATOMIC);
+    CASE(INSTRUCTIONS_BARRIER);
+    CASE(INSTRUCTIONS_IMAGE);
+    CASE(INSTRUCTIONS_OTHER);
+    CASE(FLOPS);
+    CASE(BYTES_LOADED_DEVICE);
+    CASE(BYTES_LOADED_WORKGROUP);
+    CASE(BYTES_LOADED_INVOCATION);
+    CASE(BYTES_STORED_DEVICE);
+    CASE(BYTES_STORED_WORKGROUP);
+    CASE(BYTES_STORED_INVOCATION);
+    CASE(ATOMICS);
+    CASE(BARRIERS);
+    CASE(WORKGROUPS);
+    CASE(INVOCATIONS);
+    CASE(ALLOCATIONS);
+    CASE(MODELED_CYCLES);
+    CASE(COMPILED_BLOCKS);
+#undef CASE
+  default:
+    return "<unknown>";
+  }
+}
+
+void PerformanceCounters::print(std::ostream &O) const
+{
+  Values Totals = getAll();
+  for (unsigned C = 0; C < NUM_COUNTERS; C++)
+    O << "  " << std::left << std::setw(26) << getName((Counter)C)
+      << std::right << Totals[C] << std::endl;
+}
+
+void PerformanceCounters::registerThread()
+{
+  std::lock_guard<std::mutex> Lock(SlotsMutex);
+
+  // Look for an existing slot for this thread.
+  std::thread::id Thread = std::this_thread::get_id();
+  Slot *S = nullptr;
+  for (auto &Entry : Slots)
+  {
+    if (Entry.first == Thread)
+    {
+      S = Entry.second.get();
+      break;
+    }
+  }
+
+  // Create a new slot if necessary.
+  if (!S)
+  {
+    Slots.push_back({Thread, std::make_unique<Slot>()});
+    S = Slots.back().second.get();
+    for (auto &V : S->Values)
+      V.store(0, std::memory_order_relaxed);
+  }
+
+  CachedSlot.Owner = Id;
+  CachedSlot.S = S;
+}
+
+void PerformanceCounters::releaseThread()
+{
+  std::lock_guard<std::mutex> Lock(SlotsMutex);
+
+  std::thread::id Thread = std::this_thread::get_id();
+  for (auto Itr = Slots.begin(); Itr != Slots.end(); Itr++)
+  {
+    if (Itr->first != Thread)
+      continue;
+
+    for (unsigned C = 0; C < NUM_COUNTERS; C++)
+      Released[C] += Itr->second->Values[C].load(std::memory_order_relaxed);
+    Slots.erase(Itr);
+    break;
+  }
+
+  if (CachedSlot.Owner == Id)
+    CachedSlot.Owner = 0;
+}
+
+void PerformanceCounters::reset()
+{
+  std::lock_guard<std::mutex> Lock(SlotsMutex);
+  Released.fill(0);
+  for (auto &S : Slots)
+    for (auto &V : S.second->Values)
+      V.store(0, std::memory_order_relaxed);
+}
+
+} // namespace talvos
@@ -45,6 +45,7 @@
 #include <spirv/unified1/spirv.h>
 
 #include "Utils.h"
+#include "talvos/BarrierReport.h"
 #include "talvos/Commands.h"
 #include "talvos/ComputePipeline.h"
 #include "talvos/Device.h"
@@ -58,9 +59,12 @@
 #include "talvos/PipelineExecutor.h"
 #include "talvos/PipelineStage.h"
 #include "talvos/RenderPass.h"
+#include "talvos/TimingModel.h"
 #include "talvos/Type.h"
 #include "talvos/Variable.h"
 #include "talvos/Workgroup.h"
+#include "talvos/WorkgroupReport.h"
+#include "talvos/WorkgroupSampler.h"
 
 /// The number of lines before and after the current instruction to print.
 #define CONTEXT_SIZE 3
@@ -73,10 +77,6 @@ using PhyCoord = PipelineExecutor::PhyCoord;
 using LogCoord = PipelineExecutor::LogCoord;
 using Core = PipelineExecutor::Core;
 
-std::map<PhyCoord, LaneState> PipelineExecutor::Lanes;
-std::map<PhyCoord, LogCoord> PipelineExecutor::Assignments;
-std::vector<Core> PipelineExecutor::Cores;
-
 static thread_local uint64_t ActiveLaneMask;
 
 // static thread_local uint64_t ActiveGroupMask;
@@ -91,9 +91,6 @@ static thread_local Invocation *CurrentInvocation;
 // static std::vector<std::queue<std::function<void()>>> CurrentMicrotasks;
 // static thread_local std::vector<Instruction *> CorePCs;
 
-uint32_t PipelineExecutor::NextBreakpoint = 1;
-std::map<uint32_t, uint32_t> PipelineExecutor::Breakpoints;
-
 PipelineExecutor::SavedLocals PipelineExecutor::pushState()
 {
   return {Lanes,
@@ -176,6 +173,13 @@ PipelineExecutor::PipelineExecutor(PipelineExecutorKey Key, Device &Dev)
 
   Interactive = checkEnv("TALVOS_INTERACTIVE", false);
 
+  if (checkEnv("TALVOS_WORKGROUP_REPORT", false))
+    GroupReport = std::make_unique<WorkgroupReport>(
+        getEnvUInt("TALVOS_WORKGROUP_REPORT_TOP", 10));
+  if (checkEnv("TALVOS_BARRIER_REPORT", false))
+    BarrierStats = std::make_unique<BarrierReport>(
+        getEnvUInt("TALVOS_BARRIER_REPORT_TOP", 10));
+
   // Get number of worker threads to launch.
   NumThreads = 1;
   // if (!Interactive && Dev.isThreadSafe())
@@ -321,25 +325,45 @@ void PipelineExecutor::start(const talvos::DispatchCommand &Cmd)
   for (uint32_t GZ = 0; GZ < Cmd.getNumGroups().Z; GZ++)
     for (uint32_t GY = 0; GY < Cmd.getNumGroups().Y; GY++)
       for (uint32_t GX = 0; GX < Cmd.getNumGroups().X; GX++)
-      {
         PendingGroups.push_back(
             {BaseGroup.X + GX, BaseGroup.Y + GY, BaseGroup.Z + GZ});
 
-        auto Coord = PhyCoord{.Core = NextCore, .Lane = NextLane++};
+  if (GroupReport)
+    GroupReport->begin(BaseGroup, Cmd.getNumGroups());
 
-        Assignments[Coord] = {BaseGroup.X + GX, BaseGroup.Y + GY,
-                              BaseGroup.Z + GZ};
-        // TODO this is a little weird; kinda true, but a little weird
-        // TODO we really want to tease apart the program load from the program
-        // "step"
-        Lanes[Coord] = LaneState::AtBreakpoint;
+  // Only execute a sample of the groups, if requested.
+  if (WorkgroupSampler *Sampler = Dev.getWorkgroupSampler())
+    Sampler->select(PendingGroups);
 
-        if (NextLane >= Dev.Lanes)
-          NextCore++, NextLane = 0;
+  // Limit the number of groups resident on each core by the occupancy of the
+  // shader, if it is being modeled.
+  uint64_t LanesPerCore = Dev.Lanes;
+  if (TimingModel *Timing = Dev.getTimingModel())
+    LanesPerCore = std::min<uint64_t>(
+        LanesPerCore,
+        Timing->admitDispatch(*CurrentStage, PendingGroups.size()));
 
-        assert(NextCore < Dev.Cores && NextCore < 64 && NextLane < 64 &&
-               "tiny scheduler ran out of numbers");
-      }
+  for (const Dim3 &GroupId : PendingGroups)
+  {
+    // Groups that do not fit are admitted as resident groups complete (see
+    // admitPendingGroups).
+    if (NextCore >= Dev.Cores)
+      break;
+
+    auto Coord = PhyCoord{.Core = NextCore, .Lane = NextLane++};
+
+    Assignments[Coord] = GroupId;
+    // TODO this is a little weird; kinda true, but a little weird
+    // TODO we really want to tease apart the program load from the program
+    // "step"
+    Lanes[Coord] = LaneState::AtBreakpoint;
+
+    if (NextLane >= LanesPerCore)
+      NextCore++, NextLane = 0;
+
+    assert(NextCore < 64 && NextLane < 64 &&
+           "tiny scheduler ran out of numbers");
+  }
 
   // Run worker threads to process groups.
   NextWorkIndex = 0;
@@ -370,6 +394,11 @@ void PipelineExecutor::stop()
   GlobalMem.release(*PushConstantAddress);
   PushConstantAddress.reset();
 
+  if (GroupReport)
+    GroupReport->print(std::cerr);
+  if (BarrierStats)
+    BarrierStats->print(std::cerr);
+
   PendingGroups.clear();
   CurrentStage = nullptr;
   PC = nullptr;
@@ -565,6 +594,8 @@ Tick::Result PipelineExecutor::doPrepareTick()
 
             // TODO this blows up when we do sub-dispatches
             // assert(PC == CurrentInvocation->getCurrentInstruction());
+            if (TimingModel *Timing = Dev.getTimingModel())
+              Timing->setCurrentLane(phyCoord.Core, phyCoord.Lane);
             stepComputeWorker();
           }
           else if (CoreMask & LaneBit)
@@ -581,8 +612,8 @@ Tick::Result PipelineExecutor::doPrepareTick()
     else if (OpTy == MemoryOp)
     {
       // push in the tasks necessary to fulfill the slot
-      // something something structural hazards and stalls?
-      // TODO chunked by Dev.MemoryBandwidth or similar
+      // Bandwidth, latency and issue width are accounted for by the
+      // TimingModel (if enabled), which is told which lane is being stepped.
       for (const auto &[phyCoord, logCoord] : Assignments)
       {
         if (phyCoord.Core != Core)
@@ -609,6 +640,8 @@ Tick::Result PipelineExecutor::doPrepareTick()
 
             // TODO this blows up when we do sub-dispatches
             // assert(PC == CurrentInvocation->getCurrentInstruction());
+            if (TimingModel *Timing = Dev.getTimingModel())
+              Timing->setCurrentLane(phyCoord.Core, phyCoord.Lane);
             stepComputeWorker();
 
             // if we're the last task, update PC
@@ -646,6 +679,9 @@ PipelineExecutor::StepResult PipelineExecutor::step(uint64_t StepMask)
   while (tickModel(StepMask) == HasMoreMicrotasks)
     ;
 
+  // Give lanes whose groups have completed the next pending groups
+  admitPendingGroups();
+
   // Prepare the next tick
   if (doPrepareTick() == Tick::Result::Done)
     return FINISHED;
@@ -695,6 +731,42 @@ PipelineExecutor::StepResult PipelineExecutor::step(uint64_t StepMask)
   return OK;
 }
 
+void PipelineExecutor::admitPendingGroups()
+{
+  Dim3 GroupSize = CurrentStage->getGroupSize();
+  auto IsAssigned = [&](const Dim3 &GroupId) {
+    return std::any_of(Assignments.begin(), Assignments.end(),
+                       [&](const auto &A) {
+                         return Dim3(A.second.X / GroupSize.X,
+                                     A.second.Y / GroupSize.Y,
+                                     A.second.Z / GroupSize.Z) == GroupId;
+                       });
+  };
+
+  for (auto &[phyCoord, logCoord] : Assignments)
+  {
+    // A lane is free once its group can no longer be found.
+    if (doSwtch(logCoord))
+      continue;
+
+    // Take the first group that has not started and has no lane yet.
+    auto Next = std::find_if(PendingGroups.begin() + NextWorkIndex,
+                             PendingGroups.end(),
+                             [&](const Dim3 &G) { return !IsAssigned(G); });
+    if (Next == PendingGroups.end())
+      return;
+
+    logCoord = *Next * GroupSize;
+    Lanes[phyCoord] = LaneState::AtBreakpoint;
+    doSwtch(logCoord);
+
+    // Resume the core if all of its previous lanes had finished.
+    auto &PC = Cores[phyCoord.Core].PC;
+    if (!PC)
+      PC = CurrentInvocation->getCurrentInstruction();
+  }
+}
+
 void PipelineExecutor::stepComputeWorker()
 {
   while (true)
@@ -772,21 +844,34 @@ void PipelineExecutor::stepComputeWorker()
           abort();
         }
 
+        if (BarrierStats)
+          BarrierStats->barrier(*CurrentGroup);
+
         // Clear the barrier.
         for (auto &WI : WorkItems)
           WI->clearBarrier();
+        CurrentGroup->addBarrier();
         Dev.reportWorkgroupBarrier(CurrentGroup);
         continue;
       }
     }
 
     // All invocations must have completed - this group is done.
-    Dev.reportWorkgroupComplete(CurrentGroup);
-    delete CurrentGroup;
+    finishWorkgroup(CurrentGroup);
     CurrentGroup = nullptr;
   }
 }
 
+void PipelineExecutor::finishWorkgroup(Workgroup *Group)
+{
+  if (GroupReport)
+    GroupReport->record(*Group);
+  if (BarrierStats)
+    BarrierStats->complete(*Group);
+  Dev.reportWorkgroupComplete(Group);
+  delete Group;
+}
+
 void PipelineExecutor::startComputeWorker()
 {
   IsWorkerThread = true;
@@ -883,16 +968,19 @@ void PipelineExecutor::runComputeWorker()
           abort();
         }
 
+        if (BarrierStats)
+          BarrierStats->barrier(*CurrentGroup);
+
         // Clear the barrier.
         for (auto &WI : WorkItems)
           WI->clearBarrier();
+        CurrentGroup->addBarrier();
         Dev.reportWorkgroupBarrier(CurrentGroup);
       }
       else
       {
         // All invocations must have completed - this group is done.
-        Dev.reportWorkgroupComplete(CurrentGroup);
-        delete CurrentGroup;
+        finishWorkgroup(CurrentGroup);
         CurrentGroup = nullptr;
         break;
       }
@@ -2347,6 +2435,11 @@ void PipelineExecutor::printContext() const
       if (!I)
         break;
     }
+
+    // Show source location of current instruction if available.
+    std::ostringstream Loc;
+    if (CurrentStage->getModule()->printSourceLocation(Loc, CI))
+      std::cout << "   at " << Loc.str() << std::endl;
   }
 }
 
@@ -6,12 +6,20 @@
 /// \file PipelineStage.cpp
 /// This file defines the PipelineStage class.
 
+#include "Utils.h"
 #include "talvos/PipelineStage.h"
+#include "talvos/Block.h"
 #include "talvos/EntryPoint.h"
+#include "talvos/Function.h"
 #include "talvos/Instruction.h"
 #include "talvos/Invocation.h"
 #include "talvos/Module.h"
+#include "talvos/Type.h"
+#include "talvos/Variable.h"
 #include <cassert>
+#include <set>
+
+#include <spirv/unified1/spirv.h>
 
 namespace talvos
 {
@@ -21,6 +29,7 @@ PipelineStage::PipelineStage(Device &D, std::shared_ptr<const Module> M,
     : Mod(M), EP(EP)
 {
   assert(EP);
+  M->materialize(EP);
   Objects = M->getObjects();
 
   // Update objects with specialization constant values.
@@ -50,6 +59,173 @@ PipelineStage::PipelineStage(Device &D, std::shared_ptr<const Module> M,
     this->GroupSize.Y = WorkgroupSize.get<uint32_t>(1);
     this->GroupSize.Z = WorkgroupSize.get<uint32_t>(2);
   }
+
+  foldAccessChains();
+
+  // The objects cover every ID, including those allocated by inlining.
+  EntryCounts = std::vector<std::atomic<uint32_t>>(Objects.size());
+  CompiledBlocks = std::vector<std::atomic<CompiledBlock *>>(Objects.size());
+  CompileThreshold = checkEnv("TALVOS_COMPILE", false)
+                         ? getEnvUInt("TALVOS_COMPILE_THRESHOLD", 16)
+                         : 0;
+}
+
+PipelineStage::~PipelineStage()
+{
+  for (auto &CB : CompiledBlocks)
+    delete CB.load();
+}
+
+void PipelineStage::compile(const Function *F) const
+{
+  for (auto &B : F->getBlocks())
+  {
+    CompiledBlock *CB = new CompiledBlock;
+    for (const Instruction *I = B.second->getLabel().next(); I; I = I->next())
+      CB->Instructions.push_back({I, Invocation::compile(I, Objects)});
+    CompiledBlocks[B.first].store(CB, std::memory_order_release);
+  }
+}
+
+void PipelineStage::enterFunction(const Function *F) const
+{
+  if (!CompileThreshold)
+    return;
+
+  // Stop counting once the function is hot, so that entries to it do not
+  // contend on the counter. Only the entry that reaches the threshold
+  // compiles the function; other invocations interpret it until it is done.
+  std::atomic<uint32_t> &Count = EntryCounts[F->getId()];
+  if (Count.load(std::memory_order_relaxed) >= CompileThreshold)
+    return;
+  if (Count.fetch_add(1, std::memory_order_relaxed) + 1 == CompileThreshold)
+    compile(F);
+}
+
+void PipelineStage::foldAccessChains()
+{
+  // Record the pointer types of results that access chains may use as bases,
+  // and find the access chains in every function used by the entry point.
+  std::vector<const Type *> PointerTypes(Objects.size());
+  Callees.resize(Objects.size());
+  for (const Variable *V : Mod->getVariables())
+    PointerTypes[V->getId()] = V->getType();
+
+  std::vector<const Instruction *> Chains;
+  std::vector<const Function *> Worklist = {EP->getFunction()};
+  std::set<const Function *> Visited = {EP->getFunction()};
+  while (!Worklist.empty())
+  {
+    const Function *Func = Worklist.back();
+    Worklist.pop_back();
+    for (auto &B : Func->getBlocks())
+    {
+      for (const Instruction *I = B.second->getLabel().next(); I; I = I->next())
+      {
+        const Type *ResultType = I->getResultType();
+        if (ResultType && ResultType->isPointer())
+          PointerTypes[I->getOperand(1)] = ResultType;
+
+        switch (I->getOpcode())
+        {
+        case SpvOpAccessChain:
+        case SpvOpInBoundsAccessChain:
+        case SpvOpPtrAccessChain:
+          Chains.push_back(I);
+          break;
+        case SpvOpFunctionCall:
+        {
+          const Function *Callee = Mod->getFunction(I->getOperand(2));
+          Callees[I->getOperand(1)] = Callee;
+          if (Visited.insert(Callee).second)
+            Worklist.push_back(Callee);
+          break;
+        }
+        default:
+          break;
+        }
+      }
+    }
+  }
+
+  FoldedAccessChains.resize(Objects.size());
+  for (const Instruction *Inst : Chains)
+  {
+    const Type *BaseType = PointerTypes[Inst->getOperand(2)];
+    if (!BaseType)
+      continue;
+
+    // The layout of a matrix or vector pointer is only known at runtime.
+    FoldedAccessChain Folded = {0, 0, BaseType->getElementType(), {}};
+    if (Folded.Ty->isMatrix() || Folded.Ty->isVector())
+      continue;
+
+    uint32_t FirstIndexOperand = 3;
+    if (Inst->getOpcode() == SpvOpPtrAccessChain)
+      FirstIndexOperand = 4;
+
+    // Fold indices until the first one that is not a constant.
+    for (uint32_t i = FirstIndexOperand; i < Inst->getNumOperands(); i++)
+    {
+      const Object &IndexObj = Objects[Inst->getOperand(i)];
+      if (!IndexObj || !IndexObj.getType()->isInt())
+        break;
+
+      uint64_t Index;
+      size_t IndexSize = IndexObj.getType()->getSize();
+      if (IndexSize == 2)
+        Index = IndexObj.get<uint16_t>();
+      else if (IndexSize == 4)
+        Index = IndexObj.get<uint32_t>();
+      else if (IndexSize == 8)
+        Index = IndexObj.get<uint64_t>();
+      else
+        break;
+
+      const Type *ElemTy = Folded.Ty->getElementType(Index);
+      Folded.Offset += Folded.Ty->getElementOffset(Index, Folded.MatrixLayout);
+      Folded.Ty = ElemTy;
+      Folded.NumIndices++;
+    }
+
+    if (Folded.NumIndices)
+      FoldedAccessChains[Inst->getOperand(1)] = Folded;
+  }
+}
+
+std::shared_ptr<const PipelineStage>
+PipelineStageCache::get(Device &D, std::shared_ptr<const Module> M,
+                        const EntryPoint *EP, const SpecConstantMap &SM)
+{
+  SpecValues Values;
+  for (auto &SC : SM)
+  {
+    const uint8_t *Data = SC.second.getData();
+    Values.push_back(
+        {SC.first, std::vector<uint8_t>(
+                       Data, Data + SC.second.getType()->getSize())});
+  }
+  Key K(M.get(), EP, std::move(Values));
+
+  // A capacity of zero disables the cache.
+  if (!Capacity)
+    return std::make_shared<const PipelineStage>(D, M, EP, SM);
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  auto Itr = Stages.find(K);
+  if (Itr != Stages.end())
+    return Itr->second;
+
+  // Evict the oldest stage if the cache is full.
+  if (Stages.size() >= Capacity && !Order.empty())
+  {
+    Stages.erase(Order.front());
+    Order.pop_front();
+  }
+
+  auto Stage = std::make_shared<const PipelineStage>(D, M, EP, SM);
+  Order.push_back(Stages.emplace(std::move(K), Stage).first);
+  return Stage;
 }
 
 } // namespace talvos
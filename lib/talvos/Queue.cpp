@@ -10,6 +10,7 @@
 
 #include "talvos/Commands.h"
 #include "talvos/Device.h"
+#include "talvos/PerformanceCounters.h"
 #include "talvos/Queue.h"
 
 namespace talvos
@@ -99,6 +100,9 @@ void Queue::run()
     StateChanged.notify_all();
     Mutex.unlock();
   }
+
+  // Free the performance counter slot used by this thread.
+  Dev.getCounters().releaseThread();
 }
 
 void Queue::waitIdle()
@@ -0,0 +1,301 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file Roofline.cpp
+/// This file defines the Roofline class.
+
+#include <iostream>
+
+#include <spirv/unified1/GLSL.std.450.h>
+#include <spirv/unified1/spirv.h>
+
+#include "talvos/Commands.h"
+#include "talvos/ComputePipeline.h"
+#include "talvos/EntryPoint.h"
+#include "talvos/Instruction.h"
+#include "talvos/Invocation.h"
+#include "talvos/Memory.h"
+#include "talvos/Module.h"
+#include "talvos/Object.h"
+#include "talvos/PipelineContext.h"
+#include "talvos/PipelineStage.h"
+#include "talvos/Roofline.h"
+#include "talvos/TimingModel.h"
+#include "talvos/Type.h"
+
+namespace talvos
+{
+
+/// Names of the memory storage classes used in the JSON report.
+static const char *ScopeNames[Roofline::NUM_SCOPES] = {
+    "device",
+    "workgroup",
+    "invocation",
+};
+
+/// Returns the number of scalar components in a value of type \p Ty.
+static uint64_t getNumComponents(const Type *Ty)
+{
+  if (Ty->isVector())
+    return Ty->getElementCount();
+  if (Ty->isMatrix())
+    return Ty->getElementCount() * Ty->getElementType()->getElementCount();
+  return 1;
+}
+
+/// Returns the number of components of the operand \p Index of \p Inst.
+static uint64_t getOperandComponents(const Invocation *Invoc,
+                                     const Instruction *Inst, unsigned Index)
+{
+  const Type *Ty = Invoc->getObject(Inst->getOperand(Index)).getType();
+  return Ty ? getNumComponents(Ty) : 1;
+}
+
+/// Print \p Value to \p O as a JSON number, or null if it is zero.
+static void printNumberOrNull(std::ostream &O, double Value)
+{
+  if (Value)
+    O << Value;
+  else
+    O << "null";
+}
+
+/// Print \p Str to \p O as a JSON string.
+static void printString(std::ostream &O, const std::string &Str)
+{
+  O << '"';
+  for (char C : Str)
+  {
+    if (C == '"' || C == '\\')
+      O << '\\';
+    O << C;
+  }
+  O << '"';
+}
+
+uint64_t Roofline::Dispatch::getBytes(MemoryScope Scope) const
+{
+  return BytesLoaded[(unsigned)Scope] + BytesStored[(unsigned)Scope];
+}
+
+double Roofline::Dispatch::getIntensity(MemoryScope Scope) const
+{
+  uint64_t Bytes = getBytes(Scope);
+  return Bytes ? (double)Flops / Bytes : 0.0;
+}
+
+Roofline::Roofline(const TimingModel &Model)
+{
+  uint64_t NumCores = Model.getNumCores();
+  DeviceProfile.FlopsPerCycle = (double)Model.getFlopsPerCycle() * NumCores;
+  DeviceProfile.ClockMHz = (double)Model.getClockMHz();
+
+  // Device memory is shared by all cores, and other storage classes have a
+  // channel on each core (matching the timing model).
+  for (unsigned S = 0; S < NUM_SCOPES; S++)
+  {
+    double Bandwidth = (double)Model.getMemoryParams((MemoryScope)S).Bandwidth;
+    if (S != (unsigned)MemoryScope::Device)
+      Bandwidth *= NumCores;
+    DeviceProfile.Bandwidth[S] = Bandwidth;
+  }
+}
+
+void Roofline::commandBegin(const Command *Cmd,
+                            const PerformanceCounters &Counters)
+{
+  if (Cmd->getType() == Command::DISPATCH)
+    Baseline = Counters.getAll();
+}
+
+void Roofline::commandComplete(const Command *Cmd,
+                               const PerformanceCounters &Counters)
+{
+  if (Cmd->getType() != Command::DISPATCH)
+    return;
+
+  const DispatchCommand *DC = (const DispatchCommand *)Cmd;
+  PerformanceCounters::Values Current = Counters.getAll();
+  auto Delta = [&](PerformanceCounters::Counter C) {
+    return Current[C] - Baseline[C];
+  };
+
+  Dispatch D;
+  D.EntryName = DC->getPipelineContext()
+                    .getComputePipeline()
+                    ->getStage()
+                    ->getEntryPoint()
+                    ->getName();
+  D.NumGroups = DC->getNumGroups();
+  D.Flops = Delta(PerformanceCounters::FLOPS);
+  D.ModeledCycles = Delta(PerformanceCounters::MODELED_CYCLES);
+  for (unsigned S = 0; S < NUM_SCOPES; S++)
+  {
+    D.BytesLoaded[S] =
+        Delta((PerformanceCounters::Counter)(
+            PerformanceCounters::BYTES_LOADED_DEVICE + S));
+    D.BytesStored[S] =
+        Delta((PerformanceCounters::Counter)(
+            PerformanceCounters::BYTES_STORED_DEVICE + S));
+  }
+  Dispatches.push_back(D);
+}
+
+uint64_t Roofline::countFlops(const Invocation *Invoc, const Instruction *Inst)
+{
+  switch (Inst->getOpcode())
+  {
+  case SpvOpExtInst:
+    // Only the GLSL.std.450 instructions are known to be arithmetic.
+    if (Inst->getOperand(2) != Invoc->getModule()->getGLSLExtInstSet())
+      return 0;
+    break;
+  case SpvOpDot:
+  case SpvOpFAdd:
+  case SpvOpFDiv:
+  case SpvOpFMod:
+  case SpvOpFMul:
+  case SpvOpFNegate:
+  case SpvOpFRem:
+  case SpvOpFSub:
+  case SpvOpMatrixTimesMatrix:
+  case SpvOpMatrixTimesScalar:
+  case SpvOpMatrixTimesVector:
+  case SpvOpOuterProduct:
+  case SpvOpVectorTimesMatrix:
+  case SpvOpVectorTimesScalar:
+    break;
+  default:
+    return 0;
+  }
+
+  // Only operations that produce floating point results are counted.
+  const Type *ResultType = Inst->getResultType();
+  const Type *ComponentType = ResultType;
+  while (ComponentType->isVector() || ComponentType->isMatrix())
+    ComponentType = ComponentType->getElementType();
+  if (!ComponentType->isFloat())
+    return 0;
+
+  uint64_t Components = getNumComponents(ResultType);
+  switch (Inst->getOpcode())
+  {
+  case SpvOpDot:
+    return 2 * getOperandComponents(Invoc, Inst, 2);
+  case SpvOpMatrixTimesVector:
+    // Each result component is a dot product with the vector operand.
+    return 2 * Components * getOperandComponents(Invoc, Inst, 3);
+  case SpvOpVectorTimesMatrix:
+    return 2 * Components * getOperandComponents(Invoc, Inst, 2);
+  case SpvOpMatrixTimesMatrix:
+  {
+    // Each result component is a dot product of a row of the left operand
+    // with a column of the right operand.
+    const Type *Right = Invoc->getObject(Inst->getOperand(3)).getType();
+    uint64_t Inner = Right ? Right->getElementType()->getElementCount() : 1;
+    return 2 * Components * Inner;
+  }
+  case SpvOpExtInst:
+    // Count each extended instruction as a single operation per component,
+    // apart from fused multiply-add which performs two.
+    if (Inst->getOperand(3) == GLSLstd450Fma)
+      return 2 * Components;
+    return Components;
+  default:
+    return Components;
+  }
+}
+
+double Roofline::getAttainable(const Dispatch &D, int &Bound) const
+{
+  // Find the resource that takes the longest to service the dispatch.
+  Bound = -1;
+  double Cycles = D.Flops / DeviceProfile.FlopsPerCycle;
+  for (unsigned S = 0; S < NUM_SCOPES; S++)
+  {
+    if (!DeviceProfile.Bandwidth[S])
+      continue;
+    double MemoryCycles =
+        D.getBytes((MemoryScope)S) / DeviceProfile.Bandwidth[S];
+    if (MemoryCycles > Cycles)
+    {
+      Cycles = MemoryCycles;
+      Bound = (int)S;
+    }
+  }
+  return Cycles ? D.Flops / Cycles : 0.0;
+}
+
+void Roofline::printJSON(std::ostream &O) const
+{
+  O << "{" << std::endl;
+  O << "  \"profile\": {" << std::endl;
+  O << "    \"clock_mhz\": " << DeviceProfile.ClockMHz << "," << std::endl;
+  O << "    \"peak_flops_per_cycle\": " << DeviceProfile.FlopsPerCycle << ","
+    << std::endl;
+  O << "    \"bandwidth\": {";
+  for (unsigned S = 0; S < NUM_SCOPES; S++)
+  {
+    O << (S ? ", " : "") << "\"" << ScopeNames[S] << "\": ";
+    printNumberOrNull(O, DeviceProfile.Bandwidth[S]);
+  }
+  O << "}" << std::endl;
+  O << "  }," << std::endl;
+
+  O << "  \"dispatches\": [";
+  for (size_t i = 0; i < Dispatches.size(); i++)
+  {
+    const Dispatch &D = Dispatches[i];
+    O << (i ? "," : "") << std::endl;
+    O << "    {" << std::endl;
+    O << "      \"entry\": ";
+    printString(O, D.EntryName);
+    O << "," << std::endl;
+    O << "      \"groups\": [" << D.NumGroups.X << ", " << D.NumGroups.Y << ", "
+      << D.NumGroups.Z << "]," << std::endl;
+    O << "      \"flops\": " << D.Flops << "," << std::endl;
+
+    O << "      \"bytes\": {" << std::endl;
+    for (unsigned S = 0; S < NUM_SCOPES; S++)
+    {
+      O << "        \"" << ScopeNames[S] << "\": {\"loaded\": "
+        << D.BytesLoaded[S] << ", \"stored\": " << D.BytesStored[S] << "}"
+        << (S + 1 < NUM_SCOPES ? "," : "") << std::endl;
+    }
+    O << "      }," << std::endl;
+
+    O << "      \"intensity\": {";
+    for (unsigned S = 0; S < NUM_SCOPES; S++)
+    {
+      O << (S ? ", " : "") << "\"" << ScopeNames[S] << "\": ";
+      printNumberOrNull(O, D.getIntensity((MemoryScope)S));
+    }
+    O << "}," << std::endl;
+
+    int Bound;
+    double Attainable = getAttainable(D, Bound);
+    O << "      \"bound\": \"" << (Bound < 0 ? "compute" : ScopeNames[Bound])
+      << "\"," << std::endl;
+    O << "      \"attainable_flops_per_cycle\": " << Attainable << ","
+      << std::endl;
+    O << "      \"attainable_gflops\": "
+      << Attainable * DeviceProfile.ClockMHz / 1000;
+    if (D.ModeledCycles)
+    {
+      double Achieved = (double)D.Flops / D.ModeledCycles;
+      O << "," << std::endl;
+      O << "      \"modeled_cycles\": " << D.ModeledCycles << "," << std::endl;
+      O << "      \"achieved_flops_per_cycle\": " << Achieved << ","
+        << std::endl;
+      O << "      \"achieved_gflops\": "
+        << Achieved * DeviceProfile.ClockMHz / 1000;
+    }
+    O << std::endl << "    }";
+  }
+  O << std::endl << "  ]" << std::endl;
+  O << "}" << std::endl;
+}
+
+} // namespace talvos
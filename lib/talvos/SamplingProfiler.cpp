@@ -0,0 +1,203 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file SamplingProfiler.cpp
+/// This file defines the SamplingProfiler class.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "talvos/Commands.h"
+#include "talvos/Instruction.h"
+#include "talvos/Invocation.h"
+#include "talvos/Module.h"
+#include "talvos/SamplingProfiler.h"
+
+/// The number of entries to show in each section of a profile report.
+#define REPORT_SIZE 10
+
+namespace talvos
+{
+
+/// Source of unique identifiers for SamplingProfiler instances.
+static std::atomic<uint64_t> NextProfilerId(1);
+
+thread_local SamplingProfiler::SampleCache SamplingProfiler::LastSample;
+
+SamplingProfiler::SamplingProfiler(uint64_t Interval, size_t Capacity)
+    : Id(NextProfilerId++), Interval(Interval), Capacity(Capacity)
+{
+  assert(Interval > 0);
+  Samples = std::make_unique<Sample[]>(Capacity);
+  NextSample = 0;
+  Tick = 1;
+  Stop = false;
+  Watcher = std::thread(&SamplingProfiler::watch, this);
+}
+
+SamplingProfiler::~SamplingProfiler()
+{
+  // Signal watcher thread to exit.
+  {
+    std::lock_guard<std::mutex> Lock(WatcherMutex);
+    Stop = true;
+  }
+  StopSignal.notify_all();
+  Watcher.join();
+}
+
+void SamplingProfiler::commandComplete(const Command *Cmd)
+{
+  switch (Cmd->getType())
+  {
+  case Command::DISPATCH:
+  case Command::DRAW:
+  case Command::DRAW_INDEXED:
+    break;
+  default:
+    return;
+  }
+
+  // All workers have finished, so the sample buffer is stable here.
+  report(std::cerr, NextSample.load());
+  NextSample = 0;
+}
+
+void SamplingProfiler::sample(const Invocation *Invoc)
+{
+  LastSample.Owner = Id;
+  LastSample.Tick = Tick.load(std::memory_order_relaxed);
+
+  // Claim a slot in the sample buffer.
+  size_t Index = NextSample.fetch_add(1, std::memory_order_relaxed);
+  if (Index >= Capacity)
+    return;
+
+  Sample &S = Samples[Index];
+  S.Mod = Invoc->getModule().get();
+  S.Inst = Invoc->getCurrentInstruction();
+  S.Depth =
+      (uint32_t)std::min<size_t>(Invoc->getCallDepth(), MAX_STACK_DEPTH);
+  for (uint32_t i = 0; i < S.Depth; i++)
+    S.Stack[i] = Invoc->getCallSite(i);
+}
+
+void SamplingProfiler::report(std::ostream &O, size_t NumSamples) const
+{
+  size_t Dropped = 0;
+  if (NumSamples > Capacity)
+  {
+    Dropped = NumSamples - Capacity;
+    NumSamples = Capacity;
+  }
+
+  O << std::endl;
+  O << "Sampling profile: " << NumSamples << " samples (interval " << Interval
+    << "us";
+  if (Dropped)
+    O << ", " << Dropped << " dropped";
+  O << ")" << std::endl;
+  if (!NumSamples)
+    return;
+
+  // Aggregate samples by instruction, source line and call site.
+  typedef std::pair<const Module *, size_t> InstCount;
+  typedef std::map<const Instruction *, InstCount> InstCountMap;
+  InstCountMap ByInst;
+  InstCountMap ByCallSite;
+  std::map<std::string, size_t> ByLine;
+  for (size_t s = 0; s < NumSamples; s++)
+  {
+    const Sample &S = Samples[s];
+    auto &IC = ByInst[S.Inst];
+    IC.first = S.Mod;
+    IC.second++;
+
+    if (const SourceLocation *Loc = S.Mod->getSourceLocation(S.Inst))
+    {
+      std::string File = S.Mod->getDebugString(Loc->File);
+      if (File.empty())
+        File = "%" + std::to_string(Loc->File);
+      ByLine[File + ":" + std::to_string(Loc->Line)]++;
+    }
+
+    for (uint32_t i = 0; i < S.Depth; i++)
+    {
+      auto &CC = ByCallSite[S.Stack[i]];
+      CC.first = S.Mod;
+      CC.second++;
+    }
+  }
+
+  // Helper to print a sample count as a percentage.
+  auto printPercent = [&](size_t Count) {
+    std::ostringstream Percent;
+    Percent << std::fixed << std::setprecision(2)
+            << (100.0 * Count / NumSamples) << "%";
+    O << "  " << std::setw(8) << Percent.str() << "  ";
+  };
+
+  // Helper to print the top entries of an instruction map.
+  auto printInsts = [&](const InstCountMap &Map) {
+    std::vector<std::pair<const Instruction *, InstCount>> Sorted(Map.begin(),
+                                                                  Map.end());
+    std::stable_sort(Sorted.begin(), Sorted.end(), [](auto &A, auto &B) {
+      return A.second.second > B.second.second;
+    });
+    for (size_t i = 0; i < Sorted.size() && i < REPORT_SIZE; i++)
+    {
+      printPercent(Sorted[i].second.second);
+      Sorted[i].first->print(O, false);
+      std::ostringstream Loc;
+      if (Sorted[i].second.first->printSourceLocation(Loc, Sorted[i].first))
+        O << "  [" << Loc.str() << "]";
+      O << std::endl;
+    }
+  };
+
+  O << "  Instructions:" << std::endl;
+  printInsts(ByInst);
+
+  if (!ByLine.empty())
+  {
+    std::vector<std::pair<std::string, size_t>> Sorted(ByLine.begin(),
+                                                       ByLine.end());
+    std::stable_sort(Sorted.begin(), Sorted.end(),
+                     [](auto &A, auto &B) { return A.second > B.second; });
+    O << "  Source lines:" << std::endl;
+    for (size_t i = 0; i < Sorted.size() && i < REPORT_SIZE; i++)
+    {
+      printPercent(Sorted[i].second);
+      O << Sorted[i].first << std::endl;
+    }
+  }
+
+  if (!ByCallSite.empty())
+  {
+    O << "  Call sites (inclusive):" << std::endl;
+    printInsts(ByCallSite);
+  }
+}
+
+void SamplingProfiler::watch()
+{
+  std::unique_lock<std::mutex> Lock(WatcherMutex);
+  while (!Stop)
+  {
+    if (StopSignal.wait_for(Lock, std::chrono::microseconds(Interval),
+                            [this]() { return Stop; }))
+      break;
+    Tick.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+} // namespace talvos
@@ -0,0 +1,358 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file TimingModel.cpp
+/// This file defines the TimingModel class.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "talvos/Memory.h"
+#include "talvos/TimingModel.h"
+
+namespace talvos
+{
+
+/// Names of the instruction classes used in device description files.
+static const char *ClassNames[TimingModel::NUM_CLASSES] = {
+    "arithmetic", "memory", "control_flow", "atomic",
+    "barrier",    "image",  "other",
+};
+
+/// Names of the memory storage classes used in device description files.
+static const char *ScopeNames[TimingModel::NUM_SCOPES] = {
+    "device",
+    "workgroup",
+    "invocation",
+};
+
+/// Parse an unsigned integer from \p Str into \p Value.
+/// Returns false if \p Str is not a valid unsigned integer.
+static bool parseUInt(const std::string &Str, uint64_t &Value)
+{
+  if (Str.empty() || Str[0] == '-')
+    return false;
+  char *End;
+  Value = strtoull(Str.c_str(), &End, 0);
+  return !strlen(End);
+}
+
+TimingModel::TimingModel(uint64_t NumCores, uint64_t NumLanes)
+    : NumCores(NumCores), NumLanes(NumLanes)
+{
+  IssueWidth.assign(NumCores, 1);
+
+  Latency[PerformanceCounters::INSTRUCTIONS_ARITHMETIC] = 4;
+  Latency[PerformanceCounters::INSTRUCTIONS_MEMORY] = 1;
+  Latency[PerformanceCounters::INSTRUCTIONS_CONTROL_FLOW] = 1;
+  Latency[PerformanceCounters::INSTRUCTIONS_ATOMIC] = 1;
+  Latency[PerformanceCounters::INSTRUCTIONS_BARRIER] = 1;
+  Latency[PerformanceCounters::INSTRUCTIONS_IMAGE] = 8;
+  Latency[PerformanceCounters::INSTRUCTIONS_OTHER] = 1;
+
+  Memory[(unsigned)MemoryScope::Device] = {400, 64};
+  Memory[(unsigned)MemoryScope::Workgroup] = {20, 128};
+  Memory[(unsigned)MemoryScope::Invocation] = {0, 0};
+
+  CoreLimits = {65536, 49152, 2048, 32};
+
+  // Assume each lane can complete a fused multiply-add every cycle.
+  FlopsPerCycle = 2 * NumLanes;
+  ClockMHz = 1000;
+
+  beginDispatch();
+}
+
+uint64_t TimingModel::admitDispatch(const PipelineStage &Stage,
+                                    uint64_t NumGroups)
+{
+  CurrentOccupancy = std::make_unique<Occupancy>(Stage, CoreLimits, NumLanes);
+  AdmittedGroups = TotalGroups = NumGroups;
+  return CurrentOccupancy->getGroupsPerCore();
+}
+
+void TimingModel::beginDispatch()
+{
+  Cores.assign(NumCores, CoreState{});
+  LaneReady.assign(NumCores * NumLanes, 0);
+  DeviceChannelFree = 0;
+  for (unsigned S = 0; S < NUM_SCOPES; S++)
+  {
+    PendingBytes[S] = 0;
+    PendingLatency[S] = (uint64_t)-1;
+    TotalBytes[S] = 0;
+  }
+  CurrentLane = 0;
+  NumIssued = 0;
+  CurrentOccupancy.reset();
+  AdmittedGroups = 0;
+  TotalGroups = 0;
+}
+
+uint64_t TimingModel::endDispatch()
+{
+  uint64_t Cycles = getDispatchCycles();
+  LaneReady.clear();
+  Cores.clear();
+  CurrentOccupancy.reset();
+  return Cycles;
+}
+
+uint64_t TimingModel::getCycles() const
+{
+  uint64_t Cycles = DeviceChannelFree;
+  for (uint64_t Ready : LaneReady)
+    Cycles = std::max(Cycles, Ready);
+  for (const CoreState &C : Cores)
+  {
+    Cycles = std::max(Cycles, C.Cycle + (C.Issued ? 1 : 0));
+    for (uint64_t Free : C.ChannelFree)
+      Cycles = std::max(Cycles, Free);
+  }
+  return Cycles;
+}
+
+uint64_t TimingModel::getDispatchCycles() const
+{
+  uint64_t Cycles = getCycles();
+  if (!CurrentOccupancy || TotalGroups <= AdmittedGroups)
+    return Cycles;
+
+  // Workgroups run in waves of as many as can be resident on every core, so
+  // scale by the number of waves rather than the number of workgroups.
+  uint64_t WaveSize = std::max<uint64_t>(
+      CurrentOccupancy->getGroupsPerCore() * NumCores, 1);
+  uint64_t Waves = (AdmittedGroups + WaveSize - 1) / WaveSize;
+  uint64_t TotalWaves = (TotalGroups + WaveSize - 1) / WaveSize;
+  return Cycles * TotalWaves / Waves;
+}
+
+void TimingModel::issue(uint16_t Opcode)
+{
+  if (CurrentLane >= LaneReady.size())
+    return;
+
+  CoreState &C = Cores[CurrentLane / NumLanes];
+  uint64_t Width = IssueWidth[CurrentLane / NumLanes];
+
+  // Wait for the lane's previous instruction and a free issue slot.
+  uint64_t IssueCycle = std::max(C.Cycle, LaneReady[CurrentLane]);
+  if (IssueCycle > C.Cycle)
+  {
+    C.Cycle = IssueCycle;
+    C.Issued = 0;
+  }
+  if (++C.Issued >= Width)
+  {
+    C.Cycle++;
+    C.Issued = 0;
+  }
+  NumIssued++;
+
+  uint64_t Done =
+      IssueCycle + Latency[PerformanceCounters::getInstructionClass(Opcode)];
+
+  // Transfer any data accessed by the instruction.
+  for (unsigned S = 0; S < NUM_SCOPES; S++)
+  {
+    if (!PendingBytes[S])
+      continue;
+
+    uint64_t &ChannelFree =
+        S == (unsigned)MemoryScope::Device ? DeviceChannelFree
+                                           : C.ChannelFree[S];
+    uint64_t Start = std::max(IssueCycle, ChannelFree);
+    uint64_t Transfer = 0;
+    if (Memory[S].Bandwidth)
+      Transfer =
+          (PendingBytes[S] + Memory[S].Bandwidth - 1) / Memory[S].Bandwidth;
+    ChannelFree = Start + Transfer;
+    uint64_t AccessLatency = PendingLatency[S] == (uint64_t)-1
+                                 ? Memory[S].Latency
+                                 : PendingLatency[S];
+    Done = std::max(Done, Start + Transfer + AccessLatency);
+
+    TotalBytes[S] += PendingBytes[S];
+    PendingBytes[S] = 0;
+    PendingLatency[S] = (uint64_t)-1;
+  }
+
+  LaneReady[CurrentLane] = Done;
+}
+
+bool TimingModel::load(const std::string &FileName)
+{
+  std::ifstream File(FileName);
+  if (!File)
+  {
+    std::cerr << "ERROR: Failed to open device description file '" << FileName
+              << "'" << std::endl;
+    return false;
+  }
+
+  std::string Line;
+  unsigned LineNum = 0;
+  while (std::getline(File, Line))
+  {
+    LineNum++;
+
+    // Strip comments and split line into tokens.
+    Line = Line.substr(0, Line.find('#'));
+    std::istringstream SS(Line);
+    std::vector<std::string> Tokens;
+    std::string Token;
+    while (SS >> Token)
+      Tokens.push_back(Token);
+    if (Tokens.empty())
+      continue;
+
+    const char *Error = nullptr;
+    uint64_t Value;
+    if (Tokens[0] == "issue_width")
+    {
+      uint64_t Core;
+      if (Tokens.size() < 2 || Tokens.size() > 3)
+        Error = "usage: issue_width WIDTH [CORE]";
+      else if (!parseUInt(Tokens[1], Value) || Value == 0)
+        Error = "invalid issue width";
+      else if (Tokens.size() == 2)
+        IssueWidth.assign(NumCores, Value);
+      else if (!parseUInt(Tokens[2], Core) || Core >= NumCores)
+        Error = "invalid core index";
+      else
+        IssueWidth[Core] = Value;
+    }
+    else if (Tokens[0] == "latency")
+    {
+      const char **Class = ClassNames + NUM_CLASSES;
+      if (Tokens.size() == 3)
+        Class = std::find_if(ClassNames, ClassNames + NUM_CLASSES,
+                             [&](const char *Name) { return Tokens[1] == Name; });
+      if (Tokens.size() != 3)
+        Error = "usage: latency CLASS CYCLES";
+      else if (Class == ClassNames + NUM_CLASSES)
+        Error = "invalid instruction class";
+      else if (!parseUInt(Tokens[2], Value))
+        Error = "invalid latency";
+      else
+        Latency[Class - ClassNames] = Value;
+    }
+    else if (Tokens[0] == "memory")
+    {
+      const char **Scope = ScopeNames + NUM_SCOPES;
+      if (Tokens.size() == 4)
+        Scope = std::find_if(ScopeNames, ScopeNames + NUM_SCOPES,
+                             [&](const char *Name) { return Tokens[1] == Name; });
+      if (Tokens.size() != 4)
+        Error = "usage: memory STORAGE latency|bandwidth VALUE";
+      else if (Scope == ScopeNames + NUM_SCOPES)
+        Error = "invalid storage class";
+      else if (!parseUInt(Tokens[3], Value))
+        Error = "invalid value";
+      else if (Tokens[2] == "latency")
+        Memory[Scope - ScopeNames].Latency = Value;
+      else if (Tokens[2] == "bandwidth")
+        Memory[Scope - ScopeNames].Bandwidth = Value;
+      else
+        Error = "invalid memory parameter";
+    }
+    else if (Tokens[0] == "core")
+    {
+      if (Tokens.size() != 3)
+        Error = "usage: core RESOURCE VALUE";
+      else if (!parseUInt(Tokens[2], Value) || Value == 0)
+        Error = "invalid value";
+      else if (Tokens[1] == "registers")
+        CoreLimits.Registers = Value;
+      else if (Tokens[1] == "workgroup_memory")
+        CoreLimits.WorkgroupMemory = Value;
+      else if (Tokens[1] == "invocations")
+        CoreLimits.Invocations = Value;
+      else if (Tokens[1] == "workgroups")
+        CoreLimits.Workgroups = Value;
+      else
+        Error = "invalid core resource";
+    }
+    else if (Tokens[0] == "flops_per_cycle" || Tokens[0] == "clock_mhz")
+    {
+      if (Tokens.size() != 2)
+        Error = Tokens[0] == "clock_mhz" ? "usage: clock_mhz MHZ"
+                                         : "usage: flops_per_cycle FLOPS";
+      else if (!parseUInt(Tokens[1], Value) || Value == 0)
+        Error = "invalid value";
+      else if (Tokens[0] == "clock_mhz")
+        ClockMHz = Value;
+      else
+        FlopsPerCycle = Value;
+    }
+    else
+    {
+      Error = "unrecognized parameter";
+    }
+
+    if (Error)
+    {
+      std::cerr << "ERROR: " << FileName << ":" << LineNum << ": " << Error
+                << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void TimingModel::memoryAccess(MemoryScope Scope, uint64_t NumBytes)
+{
+  PendingBytes[(unsigned)Scope] += NumBytes;
+}
+
+void TimingModel::setAccessLatency(MemoryScope Scope, uint64_t Latency)
+{
+  uint64_t &Pending = PendingLatency[(unsigned)Scope];
+  Pending = Pending == (uint64_t)-1 ? Latency : std::max(Pending, Latency);
+}
+
+void TimingModel::print(std::ostream &O) const
+{
+  uint64_t Cycles = getCycles();
+
+  std::ostringstream IPC;
+  IPC << std::fixed << std::setprecision(2)
+      << (Cycles ? (double)NumIssued / Cycles : 0.0);
+
+  O << "Timing model: " << getDispatchCycles() << " cycles";
+  if (TotalGroups > AdmittedGroups)
+    O << " (extrapolated from " << Cycles << " cycles for " << AdmittedGroups
+      << " of " << TotalGroups << " workgroups)";
+  O << std::endl;
+  O << "  Instructions issued: " << NumIssued << " (" << IPC.str()
+    << " per cycle)" << std::endl;
+  for (unsigned S = 0; S < NUM_SCOPES; S++)
+  {
+    if (TotalBytes[S])
+      O << "  Bytes transferred (" << ScopeNames[S] << "): " << TotalBytes[S]
+        << std::endl;
+  }
+  if (CurrentOccupancy)
+  {
+    // Each lane holds one workgroup at a time, and is occupied from the start
+    // of the dispatch until its last instruction completes.
+    double ResidentGroups = 0;
+    if (Cycles)
+    {
+      for (uint64_t Ready : LaneReady)
+        ResidentGroups += Ready;
+      ResidentGroups /= (double)Cycles * NumCores;
+    }
+    CurrentOccupancy->print(O, ResidentGroups);
+  }
+}
+
+} // namespace talvos
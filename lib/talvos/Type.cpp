@@ -9,10 +9,13 @@
 #include <spirv/unified1/spirv.h>
 
 #include "talvos/Image.h"
+#include "talvos/Object.h"
 #include "talvos/Type.h"
 
 #include <cassert>
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
 
 namespace talvos
 {
@@ -27,12 +30,43 @@ size_t Type::getElementOffset(uint64_t Index) const
 {
   if (Id == STRUCT)
     return ElementOffsets[Index];
-  else if (Id == VECTOR || Id == MATRIX)
-    return ElementType->getSize() * Index;
-  else if (Id == ARRAY || Id == POINTER || Id == RUNTIME_ARRAY)
-    return ArrayStride * Index;
-  assert(false && "Not an aggregate type");
-  abort();
+  assert((isComposite() || Id == POINTER) && "Not an aggregate type");
+  return ElementStride * Index;
+}
+
+size_t Type::getElementOffset(uint64_t Index, PtrMatrixLayout &Layout) const
+{
+  size_t Offset;
+  if (Id == MATRIX && Layout)
+  {
+    // Special case for matrix pointers with non-default layouts.
+    if (Layout.Order == PtrMatrixLayout::COL_MAJOR)
+      Offset = Index * Layout.Stride;
+    else
+      Offset = Index * ElementType->getElementType()->getSize();
+  }
+  else if (Id == VECTOR && Layout)
+  {
+    // Special case for vector pointers with non-default layouts.
+    if (Layout.Order == PtrMatrixLayout::COL_MAJOR)
+      Offset = Index * ElementType->getSize();
+    else
+      Offset = Index * Layout.Stride;
+  }
+  else
+  {
+    Offset = getElementOffset(Index);
+  }
+
+  // Track the layout of a matrix member.
+  if (Id == STRUCT && Layouts[Index].MatrixStride)
+  {
+    Layout.Stride = Layouts[Index].MatrixStride;
+    Layout.Order = Layouts[Index].ColMajor ? PtrMatrixLayout::COL_MAJOR
+                                           : PtrMatrixLayout::ROW_MAJOR;
+  }
+
+  return Offset;
 }
 
 const Type *Type::getElementType(uint64_t Index) const
@@ -80,6 +114,48 @@ bool Type::isScalar() const
   return (Id == BOOL) || (Id == INT) || (Id == FLOAT) || (Id == POINTER);
 }
 
+bool Type::isIdentical(const Type &Other) const
+{
+  // Element types are already interned, so they are compared by address.
+  return Id == Other.Id && ByteSize == Other.ByteSize &&
+         BitWidth == Other.BitWidth && StorageClass == Other.StorageClass &&
+         ElementType == Other.ElementType &&
+         ElementCount == Other.ElementCount &&
+         ArrayStride == Other.ArrayStride &&
+         ElementTypes == Other.ElementTypes &&
+         ElementOffsets == Other.ElementOffsets &&
+         ReturnType == Other.ReturnType &&
+         ArgumentTypes == Other.ArgumentTypes &&
+         Dimensionality == Other.Dimensionality && Depth == Other.Depth &&
+         Arrayed == Other.Arrayed && Multisampled == Other.Multisampled &&
+         Sampled == Other.Sampled && Format == Other.Format;
+}
+
+const Type *Type::intern(std::unique_ptr<Type> Ty)
+{
+  // Interned types are deliberately never destroyed, since objects may refer
+  // to them until the very end of the process.
+  static std::mutex Mutex;
+  static auto &Interned =
+      *new std::unordered_multimap<size_t, std::unique_ptr<Type>>;
+
+  // Hash the fields that distinguish most types.
+  size_t Hash = std::hash<const Type *>()(Ty->ElementType);
+  for (size_t Value : {(size_t)Ty->Id, Ty->ByteSize, (size_t)Ty->BitWidth,
+                       (size_t)Ty->StorageClass, (size_t)Ty->ElementCount,
+                       (size_t)Ty->ArrayStride})
+    Hash = Hash * 31 + Value;
+  for (auto &Member : Ty->ElementTypes)
+    Hash = Hash * 31 + std::hash<const Type *>()(Member.first);
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  auto Range = Interned.equal_range(Hash);
+  for (auto Itr = Range.first; Itr != Range.second; Itr++)
+    if (Itr->second->isIdentical(*Ty))
+      return Itr->second.get();
+  return Interned.emplace(Hash, std::move(Ty))->second.get();
+}
+
 std::ostream &operator<<(std::ostream &Stream, const Type *Ty)
 {
   switch (Ty->Id)
@@ -237,6 +313,7 @@ std::unique_ptr<Type> Type::getArray(const Type *ElemType,
   T->ElementType = ElemType;
   T->ElementCount = ElementCount;
   T->ArrayStride = ArrayStride;
+  T->ElementStride = ArrayStride;
   return T;
 }
 
@@ -290,6 +367,7 @@ std::unique_ptr<Type> Type::getMatrix(const Type *ColumnType,
   std::unique_ptr<Type> T(new Type(MATRIX, NumColumns * ColumnType->getSize()));
   T->ElementType = ColumnType;
   T->ElementCount = NumColumns;
+  T->ElementStride = (uint32_t)ColumnType->getSize();
   return T;
 }
 
@@ -301,6 +379,7 @@ std::unique_ptr<Type> Type::getPointer(uint32_t StorageClass,
   T->StorageClass = StorageClass;
   T->ElementType = ElemType;
   T->ArrayStride = ArrayStride;
+  T->ElementStride = ArrayStride;
   return T;
 }
 
@@ -311,6 +390,7 @@ std::unique_ptr<Type> Type::getRuntimeArray(const Type *ElemType,
   std::unique_ptr<Type> T(new Type(RUNTIME_ARRAY, 0));
   T->ElementType = ElemType;
   T->ArrayStride = ArrayStride;
+  T->ElementStride = ArrayStride;
   return T;
 }
 
@@ -359,9 +439,24 @@ std::unique_ptr<Type> Type::getStruct(const StructElementTypeList &ElemTypes)
       CurrentOffset = Offsets[i] + ElemTypes[i].first->getSize();
   }
 
+  // Record the layout of each matrix member.
+  std::vector<MemberLayout> Layouts(ElemTypes.size(), MemberLayout{0, 0});
+  for (size_t i = 0; i < ElemTypes.size(); i++)
+  {
+    auto &Decorations = ElemTypes[i].second;
+    if (!Decorations.count(SpvDecorationMatrixStride))
+      continue;
+    Layouts[i].MatrixStride = Decorations.at(SpvDecorationMatrixStride);
+    if (Decorations.count(SpvDecorationColMajor))
+      Layouts[i].ColMajor = 1;
+    else
+      assert(Decorations.count(SpvDecorationRowMajor));
+  }
+
   std::unique_ptr<Type> T(new Type(STRUCT, CurrentOffset));
   T->ElementTypes = ElemTypes;
   T->ElementOffsets = Offsets;
+  T->Layouts = Layouts;
   T->ElementCount = (uint32_t)ElemTypes.size();
   return T;
 }
@@ -372,6 +467,7 @@ std::unique_ptr<Type> Type::getVector(const Type *ElemType, uint32_t ElemCount)
   std::unique_ptr<Type> T(new Type(VECTOR, ElemCount * ElemType->getSize()));
   T->ElementType = ElemType;
   T->ElementCount = ElemCount;
+  T->ElementStride = (uint32_t)ElemType->getSize();
   return T;
 }
 
@@ -30,7 +30,25 @@ bool checkEnv(const char *Name, bool Default)
   abort();
 }
 
-unsigned long getEnvUInt(const char *Name, unsigned Default)
+double getEnvDouble(const char *Name, double Default)
+{
+  const char *StrValue = getenv(Name);
+  if (!StrValue)
+    return Default;
+
+  char *End;
+  double Value = strtod(StrValue, &End);
+  if (strlen(End) || !strlen(StrValue))
+  {
+    std::cerr << std::endl
+              << "ERROR: Invalid value for " << Name << " environment variable"
+              << std::endl;
+    abort();
+  }
+  return Value;
+}
+
+unsigned long getEnvUInt(const char *Name, unsigned Default, bool AllowZero)
 {
   const char *StrValue = getenv(Name);
   if (!StrValue)
@@ -38,7 +56,7 @@ unsigned long getEnvUInt(const char *Name, unsigned Default)
 
   char *End;
   unsigned long Value = strtoul(StrValue, &End, 10);
-  if (strlen(End) || !strlen(StrValue) || Value == 0)
+  if (strlen(End) || !strlen(StrValue) || (Value == 0 && !AllowZero))
   {
     std::cerr << std::endl
               << "ERROR: Invalid value for " << Name << " environment variable"
@@ -16,9 +16,15 @@ namespace talvos
 /// or \p Default if it is not set.
 bool checkEnv(const char *Name, bool Default);
 
+/// Returns the floating point value for the environment variable \p Name, or
+/// \p Default if it is not set.
+double getEnvDouble(const char *Name, double Default);
+
 /// Returns the integer value for the environment variable \p Name, or
 /// \p Default if it is not set.
-unsigned long getEnvUInt(const char *Name, unsigned Default);
+/// A value of zero is rejected unless \p AllowZero is true.
+unsigned long getEnvUInt(const char *Name, unsigned Default,
+                         bool AllowZero = false);
 
 } // namespace talvos
 
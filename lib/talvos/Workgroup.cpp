@@ -24,6 +24,9 @@ Workgroup::Workgroup(Device &Dev, const PipelineExecutor &Executor,
                      Dim3 GroupId)
 {
   this->GroupId = GroupId;
+  NumInstructions = 0;
+  NumBarriers = 0;
+  StartTime = std::chrono::steady_clock::now();
   LocalMemory = new Memory(Dev, MemoryScope::Workgroup);
 
   const PipelineStage &Stage = Executor.getCurrentStage();
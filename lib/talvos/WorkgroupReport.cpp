@@ -0,0 +1,181 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file WorkgroupReport.cpp
+/// This file defines the WorkgroupReport class.
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "talvos/Workgroup.h"
+#include "talvos/WorkgroupReport.h"
+
+/// The number of bins in the instruction histogram.
+#define HISTOGRAM_BINS 8
+
+/// The length of the longest bar in the instruction histogram.
+#define HISTOGRAM_WIDTH 40
+
+/// The maximum width and height of the heat map.
+///\{
+#define HEATMAP_WIDTH 64
+#define HEATMAP_HEIGHT 32
+///\}
+
+namespace talvos
+{
+
+/// Characters used for the heat map, from fewest to most instructions.
+static const char HeatRamp[] = ".:-=+*#%@";
+
+WorkgroupReport::WorkgroupReport(unsigned NumTop) : NumTop(NumTop) {}
+
+void WorkgroupReport::begin(Dim3 BaseGroup, Dim3 NumGroups)
+{
+  this->BaseGroup = BaseGroup;
+  this->NumGroups = NumGroups;
+  Records.clear();
+}
+
+void WorkgroupReport::print(std::ostream &O)
+{
+  if (Records.empty())
+    return;
+
+  // Compute summary statistics.
+  uint64_t MinInstructions = UINT64_MAX, MaxInstructions = 0;
+  uint64_t MinTime = UINT64_MAX, MaxTime = 0;
+  uint32_t MinBarriers = UINT32_MAX, MaxBarriers = 0;
+  double TotalInstructions = 0, TotalTime = 0;
+  for (const Record &R : Records)
+  {
+    MinInstructions = std::min(MinInstructions, R.Instructions);
+    MaxInstructions = std::max(MaxInstructions, R.Instructions);
+    MinTime = std::min(MinTime, R.WallTime);
+    MaxTime = std::max(MaxTime, R.WallTime);
+    MinBarriers = std::min(MinBarriers, R.Barriers);
+    MaxBarriers = std::max(MaxBarriers, R.Barriers);
+    TotalInstructions += R.Instructions;
+    TotalTime += R.WallTime;
+  }
+  double MeanInstructions = TotalInstructions / Records.size();
+
+  std::ostringstream SS;
+  SS << std::fixed << std::setprecision(1);
+  SS << std::endl
+     << "Workgroup report: " << Records.size() << " workgroups" << std::endl;
+  SS << "  Instructions: min " << MinInstructions << ", mean "
+     << MeanInstructions << ", max " << MaxInstructions;
+  if (MeanInstructions > 0)
+    SS << " (max/mean " << std::setprecision(2)
+       << MaxInstructions / MeanInstructions << std::setprecision(1) << ")";
+  SS << std::endl;
+  SS << "  Wall time: min " << MinTime / 1000.0 << "us, mean "
+     << TotalTime / Records.size() / 1000.0 << "us, max " << MaxTime / 1000.0
+     << "us" << std::endl;
+  SS << "  Barriers: min " << MinBarriers << ", max " << MaxBarriers
+     << std::endl;
+
+  // Build a histogram of the instructions executed by each workgroup.
+  uint64_t BinWidth = (MaxInstructions - MinInstructions) / HISTOGRAM_BINS + 1;
+  size_t NumBins = (MaxInstructions - MinInstructions) / BinWidth + 1;
+  std::vector<uint64_t> Bins(NumBins);
+  for (const Record &R : Records)
+    Bins[(R.Instructions - MinInstructions) / BinWidth]++;
+  uint64_t MaxCount = *std::max_element(Bins.begin(), Bins.end());
+  size_t ValueWidth = std::to_string(MinInstructions + NumBins * BinWidth - 1)
+                          .length();
+  size_t CountWidth = std::to_string(MaxCount).length();
+
+  SS << "  Instruction histogram:" << std::endl;
+  for (size_t b = 0; b < NumBins; b++)
+  {
+    uint64_t Low = MinInstructions + b * BinWidth;
+    SS << "    " << std::setw(ValueWidth) << Low << " - "
+       << std::setw(ValueWidth) << Low + BinWidth - 1 << ": "
+       << std::setw(CountWidth) << Bins[b];
+    if (Bins[b])
+      SS << " "
+         << std::string(std::max<uint64_t>(Bins[b] * HISTOGRAM_WIDTH / MaxCount,
+                                           1),
+                        '#');
+    SS << std::endl;
+  }
+
+  // List the workgroups that executed the most instructions.
+  std::vector<const Record *> Sorted;
+  for (const Record &R : Records)
+    Sorted.push_back(&R);
+  std::stable_sort(Sorted.begin(), Sorted.end(),
+                   [](const Record *A, const Record *B) {
+                     return A->Instructions > B->Instructions;
+                   });
+  if (Sorted.size() > NumTop)
+    Sorted.resize(NumTop);
+  SS << "  Most instructions:" << std::endl;
+  for (const Record *R : Sorted)
+  {
+    SS << "    " << R->GroupId << ": " << R->Instructions << " instructions, "
+       << R->WallTime / 1000.0 << "us, " << R->Barriers << " barriers"
+       << std::endl;
+  }
+
+  // Build a heat map of the mean instructions over the X and Y dimensions,
+  // combining groups into cells if the grid is too large.
+  uint32_t Width = std::min<uint32_t>(NumGroups.X, HEATMAP_WIDTH);
+  uint32_t Height = std::min<uint32_t>(NumGroups.Y, HEATMAP_HEIGHT);
+  std::vector<double> CellTotal(Width * Height);
+  std::vector<uint64_t> CellCount(Width * Height);
+  for (const Record &R : Records)
+  {
+    uint64_t X = (uint64_t)(R.GroupId.X - BaseGroup.X) * Width / NumGroups.X;
+    uint64_t Y = (uint64_t)(R.GroupId.Y - BaseGroup.Y) * Height / NumGroups.Y;
+    CellTotal[X + Y * Width] += R.Instructions;
+    CellCount[X + Y * Width]++;
+  }
+
+  const size_t RampSize = sizeof(HeatRamp) - 1;
+  SS << "  Instruction heat map ('" << HeatRamp[0] << "' = " << MinInstructions
+     << ", '" << HeatRamp[RampSize - 1] << "' = " << MaxInstructions
+     << ", ' ' = not executed):" << std::endl;
+  for (uint32_t Y = 0; Y < Height; Y++)
+  {
+    std::string Row;
+    for (uint32_t X = 0; X < Width; X++)
+    {
+      uint64_t Count = CellCount[X + Y * Width];
+      if (!Count)
+      {
+        Row += ' ';
+        continue;
+      }
+      double Mean = CellTotal[X + Y * Width] / Count;
+      size_t Level = 0;
+      if (MaxInstructions > MinInstructions)
+        Level = (size_t)((Mean - MinInstructions) * (RampSize - 1) /
+                         (MaxInstructions - MinInstructions));
+      Row += HeatRamp[Level];
+    }
+    SS << "    " << Row << std::endl;
+  }
+
+  O << SS.str();
+  Records.clear();
+}
+
+void WorkgroupReport::record(const Workgroup &Group)
+{
+  uint64_t WallTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() -
+                          Group.getStartTime())
+                          .count();
+  Records.push_back({Group.getGroupId(), Group.getNumInstructions(), WallTime,
+                     Group.getNumBarriers()});
+}
+
+} // namespace talvos
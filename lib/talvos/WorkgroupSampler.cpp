@@ -0,0 +1,153 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file WorkgroupSampler.cpp
+/// This file defines the WorkgroupSampler class.
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "talvos/Commands.h"
+#include "talvos/WorkgroupSampler.h"
+
+namespace talvos
+{
+
+/// Returns a pseudo-random number derived from \p Seed and \p Index.
+static uint64_t hash(uint64_t Seed, uint64_t Index)
+{
+  // SplitMix64 finalizer.
+  uint64_t X = Seed + (Index + 1) * 0x9E3779B97F4A7C15ULL;
+  X = (X ^ (X >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  X = (X ^ (X >> 27)) * 0x94D049BB133111EBULL;
+  return X ^ (X >> 31);
+}
+
+WorkgroupSampler::WorkgroupSampler(uint64_t Count, double Fraction,
+                                   uint64_t Seed)
+    : Count(Count), Fraction(Fraction), Seed(Seed)
+{
+  assert(Count || (Fraction > 0 && Fraction <= 1));
+  NumGroups = 0;
+  NumSampled = 0;
+  Sampling = false;
+  LastGroup = nullptr;
+  LastCount = nullptr;
+}
+
+void WorkgroupSampler::commandBegin(const Command *Cmd,
+                                    const PerformanceCounters &Counters)
+{
+  if (Cmd->getType() == Command::DISPATCH)
+    Baseline = Counters.getAll();
+}
+
+void WorkgroupSampler::commandComplete(const Command *Cmd,
+                                       PerformanceCounters &Counters)
+{
+  if (Cmd->getType() != Command::DISPATCH || !Sampling)
+    return;
+
+  // Scale the counters that accumulate per workgroup up to the full number of
+  // workgroups. Allocations are made once per dispatch, and modeled cycles are
+  // extrapolated by the timing model from the number of waves of workgroups.
+  double Scale = (double)NumGroups / NumSampled;
+  PerformanceCounters::Values Current = Counters.getAll();
+  for (unsigned C = 0; C < PerformanceCounters::NUM_COUNTERS; C++)
+  {
+    if (C == PerformanceCounters::ALLOCATIONS ||
+        C == PerformanceCounters::MODELED_CYCLES)
+      continue;
+    uint64_t Delta = Current[C] - Baseline[C];
+    Counters.add((PerformanceCounters::Counter)C,
+                 (uint64_t)std::llround(Delta * (Scale - 1)));
+  }
+
+  uint64_t Instructions = 0;
+  for (unsigned C = PerformanceCounters::INSTRUCTIONS_ARITHMETIC;
+       C <= PerformanceCounters::INSTRUCTIONS_OTHER; C++)
+    Instructions += Current[C] - Baseline[C];
+
+  std::ostringstream SS;
+  SS << std::fixed << std::setprecision(1);
+  SS << std::endl
+     << "Workgroup sampling: executed " << NumSampled << " of " << NumGroups
+     << " workgroups (seed " << Seed << ")" << std::endl;
+  SS << "  Counters extrapolated by a factor of " << Scale << std::endl;
+  SS << "  Instructions: " << std::llround(Instructions * Scale);
+
+  // Estimate the standard error of the extrapolated instruction count from
+  // the variance between workgroups, with a finite population correction.
+  size_t N = GroupInstructions.size();
+  if (N > 1)
+  {
+    double Mean = 0;
+    for (uint64_t I : GroupInstructions)
+      Mean += I;
+    Mean /= N;
+    double Variance = 0;
+    for (uint64_t I : GroupInstructions)
+      Variance += (I - Mean) * (I - Mean);
+    Variance /= N - 1;
+    double Error = NumGroups * std::sqrt(Variance / N) *
+                   std::sqrt(1.0 - (double)N / NumGroups);
+    SS << " +/- " << 1.96 * Error << " (95% confidence)";
+  }
+  SS << std::endl;
+  SS << "  WARNING: the outputs of " << (NumGroups - NumSampled)
+     << " workgroups that were not sampled have not been written" << std::endl;
+  std::cerr << SS.str();
+
+  Sampling = false;
+  RunningGroups.clear();
+  GroupInstructions.clear();
+  LastGroup = nullptr;
+  LastCount = nullptr;
+}
+
+void WorkgroupSampler::select(std::vector<Dim3> &Groups)
+{
+  NumGroups = Groups.size();
+  NumSampled = Count ? Count : (uint64_t)std::ceil(NumGroups * Fraction);
+  NumSampled = std::max<uint64_t>(NumSampled, 1);
+  Sampling = NumSampled < NumGroups;
+  if (!Sampling)
+  {
+    NumSampled = NumGroups;
+    return;
+  }
+
+  // Choose one workgroup from each stratum.
+  std::vector<Dim3> Sample;
+  Sample.reserve(NumSampled);
+  uint64_t Quotient = NumGroups / NumSampled;
+  uint64_t Remainder = NumGroups % NumSampled;
+  for (uint64_t i = 0; i < NumSampled; i++)
+  {
+    uint64_t Begin = i * Quotient + (i * Remainder) / NumSampled;
+    uint64_t End = (i + 1) * Quotient + ((i + 1) * Remainder) / NumSampled;
+    Sample.push_back(Groups[Begin + hash(Seed, i) % (End - Begin)]);
+  }
+  Groups.swap(Sample);
+}
+
+void WorkgroupSampler::workgroupComplete(const Workgroup *Group)
+{
+  if (!Sampling)
+    return;
+
+  auto Itr = RunningGroups.find(Group);
+  GroupInstructions.push_back(Itr == RunningGroups.end() ? 0 : Itr->second);
+  if (Itr != RunningGroups.end())
+    RunningGroups.erase(Itr);
+  LastGroup = nullptr;
+  LastCount = nullptr;
+}
+
+} // namespace talvos
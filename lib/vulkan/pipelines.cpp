@@ -8,6 +8,7 @@
 #include <cstring>
 
 #include "talvos/ComputePipeline.h"
+#include "talvos/Device.h"
 #include "talvos/GraphicsPipeline.h"
 #include "talvos/Module.h"
 #include "talvos/PipelineStage.h"
@@ -84,9 +85,11 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateComputePipelines(
 
     // Create pipeline.
     pPipelines[i] = new VkPipeline_T;
-    talvos::PipelineStage *Stage = new talvos::PipelineStage(
-        *device->Device, Mod,
-        Mod->getEntryPoint(StageInfo.pName, EXEC_MODEL_GLCOMPUTE), SM);
+    talvos::Device &Dev = *device->Device;
+    std::shared_ptr<const talvos::PipelineStage> Stage =
+        Dev.getPipelineStageCache().get(
+            Dev, Mod, Mod->getEntryPoint(StageInfo.pName, EXEC_MODEL_GLCOMPUTE),
+            SM);
     pPipelines[i]->ComputePipeline = new talvos::ComputePipeline(Stage);
   }
   return VK_SUCCESS;
@@ -99,8 +102,9 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateGraphicsPipelines(
 {
   for (uint32_t i = 0; i < createInfoCount; i++)
   {
-    talvos::PipelineStage *VertexStage = nullptr;
-    talvos::PipelineStage *FragmentStage = nullptr;
+    talvos::Device &Dev = *device->Device;
+    std::shared_ptr<const talvos::PipelineStage> VertexStage;
+    std::shared_ptr<const talvos::PipelineStage> FragmentStage;
     for (uint32_t s = 0; s < pCreateInfos[i].stageCount; s++)
     {
       const VkPipelineShaderStageCreateInfo &StageInfo =
@@ -115,14 +119,14 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateGraphicsPipelines(
       switch (StageInfo.stage)
       {
       case VK_SHADER_STAGE_VERTEX_BIT:
-        VertexStage = new talvos::PipelineStage(
-            *device->Device, Mod,
-            Mod->getEntryPoint(StageInfo.pName, EXEC_MODEL_VERTEX), SM);
+        VertexStage = Dev.getPipelineStageCache().get(
+            Dev, Mod, Mod->getEntryPoint(StageInfo.pName, EXEC_MODEL_VERTEX),
+            SM);
         break;
       case VK_SHADER_STAGE_FRAGMENT_BIT:
-        FragmentStage = new talvos::PipelineStage(
-            *device->Device, Mod,
-            Mod->getEntryPoint(StageInfo.pName, EXEC_MODEL_FRAGMENT), SM);
+        FragmentStage = Dev.getPipelineStageCache().get(
+            Dev, Mod, Mod->getEntryPoint(StageInfo.pName, EXEC_MODEL_FRAGMENT),
+            SM);
         break;
       default:
         assert(false && "Unhandled pipeline stage");
@@ -0,0 +1,97 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file WarpAccessPlugin.cpp
+/// This file defines the WarpAccessPlugin class.
+
+#include "WarpAccessPlugin.h"
+
+#include "talvos/Commands.h"
+#include "talvos/Invocation.h"
+
+namespace talvos
+{
+
+WarpAccessPlugin::WarpAccessPlugin(const Device *Dev, MemoryScope Scope)
+    : WarpPlugin(Dev), Scope(Scope), Accessed(false)
+{}
+
+void WarpAccessPlugin::commandComplete(const Command *Cmd)
+{
+  WarpPlugin::commandComplete(Cmd);
+  if (Cmd->getType() != Command::DISPATCH)
+    return;
+
+  Requests.clear();
+  Iterations.clear();
+}
+
+void WarpAccessPlugin::instructionExecuted(const Invocation *Invoc,
+                                           const Instruction *Inst)
+{
+  if (Accessed)
+  {
+    Iterations[Invoc][Inst]++;
+    Accessed = false;
+  }
+}
+
+void WarpAccessPlugin::invocationComplete(const Invocation *Invoc)
+{
+  Iterations.erase(Invoc);
+}
+
+void WarpAccessPlugin::memoryLoad(const Memory *Mem, uint64_t Address,
+                                  uint64_t NumBytes, const Invocation *Invoc)
+{
+  recordAccess(Mem, Address, NumBytes, false, Invoc);
+}
+
+void WarpAccessPlugin::memoryStore(const Memory *Mem, uint64_t Address,
+                                   uint64_t NumBytes, const uint8_t *Data,
+                                   const Invocation *Invoc)
+{
+  recordAccess(Mem, Address, NumBytes, true, Invoc);
+}
+
+void WarpAccessPlugin::recordAccess(const Memory *Mem, uint64_t Address,
+                                    uint64_t NumBytes, bool IsStore,
+                                    const Invocation *Invoc)
+{
+  LaneInfo Info;
+  if (Mem->getScope() != Scope || !getLaneInfo(Invoc, Info))
+    return;
+
+  const Instruction *Inst = Invoc->getCurrentInstruction();
+  if (!Inst)
+    return;
+
+  // The k-th execution of an instruction by each lane forms one request.
+  uint64_t Iteration = 0;
+  auto InvocItr = Iterations.find(Invoc);
+  if (InvocItr != Iterations.end())
+  {
+    auto InstItr = InvocItr->second.find(Inst);
+    if (InstItr != InvocItr->second.end())
+      Iteration = InstItr->second;
+  }
+
+  RequestKey Request = {Inst, Info.Warp, Iteration, IsStore};
+  Requests[Info.Group][Request].push_back({Info.Lane, Address, NumBytes});
+  Accessed = true;
+}
+
+void WarpAccessPlugin::workgroupComplete(const Workgroup *Group)
+{
+  auto Itr = Requests.find(getGroupKey(Group));
+  if (Itr == Requests.end())
+    return;
+
+  for (auto &R : Itr->second)
+    analyzeRequest(std::get<0>(R.first), std::get<3>(R.first), R.second);
+  Requests.erase(Itr);
+}
+
+} // namespace talvos
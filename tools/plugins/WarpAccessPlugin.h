@@ -0,0 +1,82 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file WarpAccessPlugin.h
+/// This file declares the WarpAccessPlugin class.
+
+#ifndef TALVOS_WARPACCESSPLUGIN_H
+#define TALVOS_WARPACCESSPLUGIN_H
+
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "WarpPlugin.h"
+#include "talvos/Memory.h"
+
+namespace talvos
+{
+
+/// Base class for plugins that analyze memory accesses at warp granularity.
+///
+/// Accesses to memory with a particular scope made by the same dynamic instance
+/// of an instruction across the lanes of a warp are combined into a single
+/// request, which is passed to analyzeRequest() when the workgroup completes.
+class WarpAccessPlugin : public WarpPlugin
+{
+public:
+  /// Create a plugin that analyzes accesses to memory with scope \p Scope.
+  WarpAccessPlugin(const Device *Dev, MemoryScope Scope);
+
+  void commandComplete(const Command *Cmd) override;
+  void instructionExecuted(const Invocation *Invoc,
+                           const Instruction *Inst) override;
+  void invocationComplete(const Invocation *Invoc) override;
+  void memoryLoad(const Memory *Mem, uint64_t Address, uint64_t NumBytes,
+                  const Invocation *Invoc) override;
+  void memoryStore(const Memory *Mem, uint64_t Address, uint64_t NumBytes,
+                   const uint8_t *Data, const Invocation *Invoc) override;
+  void workgroupComplete(const Workgroup *Group) override;
+
+protected:
+  /// A single memory access made by one lane of a warp.
+  struct Access
+  {
+    uint32_t Lane;     ///< The lane that made the access.
+    uint64_t Address;  ///< The address accessed.
+    uint64_t NumBytes; ///< The number of bytes accessed.
+  };
+
+  /// Analyze the accesses made by one warp-level execution of \p Inst.
+  virtual void analyzeRequest(const Instruction *Inst, bool IsStore,
+                              const std::vector<Access> &Accesses) = 0;
+
+private:
+  /// Record an access from \p Invoc.
+  void recordAccess(const Memory *Mem, uint64_t Address, uint64_t NumBytes,
+                    bool IsStore, const Invocation *Invoc);
+
+  /// Identifies a warp-level request within a workgroup.
+  typedef std::tuple<const Instruction *, uint32_t, uint64_t, bool> RequestKey;
+
+  /// The memory scope being analyzed.
+  const MemoryScope Scope;
+
+  /// Pending requests for each running workgroup.
+  std::map<GroupKey, std::map<RequestKey, std::vector<Access>>> Requests;
+
+  /// Number of completed executions of each accessing instruction, for each
+  /// running invocation.
+  std::map<const Invocation *, std::map<const Instruction *, uint64_t>>
+      Iterations;
+
+  /// True if the instruction currently executing has accessed memory.
+  bool Accessed;
+};
+
+} // namespace talvos
+
+#endif
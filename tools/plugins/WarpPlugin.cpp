@@ -0,0 +1,93 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file WarpPlugin.cpp
+/// This file defines the WarpPlugin class.
+
+#include "WarpPlugin.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "talvos/Commands.h"
+#include "talvos/ComputePipeline.h"
+#include "talvos/Device.h"
+#include "talvos/Invocation.h"
+#include "talvos/PipelineContext.h"
+#include "talvos/PipelineStage.h"
+#include "talvos/Workgroup.h"
+
+namespace talvos
+{
+
+WarpPlugin::WarpPlugin(const Device *Dev)
+    : WarpSize((uint32_t)Dev->Lanes), GroupSize(0, 0, 0)
+{}
+
+void WarpPlugin::commandBegin(const Command *Cmd)
+{
+  if (Cmd->getType() != Command::DISPATCH)
+    return;
+
+  const DispatchCommand *DC = (const DispatchCommand *)Cmd;
+  GroupSize = DC->getPipelineContext()
+                  .getComputePipeline()
+                  ->getStage()
+                  ->getGroupSize();
+}
+
+void WarpPlugin::commandComplete(const Command *Cmd)
+{
+  if (Cmd->getType() != Command::DISPATCH)
+    return;
+
+  dispatchComplete();
+  GroupSize = Dim3(0, 0, 0);
+}
+
+bool WarpPlugin::getLaneInfo(const Invocation *Invoc, LaneInfo &Info) const
+{
+  // Only compute dispatches have warps.
+  if (GroupSize.X == 0)
+    return false;
+
+  // Determine workgroup, warp, and lane from the global invocation ID.
+  Dim3 GlobalId = Invoc->getGlobalId();
+  Dim3 LocalId = GlobalId % GroupSize;
+  uint32_t LocalIndex =
+      LocalId.X + (LocalId.Y + LocalId.Z * GroupSize.Y) * GroupSize.X;
+  Info.Group = {GlobalId.X / GroupSize.X, GlobalId.Y / GroupSize.Y,
+                GlobalId.Z / GroupSize.Z};
+  Info.Warp = LocalIndex / WarpSize;
+  Info.Lane = LocalIndex % WarpSize;
+  return true;
+}
+
+uint64_t WarpPlugin::getEnvUInt(const char *Name, uint64_t Default)
+{
+  const char *StrValue = getenv(Name);
+  if (!StrValue)
+    return Default;
+
+  char *End;
+  uint64_t Value = strtoull(StrValue, &End, 10);
+  if (strlen(End) || !strlen(StrValue))
+  {
+    std::cerr << std::endl
+              << "ERROR: Invalid value for " << Name << " environment variable"
+              << std::endl;
+    abort();
+  }
+  return Value;
+}
+
+WarpPlugin::GroupKey WarpPlugin::getGroupKey(const Workgroup *Group)
+{
+  Dim3 Id = Group->getGroupId();
+  return {Id.X, Id.Y, Id.Z};
+}
+
+} // namespace talvos
@@ -0,0 +1,98 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file WarpPlugin.h
+/// This file declares the WarpPlugin class.
+
+#ifndef TALVOS_WARPPLUGIN_H
+#define TALVOS_WARPPLUGIN_H
+
+#include <cstdint>
+#include <iostream>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "talvos/Dim3.h"
+#include "talvos/Instruction.h"
+#include "talvos/Plugin.h"
+
+namespace talvos
+{
+
+class Device;
+
+/// Base class for plugins that model the execution of compute shaders in warps.
+///
+/// Invocations are grouped into modeled warps of Device::Lanes consecutive
+/// invocations (by local invocation index) within each workgroup.
+class WarpPlugin : public Plugin
+{
+public:
+  /// Create a plugin that models warps on \p Dev.
+  WarpPlugin(const Device *Dev);
+
+  bool isThreadSafe() const override { return false; }
+
+  void commandBegin(const Command *Cmd) override;
+  void commandComplete(const Command *Cmd) override;
+
+  /// Returns the integer value of environment variable \p Name, or
+  /// \p Default if it is not set. Aborts if the value is not a valid decimal
+  /// integer.
+  static uint64_t getEnvUInt(const char *Name, uint64_t Default);
+
+protected:
+  /// Identifies a workgroup.
+  typedef std::tuple<uint32_t, uint32_t, uint32_t> GroupKey;
+
+  /// The position of an invocation within the modeled warps of a dispatch.
+  struct LaneInfo
+  {
+    GroupKey Group; ///< The workgroup containing the invocation.
+    uint32_t Warp;  ///< The index of the warp within its workgroup.
+    uint32_t Lane;  ///< The index of the lane within its warp.
+  };
+
+  /// Report the results of analyzing the dispatch that has just completed.
+  virtual void dispatchComplete() = 0;
+
+  /// Find the workgroup, warp and lane of \p Invoc.
+  /// Returns false if a compute dispatch is not currently running.
+  bool getLaneInfo(const Invocation *Invoc, LaneInfo &Info) const;
+
+  /// Returns the key used to identify \p Group.
+  static GroupKey getGroupKey(const Workgroup *Group);
+
+  /// Print \p Title followed by the first \p Count instructions in \p Sorted,
+  /// using \p PrintStats to print the statistics of each instruction.
+  template <typename Stats, typename PrintFn>
+  static void printInstructions(
+      const char *Title,
+      const std::vector<std::pair<const Instruction *, Stats>> &Sorted,
+      size_t Count, PrintFn PrintStats)
+  {
+    std::cout << "  " << Title << ":" << std::endl;
+    for (size_t i = 0; i < Sorted.size() && i < Count; i++)
+    {
+      std::cout << "    ";
+      Sorted[i].first->print(std::cout, false);
+      std::cout << std::endl << "      ";
+      PrintStats(Sorted[i].second);
+      std::cout << std::endl;
+    }
+  }
+
+  /// The number of lanes in a modeled warp.
+  const uint32_t WarpSize;
+
+private:
+  /// The workgroup size of the current dispatch, or (0,0,0) if none.
+  Dim3 GroupSize;
+};
+
+} // namespace talvos
+
+#endif
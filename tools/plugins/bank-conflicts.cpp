@@ -0,0 +1,153 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file bank-conflicts.cpp
+/// This file defines a plugin that analyzes workgroup memory bank conflicts.
+///
+/// Workgroup memory accesses made by the lanes of a modeled warp are combined
+/// into a request, and mapped onto a set of banks. The conflict degree of a
+/// request is the largest number of distinct words accessed in any one bank,
+/// which is the number of cycles needed to service it. The number of banks can
+/// be set with TALVOS_BANK_COUNT (default 32), the width of each bank with
+/// TALVOS_BANK_WIDTH (default 4 bytes), and the number of instructions listed
+/// with TALVOS_BANK_CONFLICTS_TOP (default 10).
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "WarpAccessPlugin.h"
+#include "talvos/Device.h"
+#include "talvos/Instruction.h"
+
+using namespace talvos;
+
+class BankConflicts : public WarpAccessPlugin
+{
+public:
+  BankConflicts(const Device *Dev)
+      : WarpAccessPlugin(Dev, MemoryScope::Workgroup),
+        NumBanks(getEnvUInt("TALVOS_BANK_COUNT", 32)),
+        BankWidth(getEnvUInt("TALVOS_BANK_WIDTH", 4)),
+        NumWorst(getEnvUInt("TALVOS_BANK_CONFLICTS_TOP", 10))
+  {
+    if (NumBanks == 0)
+      NumBanks = 32;
+    if (BankWidth == 0)
+      BankWidth = 4;
+  }
+
+protected:
+  void analyzeRequest(const Instruction *Inst, bool IsStore,
+                      const std::vector<Access> &Accesses) override
+  {
+    // Find the distinct words accessed in each bank.
+    // Multiple lanes accessing the same word are serviced by a broadcast.
+    std::map<uint64_t, std::set<uint64_t>> Banks;
+    for (const Access &A : Accesses)
+    {
+      if (A.NumBytes == 0)
+        continue;
+      for (uint64_t W = A.Address / BankWidth;
+           W <= (A.Address + A.NumBytes - 1) / BankWidth; W++)
+        Banks[W % NumBanks].insert(W);
+    }
+    if (Banks.empty())
+      return;
+
+    uint64_t Degree = 0;
+    for (auto &B : Banks)
+      Degree = std::max<uint64_t>(Degree, B.second.size());
+
+    Stats &S = InstStats[Inst];
+    S.IsStore = IsStore;
+    S.Requests++;
+    S.Cycles += Degree;
+    S.MaxDegree = std::max(S.MaxDegree, Degree);
+    if (Degree > 1)
+      S.Conflicted++;
+  }
+
+  void dispatchComplete() override
+  {
+    if (InstStats.empty())
+      return;
+
+    Stats Total;
+    std::vector<std::pair<const Instruction *, Stats>> Sorted;
+    for (auto &IS : InstStats)
+    {
+      Total.Requests += IS.second.Requests;
+      Total.Cycles += IS.second.Cycles;
+      Total.MaxDegree = std::max(Total.MaxDegree, IS.second.MaxDegree);
+      Total.Conflicted += IS.second.Conflicted;
+      Sorted.push_back(IS);
+    }
+
+    std::cout << std::endl
+              << "Workgroup memory bank conflicts (" << NumBanks << " banks, "
+              << BankWidth << "-byte words, warp size " << WarpSize
+              << "):" << std::endl;
+    std::cout << "  Total: ";
+    print(Total);
+    std::cout << std::endl;
+
+    // Sort by number of cycles lost to conflicts.
+    std::stable_sort(Sorted.begin(), Sorted.end(), [](auto &A, auto &B) {
+      return (A.second.Cycles - A.second.Requests) >
+             (B.second.Cycles - B.second.Requests);
+    });
+
+    printInstructions("Worst instructions", Sorted, NumWorst,
+                      [this](const Stats &S) {
+                        std::cout << (S.IsStore ? "store: " : "load: ");
+                        print(S);
+                      });
+
+    InstStats.clear();
+  }
+
+private:
+  /// Bank conflict statistics for an instruction.
+  struct Stats
+  {
+    bool IsStore = false;
+    uint64_t Requests = 0;
+    uint64_t Cycles = 0;
+    uint64_t MaxDegree = 0;
+    uint64_t Conflicted = 0;
+  };
+
+  /// Print a summary of \p S.
+  void print(const Stats &S) const
+  {
+    std::cout << S.Requests << " requests, " << S.Cycles << " cycles ("
+              << std::fixed << std::setprecision(2)
+              << ((double)S.Cycles / S.Requests) << " per request, max degree "
+              << S.MaxDegree << "), " << S.Conflicted << " conflicted";
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+  }
+
+  uint64_t NumBanks;  ///< The number of memory banks.
+  uint64_t BankWidth; ///< The width of each bank in bytes.
+  size_t NumWorst;    ///< The number of instructions to report.
+
+  /// Statistics for each instruction in the current dispatch.
+  std::map<const Instruction *, Stats> InstStats;
+};
+
+extern "C"
+{
+  Plugin *talvosCreatePlugin(const Device *Dev)
+  {
+    return new BankConflicts(Dev);
+  }
+
+  void talvosDestroyPlugin(Plugin *P) { delete P; }
+}
@@ -0,0 +1,387 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file cache.cpp
+/// This file defines a plugin that models a two-level cache hierarchy.
+///
+/// Device memory loads and stores made by compute dispatches are passed
+/// through a set-associative L1 cache and an optional L2 cache, each with LRU
+/// replacement and write-allocate stores. Each level is configured with the
+/// following environment variables (shown for L1, with defaults for L1 / L2):
+///   TALVOS_CACHE_L1_SIZE     Size in bytes (16384 / 262144, 0 disables)
+///   TALVOS_CACHE_L1_LINE     Line size in bytes (128 / 128)
+///   TALVOS_CACHE_L1_WAYS     Associativity (4 / 16)
+///   TALVOS_CACHE_L1_SHARED   1 for a single cache, 0 for one per core (0 / 1)
+///   TALVOS_CACHE_L1_LATENCY  Hit latency in cycles (20 / 100)
+///
+/// The size of each enabled level must be a multiple of its line size times
+/// its associativity. An L1 miss fetches the whole L1 line from the L2 lines
+/// that cover it, so the two levels may use different line sizes.
+///
+/// Workgroups are assigned to cores in the same way as the timing model when
+/// one is enabled, and otherwise in round-robin order of their linear index.
+/// When a timing model is enabled, the latency of the level that services each
+/// access is reported to it in place of the device memory latency. The number
+/// of instructions listed can be set with TALVOS_CACHE_TOP (default 10).
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "WarpPlugin.h"
+#include "talvos/Commands.h"
+#include "talvos/Device.h"
+#include "talvos/Instruction.h"
+#include "talvos/Invocation.h"
+#include "talvos/Memory.h"
+#include "talvos/TimingModel.h"
+
+using namespace talvos;
+
+/// A set-associative cache with LRU replacement.
+///
+/// The tags for every set of every instance of the cache are held in a single
+/// array, with the ways of each set ordered from most to least recently used.
+class CacheLevel
+{
+public:
+  /// Create a cache level configured from environment variables starting with
+  /// \p Prefix, with one instance for each of \p NumCores cores unless shared.
+  CacheLevel(const std::string &Prefix, uint64_t NumCores, uint64_t Size,
+             uint64_t Line, uint64_t Ways, bool Shared, uint64_t Latency)
+  {
+    auto Get = [&Prefix](const char *Name, uint64_t Default) {
+      return WarpPlugin::getEnvUInt((Prefix + Name).c_str(), Default);
+    };
+    this->Size = Get("_SIZE", Size);
+    LineSize = std::max<uint64_t>(Get("_LINE", Line), 1);
+    NumWays = std::max<uint64_t>(Get("_WAYS", Ways), 1);
+    this->Shared = Get("_SHARED", Shared) != 0;
+    this->Latency = Get("_LATENCY", Latency);
+
+    if (this->Size % (LineSize * NumWays))
+    {
+      std::cerr << std::endl
+                << "ERROR: " << Prefix
+                << "_SIZE must be a multiple of the line size times the number"
+                << " of ways" << std::endl;
+      abort();
+    }
+    NumSets = this->Size / (LineSize * NumWays);
+    NumInstances = this->Shared ? 1 : NumCores;
+  }
+
+  /// Access the line containing \p Address in the cache instance used by
+  /// \p Core. Returns true if the line was present.
+  bool access(uint64_t Core, uint64_t Address)
+  {
+    uint64_t Line = Address / LineSize;
+    uint64_t Instance = Shared ? 0 : Core % NumInstances;
+    auto Set = Tags.begin() + (Instance * NumSets + Line % NumSets) * NumWays;
+
+    // Tags are stored as line + 1, so that zero marks an invalid way.
+    auto Way = std::find(Set, Set + NumWays, Line + 1);
+    bool Hit = Way != Set + NumWays;
+    if (!Hit)
+      Way = Set + NumWays - 1;
+
+    // Move the line to the most recently used position.
+    std::rotate(Set, Way, Way + 1);
+    *Set = Line + 1;
+    return Hit;
+  }
+
+  /// Returns true if this cache level is enabled.
+  bool isEnabled() const { return Size != 0; }
+
+  /// Invalidate the contents of every instance of the cache.
+  void reset()
+  {
+    if (isEnabled())
+      Tags.assign(NumInstances * NumSets * NumWays, 0);
+  }
+
+  /// Print the configuration of the cache to stdout.
+  void print() const
+  {
+    std::cout << Size << " bytes, " << LineSize << "-byte lines, " << NumWays
+              << "-way, " << (Shared ? "shared" : "per core");
+  }
+
+  uint64_t Size;     ///< Total size of each instance in bytes.
+  uint64_t LineSize; ///< Size of a cache line in bytes.
+  uint64_t NumWays;  ///< Number of ways in each set.
+  bool Shared;       ///< True if a single instance is shared by all cores.
+  uint64_t Latency;  ///< Hit latency in cycles.
+
+private:
+  uint64_t NumSets;           ///< Number of sets in each instance.
+  uint64_t NumInstances;      ///< Number of instances of the cache.
+  std::vector<uint64_t> Tags; ///< Tags for each way of each set.
+};
+
+class Cache : public WarpPlugin
+{
+public:
+  Cache(const Device *Dev)
+      : WarpPlugin(Dev), Dev(Dev),
+        L1("TALVOS_CACHE_L1", Dev->Cores, 16384, 128, 4, false, 20),
+        L2("TALVOS_CACHE_L2", Dev->Cores, 262144, 128, 16, true, 100),
+        NumWorst(getEnvUInt("TALVOS_CACHE_TOP", 10)), NumGroups(0, 0, 0)
+  {
+    Events.reserve(BATCH_SIZE);
+  }
+
+  void commandBegin(const Command *Cmd) override
+  {
+    WarpPlugin::commandBegin(Cmd);
+    if (Cmd->getType() != Command::DISPATCH)
+      return;
+
+    NumGroups = ((const DispatchCommand *)Cmd)->getNumGroups();
+    L1.reset();
+    L2.reset();
+  }
+
+  void memoryLoad(const Memory *Mem, uint64_t Address, uint64_t NumBytes,
+                  const Invocation *Invoc) override
+  {
+    access(Mem, Address, NumBytes, Invoc, false);
+  }
+
+  void memoryStore(const Memory *Mem, uint64_t Address, uint64_t NumBytes,
+                   const uint8_t *Data, const Invocation *Invoc) override
+  {
+    access(Mem, Address, NumBytes, Invoc, true);
+  }
+
+protected:
+  void dispatchComplete() override
+  {
+    processEvents(0);
+    NumGroups = Dim3(0, 0, 0);
+    if (InstStats.empty())
+      return;
+
+    Stats Total;
+    std::vector<std::pair<const Instruction *, Stats>> Sorted;
+    for (auto &IS : InstStats)
+    {
+      Total += IS.second;
+      Sorted.push_back(IS);
+    }
+
+    std::cout << std::endl << "Cache hierarchy (L1: ";
+    L1.print();
+    if (L2.isEnabled())
+    {
+      std::cout << "; L2: ";
+      L2.print();
+    }
+    std::cout << "):" << std::endl;
+    std::cout << "  Total: ";
+    print(Total);
+    std::cout << std::endl;
+
+    std::cout << "  Buffers:" << std::endl;
+    for (auto &BS : BufferStats)
+    {
+      std::cout << "    0x" << std::hex << BS.first << std::dec << ": ";
+      print(BS.second);
+      std::cout << std::endl;
+    }
+
+    // Sort by number of L1 misses.
+    std::stable_sort(Sorted.begin(), Sorted.end(), [](auto &A, auto &B) {
+      return (A.second.Accesses - A.second.L1Hits) >
+             (B.second.Accesses - B.second.L1Hits);
+    });
+
+    printInstructions("Worst instructions", Sorted, NumWorst,
+                      [this](const Stats &S) {
+                        std::cout << (S.IsStore ? "store: " : "load: ");
+                        print(S);
+                      });
+
+    InstStats.clear();
+    BufferStats.clear();
+  }
+
+private:
+  /// The number of events buffered before the cache model is updated.
+  static const size_t BATCH_SIZE = 4096;
+
+  /// A device memory access that has not yet been processed.
+  struct Event
+  {
+    const Instruction *Inst; ///< The instruction that made the access.
+    uint64_t Address;        ///< The address of the first byte accessed.
+    uint64_t NumBytes;       ///< The number of bytes accessed.
+    uint64_t Core;           ///< The core that the access was made from.
+    bool IsStore;            ///< True if the access was a store.
+  };
+
+  /// Cache statistics for an instruction or buffer.
+  struct Stats
+  {
+    bool IsStore = false;  ///< True if the instruction is a store.
+    uint64_t Accesses = 0; ///< Cache lines accessed.
+    uint64_t L1Hits = 0;   ///< Cache lines found in L1.
+    uint64_t L2Hits = 0;   ///< Cache lines found in L2.
+
+    Stats &operator+=(const Stats &S)
+    {
+      Accesses += S.Accesses;
+      L1Hits += S.L1Hits;
+      L2Hits += S.L2Hits;
+      return *this;
+    }
+  };
+
+  /// Record a device memory access made by \p Invoc.
+  void access(const Memory *Mem, uint64_t Address, uint64_t NumBytes,
+              const Invocation *Invoc, bool IsStore)
+  {
+    if (Mem->getScope() != MemoryScope::Device || NumBytes == 0)
+      return;
+
+    LaneInfo Info;
+    if (!getLaneInfo(Invoc, Info))
+      return;
+    const Instruction *Inst = Invoc->getCurrentInstruction();
+    if (!Inst)
+      return;
+
+    // Determine which core the workgroup runs on.
+    TimingModel *Timing = Dev->getTimingModel();
+    uint64_t Core;
+    if (Timing)
+      Core = Timing->getCurrentCore();
+    else
+      Core = (std::get<0>(Info.Group) +
+              (std::get<1>(Info.Group) +
+               std::get<2>(Info.Group) * (uint64_t)NumGroups.Y) *
+                  NumGroups.X) %
+             Dev->Cores;
+
+    Events.push_back({Inst, Address, NumBytes, Core, IsStore});
+
+    // The timing model needs the latency of the access before the instruction
+    // issues, so events cannot be deferred when it is enabled.
+    if (Timing)
+    {
+      uint64_t MissLatency =
+          Timing->getMemoryParams(MemoryScope::Device).Latency;
+      Timing->setAccessLatency(MemoryScope::Device, processEvents(MissLatency));
+    }
+    else if (Events.size() >= BATCH_SIZE)
+    {
+      processEvents(0);
+    }
+  }
+
+  /// Pass all buffered events through the cache model.
+  /// Returns the largest latency of any line accessed by the events, where a
+  /// line that misses every cache level takes \p MissLatency cycles.
+  uint64_t processEvents(uint64_t MissLatency)
+  {
+    uint64_t Latency = 0;
+    for (const Event &E : Events)
+    {
+      Stats &IS = InstStats[E.Inst];
+      Stats &BS = BufferStats[Memory::getBaseAddress(E.Address)];
+      IS.IsStore = E.IsStore;
+
+      // Access each L1 line that the access touches. The access completes when
+      // the slowest of its lines has been serviced.
+      uint64_t End = E.Address + E.NumBytes - 1;
+      for (uint64_t Line = E.Address / L1.LineSize; Line <= End / L1.LineSize;
+           Line++)
+      {
+        uint64_t First = std::max(Line * L1.LineSize, E.Address);
+        uint64_t Last = std::min(Line * L1.LineSize + L1.LineSize - 1, End);
+        IS.Accesses++;
+        BS.Accesses++;
+        if (L1.isEnabled() && L1.access(E.Core, First))
+        {
+          IS.L1Hits++;
+          BS.L1Hits++;
+          Latency = std::max(Latency, L1.Latency);
+        }
+        else if (L2.isEnabled() && accessL2(E.Core, First, Last))
+        {
+          IS.L2Hits++;
+          BS.L2Hits++;
+          Latency = std::max(Latency, L2.Latency);
+        }
+        else
+        {
+          Latency = std::max(Latency, MissLatency);
+        }
+      }
+    }
+    Events.clear();
+    return Latency;
+  }
+
+  /// Access the L2 lines needed to service an L1 miss for the bytes from
+  /// \p First to \p Last, using the L2 line size. An L1 miss fetches the whole
+  /// L1 line. Returns true if every L2 line was present.
+  bool accessL2(uint64_t Core, uint64_t First, uint64_t Last)
+  {
+    if (L1.isEnabled())
+    {
+      First -= First % L1.LineSize;
+      Last = First + L1.LineSize - 1;
+    }
+
+    bool Hit = true;
+    for (uint64_t Line = First / L2.LineSize; Line <= Last / L2.LineSize;
+         Line++)
+      Hit = L2.access(Core, Line * L2.LineSize) && Hit;
+    return Hit;
+  }
+
+  /// Print a summary of \p S.
+  void print(const Stats &S) const
+  {
+    std::cout << S.Accesses << " accesses, L1 hit rate " << std::fixed
+              << std::setprecision(1) << (100.0 * S.L1Hits / S.Accesses)
+              << "%";
+    uint64_t L1Misses = S.Accesses - S.L1Hits;
+    if (L2.isEnabled() && L1Misses)
+      std::cout << ", L2 hit rate " << (100.0 * S.L2Hits / L1Misses) << "%";
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+  }
+
+  const Device *Dev; ///< The device being modeled.
+  CacheLevel L1;     ///< The first level cache.
+  CacheLevel L2;     ///< The second level cache.
+  size_t NumWorst;   ///< The number of instructions to report.
+
+  /// The number of workgroups in the current dispatch.
+  Dim3 NumGroups;
+
+  /// Accesses that have not yet been passed through the cache model.
+  std::vector<Event> Events;
+
+  /// Statistics for each instruction in the current dispatch.
+  std::map<const Instruction *, Stats> InstStats;
+
+  /// Statistics for each buffer in the current dispatch, by base address.
+  std::map<uint64_t, Stats> BufferStats;
+};
+
+extern "C"
+{
+  Plugin *talvosCreatePlugin(const Device *Dev) { return new Cache(Dev); }
+
+  void talvosDestroyPlugin(Plugin *P) { delete P; }
+}
@@ -0,0 +1,154 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file coalescing.cpp
+/// This file defines a plugin that analyzes device memory coalescing.
+///
+/// Device memory accesses made by the lanes of a modeled warp are combined into
+/// a request, and the number of cache line transactions needed to service that
+/// request is compared with the minimum number possible. The line size can be
+/// set with TALVOS_COALESCING_LINE_SIZE (default 128 bytes), and the number of
+/// instructions listed with TALVOS_COALESCING_TOP (default 10).
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "WarpAccessPlugin.h"
+#include "talvos/Device.h"
+#include "talvos/Instruction.h"
+
+using namespace talvos;
+
+class Coalescing : public WarpAccessPlugin
+{
+public:
+  Coalescing(const Device *Dev)
+      : WarpAccessPlugin(Dev, MemoryScope::Device),
+        LineSize(getEnvUInt("TALVOS_COALESCING_LINE_SIZE", 128)),
+        NumWorst(getEnvUInt("TALVOS_COALESCING_TOP", 10))
+  {
+    if (LineSize == 0)
+      LineSize = 128;
+  }
+
+protected:
+  void analyzeRequest(const Instruction *Inst, bool IsStore,
+                      const std::vector<Access> &Accesses) override
+  {
+    // Gather the set of lines and the byte ranges touched by the request.
+    std::set<uint64_t> Lines;
+    std::vector<std::pair<uint64_t, uint64_t>> Ranges;
+    for (const Access &A : Accesses)
+    {
+      if (A.NumBytes == 0)
+        continue;
+      for (uint64_t L = A.Address / LineSize;
+           L <= (A.Address + A.NumBytes - 1) / LineSize; L++)
+        Lines.insert(L);
+      Ranges.push_back({A.Address, A.Address + A.NumBytes});
+    }
+    if (Ranges.empty())
+      return;
+
+    // Count unique bytes, so that broadcasts are not counted more than once.
+    std::sort(Ranges.begin(), Ranges.end());
+    uint64_t UniqueBytes = 0;
+    uint64_t End = 0;
+    for (auto &R : Ranges)
+    {
+      uint64_t Start = std::max(R.first, End);
+      if (R.second > Start)
+        UniqueBytes += R.second - Start;
+      End = std::max(End, R.second);
+    }
+
+    Stats &S = InstStats[Inst];
+    S.IsStore = IsStore;
+    S.Requests++;
+    S.Transactions += Lines.size();
+    S.IdealTransactions += (UniqueBytes + LineSize - 1) / LineSize;
+    S.UsefulBytes += UniqueBytes;
+  }
+
+  void dispatchComplete() override
+  {
+    if (InstStats.empty())
+      return;
+
+    Stats Total;
+    std::vector<std::pair<const Instruction *, Stats>> Sorted;
+    for (auto &IS : InstStats)
+    {
+      Total.Requests += IS.second.Requests;
+      Total.Transactions += IS.second.Transactions;
+      Total.IdealTransactions += IS.second.IdealTransactions;
+      Total.UsefulBytes += IS.second.UsefulBytes;
+      Sorted.push_back(IS);
+    }
+
+    std::cout << std::endl
+              << "Memory coalescing (warp size " << WarpSize << ", "
+              << LineSize << "-byte lines):" << std::endl;
+    std::cout << "  Total: ";
+    print(Total);
+    std::cout << std::endl;
+
+    // Sort by number of excess transactions.
+    std::stable_sort(Sorted.begin(), Sorted.end(), [](auto &A, auto &B) {
+      return (A.second.Transactions - A.second.IdealTransactions) >
+             (B.second.Transactions - B.second.IdealTransactions);
+    });
+
+    printInstructions("Worst instructions", Sorted, NumWorst,
+                      [this](const Stats &S) {
+                        std::cout << (S.IsStore ? "store: " : "load: ");
+                        print(S);
+                      });
+
+    InstStats.clear();
+  }
+
+private:
+  /// Coalescing statistics for an instruction.
+  struct Stats
+  {
+    bool IsStore = false;
+    uint64_t Requests = 0;
+    uint64_t Transactions = 0;
+    uint64_t IdealTransactions = 0;
+    uint64_t UsefulBytes = 0;
+  };
+
+  /// Print a summary of \p S.
+  void print(const Stats &S) const
+  {
+    double PerRequest = (double)S.Transactions / S.Requests;
+    double Efficiency = 100.0 * S.UsefulBytes / (S.Transactions * LineSize);
+    std::cout << S.Requests << " requests, " << S.Transactions
+              << " transactions (" << std::fixed << std::setprecision(2)
+              << PerRequest << " per request, ideal " << S.IdealTransactions
+              << "), " << std::setprecision(1) << Efficiency
+              << "% efficiency";
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+  }
+
+  uint64_t LineSize; ///< The size of a cache line in bytes.
+  size_t NumWorst;   ///< The number of instructions to report.
+
+  /// Statistics for each instruction in the current dispatch.
+  std::map<const Instruction *, Stats> InstStats;
+};
+
+extern "C"
+{
+  Plugin *talvosCreatePlugin(const Device *Dev) { return new Coalescing(Dev); }
+
+  void talvosDestroyPlugin(Plugin *P) { delete P; }
+}
@@ -0,0 +1,289 @@
+// Copyright (c) 2018 the Talvos developers. All rights reserved.
+//
+// This file is distributed under a three-clause BSD license. For full license
+// terms please see the LICENSE file distributed with this source code.
+
+/// \file divergence.cpp
+/// This file defines a plugin that analyzes SIMT branch divergence.
+///
+/// The k-th execution of a conditional branch by each lane of a modeled warp
+/// forms one warp-level branch, which is divergent if the lanes did not all
+/// branch to the same block. For branches that are preceded by a merge
+/// instruction, the number of instructions each lane executes before reaching
+/// the merge block is also recorded. A SIMT machine executes each distinct path
+/// through the region in turn, so the lane utilization of the region is the
+/// number of instructions executed by the lanes divided by the number of lane
+/// slots used to execute every path. The number of branches listed can be set
+/// with TALVOS_DIVERGENCE_TOP (default 10).
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include <spirv/unified1/spirv.h>
+
+#include "WarpPlugin.h"
+#include "talvos/Device.h"
+#include "talvos/Instruction.h"
+#include "talvos/Invocation.h"
+
+using namespace talvos;
+
+/// Returns the ID of the block containing \p Inst.
+static uint32_t getBlockId(const Instruction *Inst)
+{
+  while (Inst->getOpcode() != SpvOpLabel)
+    Inst = Inst->previous();
+  return Inst->getOperand(0);
+}
+
+/// Returns the merge block for the branch \p Inst, or 0 if it has none.
+static uint32_t getMergeBlock(const Instruction *Inst)
+{
+  const Instruction *Merge = Inst->previous();
+  if (Merge && (Merge->getOpcode() == SpvOpSelectionMerge ||
+                Merge->getOpcode() == SpvOpLoopMerge))
+    return Merge->getOperand(0);
+  return 0;
+}
+
+class Divergence : public WarpPlugin
+{
+public:
+  Divergence(const Device *Dev)
+      : WarpPlugin(Dev), NumWorst(getEnvUInt("TALVOS_DIVERGENCE_TOP", 10))
+  {}
+
+  void commandComplete(const Command *Cmd) override
+  {
+    WarpPlugin::commandComplete(Cmd);
+    Invocations.clear();
+    Branches.clear();
+    Regions.clear();
+  }
+
+  void instructionExecuted(const Invocation *Invoc,
+                           const Instruction *Inst) override
+  {
+    LaneInfo Info;
+    if (!getLaneInfo(Invoc, Info))
+      return;
+
+    InvocationState &State = Invocations[Invoc];
+    for (OpenRegion &R : State.Regions)
+      R.Count++;
+
+    uint16_t Opcode = Inst->getOpcode();
+    if (Opcode != SpvOpBranch && Opcode != SpvOpBranchConditional &&
+        Opcode != SpvOpSwitch)
+      return;
+    if (!Invoc->getCurrentInstruction())
+      return;
+    uint32_t Target = getBlockId(Invoc->getCurrentInstruction());
+
+    if (Opcode != SpvOpBranch)
+    {
+      // Record the target taken by this lane.
+      uint64_t Instance = State.Executions[Inst]++;
+      Branches[Info.Group][{Inst, Info.Warp, Instance}][Target]++;
+
+      // Open a region unless this lane is already inside one for this branch
+      // (i.e. the branch is a loop header that has been reached again).
+      uint32_t Merge = getMergeBlock(Inst);
+      if (Merge &&
+          std::none_of(State.Regions.begin(), State.Regions.end(),
+                       [Inst](const OpenRegion &R) { return R.Branch == Inst; }))
+      {
+        State.Regions.push_back(
+            {Inst, Merge, State.Entries[Inst]++, Target, 0});
+      }
+    }
+
+    // Close any regions whose merge block has been reached.
+    while (!State.Regions.empty() && State.Regions.back().Merge == Target)
+    {
+      closeRegion(Info, State.Regions.back());
+      State.Regions.pop_back();
+    }
+  }
+
+  void invocationComplete(const Invocation *Invoc) override
+  {
+    auto Itr = Invocations.find(Invoc);
+    if (Itr == Invocations.end())
+      return;
+
+    // Close regions that were left by returning or terminating.
+    LaneInfo Info;
+    if (getLaneInfo(Invoc, Info))
+    {
+      for (OpenRegion &R : Itr->second.Regions)
+        closeRegion(Info, R);
+    }
+    Invocations.erase(Itr);
+  }
+
+  void workgroupComplete(const Workgroup *Group) override
+  {
+    GroupKey Key = getGroupKey(Group);
+
+    auto BItr = Branches.find(Key);
+    if (BItr != Branches.end())
+    {
+      for (auto &B : BItr->second)
+      {
+        Stats &S = InstStats[std::get<0>(B.first)];
+        S.Branches++;
+        if (B.second.size() > 1)
+          S.Divergent++;
+      }
+      Branches.erase(BItr);
+    }
+
+    auto RItr = Regions.find(Key);
+    if (RItr != Regions.end())
+    {
+      for (auto &R : RItr->second)
+      {
+        // Each distinct path is executed for as long as its slowest lane.
+        std::map<uint32_t, uint64_t> PathLength;
+        uint64_t Useful = 0;
+        for (auto &Lane : R.second)
+        {
+          PathLength[Lane.first] =
+              std::max(PathLength[Lane.first], Lane.second);
+          Useful += Lane.second;
+        }
+        uint64_t Cycles = 0;
+        for (auto &P : PathLength)
+          Cycles += P.second;
+
+        Stats &S = InstStats[std::get<0>(R.first)];
+        S.UsefulSlots += Useful;
+        S.TotalSlots += Cycles * R.second.size();
+      }
+      Regions.erase(RItr);
+    }
+  }
+
+protected:
+  void dispatchComplete() override
+  {
+    if (InstStats.empty())
+      return;
+
+    Stats Total;
+    std::vector<std::pair<const Instruction *, Stats>> Sorted;
+    for (auto &IS : InstStats)
+    {
+      Total.Branches += IS.second.Branches;
+      Total.Divergent += IS.second.Divergent;
+      Total.UsefulSlots += IS.second.UsefulSlots;
+      Total.TotalSlots += IS.second.TotalSlots;
+      Sorted.push_back(IS);
+    }
+
+    std::cout << std::endl
+              << "SIMT divergence (warp size " << WarpSize << "):" << std::endl;
+    std::cout << "  Total: ";
+    print(Total);
+    std::cout << std::endl;
+
+    // Sort by number of divergent branches, then by lane slots wasted.
+    std::stable_sort(Sorted.begin(), Sorted.end(), [](auto &A, auto &B) {
+      if (A.second.Divergent != B.second.Divergent)
+        return A.second.Divergent > B.second.Divergent;
+      return (A.second.TotalSlots - A.second.UsefulSlots) >
+             (B.second.TotalSlots - B.second.UsefulSlots);
+    });
+
+    printInstructions("Most divergent branches", Sorted, NumWorst,
+                      [this](const Stats &S) { print(S); });
+
+    InstStats.clear();
+  }
+
+private:
+  /// A structured region that a lane is currently executing.
+  struct OpenRegion
+  {
+    const Instruction *Branch; ///< The branch that opened the region.
+    uint32_t Merge;            ///< The merge block that ends the region.
+    uint64_t Instance;         ///< The number of earlier entries by this lane.
+    uint32_t Target;           ///< The block the lane branched to on entry.
+    uint64_t Count;            ///< Instructions executed inside the region.
+  };
+
+  /// Per-invocation tracking state.
+  struct InvocationState
+  {
+    /// Number of executions of each branch.
+    std::map<const Instruction *, uint64_t> Executions;
+
+    /// Number of entries to the region of each branch.
+    std::map<const Instruction *, uint64_t> Entries;
+
+    /// Stack of regions currently being executed.
+    std::vector<OpenRegion> Regions;
+  };
+
+  /// Divergence statistics for a branch instruction.
+  struct Stats
+  {
+    uint64_t Branches = 0;    ///< Warp-level executions.
+    uint64_t Divergent = 0;   ///< Warp-level executions that diverged.
+    uint64_t UsefulSlots = 0; ///< Lane instructions executed in regions.
+    uint64_t TotalSlots = 0;  ///< Lane slots used to execute regions.
+  };
+
+  /// Identifies a warp-level instance of a branch within a workgroup.
+  typedef std::tuple<const Instruction *, uint32_t, uint64_t> InstanceKey;
+
+  /// Record the completion of region \p R by the lane described by \p Info.
+  void closeRegion(const LaneInfo &Info, const OpenRegion &R)
+  {
+    Regions[Info.Group][{R.Branch, Info.Warp, R.Instance}].push_back(
+        {R.Target, R.Count});
+  }
+
+  /// Print a summary of \p S.
+  void print(const Stats &S) const
+  {
+    std::cout << S.Branches << " branches, " << S.Divergent << " divergent ("
+              << std::fixed << std::setprecision(1)
+              << (100.0 * S.Divergent / S.Branches) << "%)";
+    if (S.TotalSlots)
+      std::cout << ", " << (100.0 * S.UsefulSlots / S.TotalSlots)
+                << "% lane utilization";
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout << std::setprecision(6);
+  }
+
+  size_t NumWorst; ///< The number of branches to report.
+
+  /// Tracking state for each running invocation.
+  std::map<const Invocation *, InvocationState> Invocations;
+
+  /// Targets taken by the lanes of each warp-level branch, for each running
+  /// workgroup.
+  std::map<GroupKey, std::map<InstanceKey, std::map<uint32_t, uint32_t>>>
+      Branches;
+
+  /// Entry target and instruction count for the lanes of each warp-level
+  /// region, for each running workgroup.
+  std::map<GroupKey,
+           std::map<InstanceKey, std::vector<std::pair<uint32_t, uint64_t>>>>
+      Regions;
+
+  /// Statistics for each branch instruction in the current dispatch.
+  std::map<const Instruction *, Stats> InstStats;
+};
+
+extern "C"
+{
+  Plugin *talvosCreatePlugin(const Device *Dev) { return new Divergence(Dev); }
+
+  void talvosDestroyPlugin(Plugin *P) { delete P; }
+}
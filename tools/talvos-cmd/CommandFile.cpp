@@ -3,6 +3,8 @@
 // This file is distributed under a three-clause BSD license. For full license
 // terms please see the LICENSE file distributed with this source code.
 
+#include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <cstdlib>
 #include <cstring>
@@ -10,20 +12,25 @@
 #include <iostream>
 #include <memory>
 #include <stdexcept>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "CommandFile.h"
 #include "talvos/Commands.h"
 #include "talvos/ComputePipeline.h"
+#include "talvos/CostEstimator.h"
 #include "talvos/Device.h"
 #include "talvos/Dim3.h"
 #include "talvos/EntryPoint.h"
 #include "talvos/Memory.h"
 #include "talvos/Module.h"
 #include "talvos/Object.h"
+#include "talvos/PerformanceCounters.h"
 #include "talvos/PipelineContext.h"
 #include "talvos/PipelineExecutor.h"
+#include "talvos/Roofline.h"
+#include "talvos/TimingModel.h"
 #include "talvos/Type.h"
 
 using namespace std;
@@ -213,6 +220,41 @@ void CommandFile::parseBuffer()
   }
 }
 
+void CommandFile::parseCost()
+{
+  if (!Module)
+    throw "COST reached with no prior MODULE command";
+  if (!Entry && !strlen(Params.EntryName))
+    throw "COST reached with no prior ENTRY command";
+  else if (strlen(Params.EntryName))
+    if (!(Entry =
+              Module->getEntryPoint(Params.EntryName, EXEC_MODEL_GLCOMPUTE)) &&
+        !(Entry = Module->getEntryPoint(Params.EntryName, EXEC_MODEL_KERNEL)))
+      throw "Bad EntryPoint!";
+
+  talvos::Dim3 GroupCount;
+  GroupCount.X = get<uint32_t>("group count X");
+  GroupCount.Y = get<uint32_t>("group count Y");
+  GroupCount.Z = get<uint32_t>("group count Z");
+
+  std::shared_ptr<const talvos::PipelineStage> Stage =
+      Device->getPipelineStageCache().get(*Device, Module, Entry, SpecConstMap);
+
+  // Use the device timing model if there is one, otherwise the defaults.
+  std::unique_ptr<talvos::TimingModel> DefaultModel;
+  const talvos::TimingModel *Model = Device->getTimingModel();
+  if (!Model)
+  {
+    DefaultModel.reset(new talvos::TimingModel(Device->Cores, Device->Lanes));
+    Model = DefaultModel.get();
+  }
+
+  talvos::Dim3 GroupSize = Stage->getGroupSize();
+  uint64_t NumInvocations = (uint64_t)GroupSize.X * GroupSize.Y * GroupSize.Z *
+                            GroupCount.X * GroupCount.Y * GroupCount.Z;
+  talvos::CostEstimator(*Stage, *Model).print(std::cout, NumInvocations);
+}
+
 void CommandFile::parseDescriptorSet()
 {
   uint32_t Set = get<uint32_t>("descriptor set");
@@ -243,8 +285,8 @@ void CommandFile::parseDispatch(Mode mode)
   GroupCount.Y = get<uint32_t>("group count Y");
   GroupCount.Z = get<uint32_t>("group count Z");
 
-  talvos::PipelineStage *Stage =
-      new talvos::PipelineStage(*Device, Module, Entry, SpecConstMap);
+  std::shared_ptr<const talvos::PipelineStage> Stage =
+      Device->getPipelineStageCache().get(*Device, Module, Entry, SpecConstMap);
 
   CurrentPipeline.emplace(Stage);
   PC.clear();
@@ -280,8 +322,8 @@ void CommandFile::parseExec(Mode mode)
       throw "Bad EntryPoint!";
 
   talvos::Dim3 GroupCount = Module->getGlobalSize(Entry->getId());
-  talvos::PipelineStage *Stage =
-      new talvos::PipelineStage(*Device, Module, Entry, SpecConstMap);
+  std::shared_ptr<const talvos::PipelineStage> Stage =
+      Device->getPipelineStageCache().get(*Device, Module, Entry, SpecConstMap);
 
   CurrentPipeline.emplace(Stage);
   PC.clear();
@@ -387,11 +429,45 @@ void CommandFile::parseModule()
 {
   // Load SPIR-V module.
   string SPVFileName = get<string>("module filename");
-  Module = talvos::Module::load(SPVFileName);
+  auto Itr = Preloaded.find(SPVFileName);
+  if (Itr != Preloaded.end())
+    Module = Itr->second;
+  else
+    Module = talvos::Module::load(SPVFileName, ModuleOptions);
   if (!Module)
     throw "failed to load SPIR-V module";
 }
 
+void CommandFile::parsePreload()
+{
+  // Load every listed module in parallel.
+  std::vector<string> FileNames;
+  while (true)
+  {
+    string FileName = get<string>("module filename");
+    if (FileName == "ENDPRELOAD")
+      break;
+    FileNames.push_back(FileName);
+  }
+  std::vector<std::shared_ptr<talvos::Module>> Modules =
+      talvos::Module::loadAll(FileNames, ModuleOptions);
+  for (size_t i = 0; i < FileNames.size(); i++)
+  {
+    if (!Modules[i])
+      throw "failed to load SPIR-V module";
+    Preloaded[FileNames[i]] = Modules[i];
+  }
+}
+
+void CommandFile::parseRoofline()
+{
+  talvos::Roofline *RooflineModel = Device->getRoofline();
+  if (!RooflineModel)
+    throw "ROOFLINE requires the roofline model (set TALVOS_ROOFLINE=1)";
+  RooflineModel->printJSON(std::cout);
+  RooflineModel->clear();
+}
+
 void CommandFile::parseSpecialize()
 {
   uint32_t SpecId = get<uint32_t>("spec constant ID");
@@ -419,6 +495,233 @@ void CommandFile::parseSpecialize()
     throw NotRecognizedException();
 }
 
+void CommandFile::parseStats()
+{
+  std::cout << std::endl << "Device statistics:" << std::endl;
+  Device->getCounters().print(std::cout);
+}
+
+void CommandFile::parseSweep()
+{
+  if (!Module)
+    throw "SWEEP reached with no prior MODULE command";
+  if (!Entry && !strlen(Params.EntryName))
+    throw "SWEEP reached with no prior ENTRY command";
+  else if (strlen(Params.EntryName))
+    if (!(Entry =
+              Module->getEntryPoint(Params.EntryName, EXEC_MODEL_GLCOMPUTE)) &&
+        !(Entry = Module->getEntryPoint(Params.EntryName, EXEC_MODEL_KERNEL)))
+      throw "Bad EntryPoint!";
+
+  talvos::Dim3 GroupCount;
+  GroupCount.X = get<uint32_t>("group count X");
+  GroupCount.Y = get<uint32_t>("group count Y");
+  GroupCount.Z = get<uint32_t>("group count Z");
+
+  // Parse the specialization constant ranges and output checks.
+  std::vector<SweepRange> Ranges;
+  std::vector<std::pair<string, string>> Checks;
+  uint64_t NumVariants = 1;
+  while (true)
+  {
+    string Token = get<string>("sweep parameter");
+    if (Token == "ENDSWEEP")
+      break;
+    else if (Token == "RANGE")
+    {
+      SweepRange Range;
+      Range.SpecId = get<uint32_t>("spec constant ID");
+      string RangeType = get<string>("range type");
+      if (RangeType == "INT16")
+        sweepRange<int16_t>(Range);
+      else if (RangeType == "UINT16")
+        sweepRange<uint16_t>(Range);
+      else if (RangeType == "INT32")
+        sweepRange<int32_t>(Range);
+      else if (RangeType == "UINT32")
+        sweepRange<uint32_t>(Range);
+      else if (RangeType == "INT64")
+        sweepRange<int64_t>(Range);
+      else if (RangeType == "UINT64")
+        sweepRange<uint64_t>(Range);
+      else
+        throw NotRecognizedException();
+      NumVariants *= Range.Values.size();
+      Ranges.push_back(std::move(Range));
+    }
+    else if (Token == "VERIFY")
+    {
+      string Output = get<string>("output buffer name");
+      string Reference = get<string>("reference buffer name");
+      if (!Buffers.count(Output) || !Buffers.count(Reference))
+        throw "invalid resource identifier";
+      if (Buffers.at(Output).second != Buffers.at(Reference).second)
+        throw "output and reference buffers have different sizes";
+      Checks.push_back({Output, Reference});
+    }
+    else
+      throw NotRecognizedException();
+  }
+
+  // Take a copy of every buffer, so that each variant starts from the current
+  // contents of memory.
+  std::map<string, std::vector<uint8_t>> Contents;
+  for (auto &B : Buffers)
+  {
+    std::vector<uint8_t> &Data = Contents[B.first];
+    Data.resize(B.second.second);
+    Device->getGlobalMemory().load(Data.data(), B.second.first, Data.size());
+  }
+
+  struct SweepResult
+  {
+    uint64_t Instructions;
+    uint64_t Cycles;
+    size_t Errors;
+    std::vector<string> Mismatches;
+
+    /// Returns true if the variant ran without errors and passed verification.
+    bool passed() const { return !Errors && Mismatches.empty(); }
+  };
+  std::vector<SweepResult> Results(NumVariants);
+
+  // Run a single variant on a new device.
+  auto RunVariant = [&](uint64_t Variant) {
+    talvos::Device Dev(Device->Cores, Device->Lanes);
+
+    // Create the buffers and point the descriptors at them.
+    std::map<uint64_t, uint64_t> Addresses;
+    std::map<string, uint64_t> Allocations;
+    for (auto &B : Buffers)
+    {
+      uint64_t Address = Dev.getGlobalMemory().allocate(B.second.second);
+      Dev.getGlobalMemory().store(Address, B.second.second,
+                                  Contents.at(B.first).data());
+      Addresses[B.second.first] = Address;
+      Allocations[B.first] = Address;
+    }
+    talvos::DescriptorSetMap Sets = DescriptorSets;
+    for (auto &Set : Sets)
+      for (auto &Binding : Set.second)
+        Binding.second.Address = Addresses[Binding.second.Address];
+
+    // Select the value of each swept constant, with the last range varying
+    // fastest.
+    talvos::SpecConstantMap SpecConsts = SpecConstMap;
+    for (size_t r = Ranges.size(), Index = Variant; r-- > 0;)
+    {
+      SpecConsts[Ranges[r].SpecId] =
+          Ranges[r].Values[Index % Ranges[r].Values.size()];
+      Index /= Ranges[r].Values.size();
+    }
+
+    talvos::ComputePipeline Pipeline(
+        Dev.getPipelineStageCache().get(Dev, Module, Entry, SpecConsts));
+    talvos::PipelineContext Context;
+    Context.bindComputePipeline(&Pipeline);
+    Context.bindComputeDescriptors(Sets);
+    talvos::DispatchCommand(Context, {0, 0, 0}, GroupCount).run(Dev);
+
+    SweepResult &Result = Results[Variant];
+    Result.Instructions = 0;
+    for (unsigned C = talvos::PerformanceCounters::INSTRUCTIONS_ARITHMETIC;
+         C <= talvos::PerformanceCounters::INSTRUCTIONS_OTHER; C++)
+      Result.Instructions +=
+          Dev.getCounters().get((talvos::PerformanceCounters::Counter)C);
+    Result.Cycles =
+        Dev.getCounters().get(talvos::PerformanceCounters::MODELED_CYCLES);
+    Result.Errors = Dev.getNumErrors();
+
+    // Compare outputs with their reference buffers.
+    for (auto &Check : Checks)
+    {
+      const std::vector<uint8_t> &Reference = Contents.at(Check.second);
+      std::vector<uint8_t> Output(Reference.size());
+      Dev.getGlobalMemory().load(Output.data(), Allocations.at(Check.first),
+                                 Output.size());
+      if (Output != Reference)
+        Result.Mismatches.push_back(Check.first);
+    }
+  };
+
+  // Run the variants in parallel, with each thread taking the next variant
+  // that has not been started. The variants are run one at a time in
+  // interactive mode or when a plugin is not thread-safe, as each variant
+  // creates its own device and therefore its own debugger and plugins.
+  std::atomic<uint64_t> NextVariant(0);
+  auto Worker = [&]() {
+    for (uint64_t V; (V = NextVariant++) < NumVariants;)
+      RunVariant(V);
+  };
+  uint64_t NumThreads = 1;
+#ifndef __EMSCRIPTEN__
+  if (!Device->getPipelineExecutor().isInteractive() &&
+      Device->isThreadSafe())
+  {
+    NumThreads = std::max(1u, std::thread::hardware_concurrency());
+    NumThreads = std::min(NumThreads, NumVariants);
+  }
+#endif
+  std::vector<std::thread> Threads;
+  for (uint64_t i = 1; i < NumThreads; i++)
+    Threads.push_back(std::thread(Worker));
+  Worker();
+  for (auto &T : Threads)
+    T.join();
+
+  // Rank the variants that ran without errors and passed verification by
+  // modeled cycles if the timing model is enabled, or instructions executed
+  // otherwise.
+  bool UseCycles = std::any_of(Results.begin(), Results.end(),
+                               [](const SweepResult &R) { return R.Cycles; });
+  std::vector<uint64_t> Ranking(NumVariants);
+  for (uint64_t V = 0; V < NumVariants; V++)
+    Ranking[V] = V;
+  std::stable_sort(Ranking.begin(), Ranking.end(), [&](uint64_t A, uint64_t B) {
+    const SweepResult &RA = Results[A];
+    const SweepResult &RB = Results[B];
+    if (RA.passed() != RB.passed())
+      return RA.passed();
+    return UseCycles ? RA.Cycles < RB.Cycles
+                     : RA.Instructions < RB.Instructions;
+  });
+
+  std::cout << std::endl
+            << "Sweep of " << NumVariants << " variants, ranked by "
+            << (UseCycles ? "modeled cycles" : "instructions executed") << ":"
+            << std::endl;
+  for (uint64_t i = 0; i < NumVariants; i++)
+  {
+    uint64_t V = Ranking[i];
+    const SweepResult &Result = Results[V];
+
+    std::cout << "  " << (i + 1) << ".";
+    std::vector<string> Labels(Ranges.size());
+    for (size_t r = Ranges.size(), Index = V; r-- > 0;)
+    {
+      Labels[r] = Ranges[r].Labels[Index % Ranges[r].Values.size()];
+      Index /= Ranges[r].Values.size();
+    }
+    for (size_t r = 0; r < Ranges.size(); r++)
+      std::cout << " " << Ranges[r].SpecId << "=" << Labels[r];
+    std::cout << ":";
+    if (UseCycles)
+      std::cout << " " << Result.Cycles << " cycles,";
+    std::cout << " " << Result.Instructions << " instructions";
+    if (Result.Errors)
+      std::cout << ", " << Result.Errors << " error"
+                << (Result.Errors > 1 ? "s" : "");
+    if (!Checks.empty())
+    {
+      if (Result.Mismatches.empty())
+        std::cout << ", verified";
+      for (const string &Name : Result.Mismatches)
+        std::cout << ", MISMATCH in '" << Name << "'";
+    }
+    std::cout << std::endl;
+  }
+}
+
 template <typename T> void CommandFile::dump(unsigned VecWidth)
 {
   string Name = get<string>("allocation name");
@@ -504,6 +807,32 @@ template <typename T> void CommandFile::specialize(uint32_t SpecId)
   SpecConstMap[SpecId] = talvos::Object(Ty, get<T>("specialization value"));
 }
 
+template <typename T> void CommandFile::sweepRange(SweepRange &Range)
+{
+  uint32_t ResultId = Module->getSpecConstant(Range.SpecId);
+  if (!ResultId)
+    throw "invalid specialization constant ID";
+
+  const talvos::Type *Ty = Module->getObject(ResultId).getType();
+  if (Ty->getSize() != sizeof(T))
+    throw "wrong type size for specialization constant";
+
+  T Start = get<T>("range start");
+  T End = get<T>("range end");
+  T Step = get<T>("range step");
+  if (Step <= 0 || End < Start)
+    throw "invalid range";
+
+  // The range includes its end value.
+  for (T Value = Start;; Value += Step)
+  {
+    Range.Values.push_back(talvos::Object(Ty, Value));
+    Range.Labels.push_back(std::to_string(Value));
+    if (End - Value < Step)
+      break;
+  }
+}
+
 bool CommandFile::run(Mode mode)
 {
   try
@@ -514,6 +843,8 @@ bool CommandFile::run(Mode mode)
       string Command = get<string>("command");
       if (Command == "BUFFER")
         parseBuffer();
+      else if (Command == "COST")
+        parseCost();
       else if (Command == "DESCRIPTOR_SET")
         parseDescriptorSet();
       else if (Command == "DISPATCH")
@@ -538,8 +869,16 @@ bool CommandFile::run(Mode mode)
         parseLoop();
       else if (Command == "MODULE")
         parseModule();
+      else if (Command == "PRELOAD")
+        parsePreload();
+      else if (Command == "ROOFLINE")
+        parseRoofline();
       else if (Command == "SPECIALIZE")
         parseSpecialize();
+      else if (Command == "STATS")
+        parseStats();
+      else if (Command == "SWEEP")
+        parseSweep();
       else
       {
         std::cerr << "line " << CurrentLine << ": ";
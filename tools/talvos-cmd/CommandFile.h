@@ -16,13 +16,14 @@
 #include "talvos/Commands.h"
 #include "talvos/ComputePipeline.h"
 #include "talvos/Device.h"
+#include "talvos/Module.h"
+#include "talvos/Object.h"
 #include "talvos/PipelineContext.h"
 #include "talvos/PipelineStage.h"
 
 namespace talvos
 {
 class EntryPoint;
-class Module;
 extern "C" struct Params
 {
   // used to populate Entry at dispatch time, if set
@@ -51,6 +52,7 @@ private:
   template <typename T> T get(const char *ParseAction);
 
   void parseBuffer();
+  void parseCost();
   void parseDescriptorSet();
   void parseDispatch(Mode);
   void parseExec(Mode);
@@ -59,7 +61,11 @@ private:
   void parseEntry();
   void parseLoop();
   void parseModule();
+  void parsePreload();
+  void parseRoofline();
   void parseSpecialize();
+  void parseStats();
+  void parseSweep();
 
   template <typename T> void dump(unsigned VecWidth);
   template <typename T> void data(uint64_t Address, uint64_t NumBytes);
@@ -67,12 +73,22 @@ private:
   template <typename T> void series(uint64_t Address, uint64_t NumBytes);
   template <typename T> void specialize(uint32_t SpecId);
 
+  /// A range of values for a specialization constant in a SWEEP command.
+  struct SweepRange
+  {
+    uint32_t SpecId;
+    std::vector<talvos::Object> Values;
+    std::vector<std::string> Labels;
+  };
+  template <typename T> void sweepRange(SweepRange &Range);
+
   std::istream &Stream;
   bool Interactive = false;
   std::map<std::string, std::pair<uint64_t, uint64_t>> Buffers;
   talvos::SpecConstantMap SpecConstMap;
   talvos::DescriptorSetMap DescriptorSets;
   std::vector<std::pair<size_t, std::streampos>> Loops;
+  std::map<std::string, std::shared_ptr<talvos::Module>> Preloaded;
 
   size_t CurrentLine = 1;
   std::string CurrentParseAction;
@@ -80,6 +96,8 @@ private:
 public:
   const talvos::EntryPoint *Entry = nullptr;
   std::shared_ptr<talvos::Module> Module;
+  talvos::Module::LoadOptions ModuleOptions =
+      talvos::Module::LoadOptions::getDefault();
   std::optional<talvos::DispatchCommand> CurrentDispatch;
   std::optional<talvos::ComputePipeline> CurrentPipeline;
   talvos::PipelineContext PC;
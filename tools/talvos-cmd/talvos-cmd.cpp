@@ -7,6 +7,7 @@
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <optional>
 
 #include "CommandFile.h"
 #include "version.h"
@@ -14,6 +15,7 @@
 using namespace std;
 
 static const char *FileName = nullptr;
+static std::optional<talvos::Module::LoadOptions> ModuleOptions;
 
 static bool parseArguments(int argc, char *argv[]);
 static void printUsage();
@@ -40,6 +42,8 @@ int main(int argc, char *argv[])
   {
     CF = std::make_unique<CommandFile>(std::cin);
   }
+  if (ModuleOptions)
+    CF->ModuleOptions = *ModuleOptions;
 
   // Run commands.
   if (!CF->run())
@@ -68,6 +72,17 @@ static bool parseArguments(int argc, char *argv[])
       cout << endl;
       exit(0);
     }
+    else if (!strcmp(argv[i], "--optimize") ||
+             !strncmp(argv[i], "--optimize=", 11))
+    {
+      ModuleOptions.emplace();
+      const char *Passes = argv[i][10] ? argv[i] + 11 : "1";
+      if (!ModuleOptions->setOptimizerPasses(Passes))
+      {
+        cerr << "Invalid optimizer pass list '" << Passes << "'" << endl;
+        return false;
+      }
+    }
     else if (argv[i][0] == '-')
     {
       cerr << "Unrecognised option '" << argv[i] << "'" << endl;
@@ -99,6 +114,9 @@ static void printUsage()
   cout << "  -h --help                    "
           "Display usage information"
        << endl;
+  cout << "  --optimize[=PASSES]          "
+          "Optimize modules with SPIRV-Tools before loading"
+       << endl;
   cout << "  -v --version                 "
           "Display version information"
        << endl;
@@ -204,14 +204,14 @@ public:
         // .SteppedCores = steppedCores,
     };
 
-    auto getOrDef = [](const PhyCoord &k) {
-      auto res = talvos::PipelineExecutor::Assignments.find(k);
-      return res == talvos::PipelineExecutor::Assignments.end() ? LogCoord{}
-                                                                : res->second;
+    auto &PE = CF.Device->getPipelineExecutor();
+    auto getOrDef = [&PE](const PhyCoord &k) {
+      auto res = PE.Assignments.find(k);
+      return res == PE.Assignments.end() ? LogCoord{} : res->second;
     };
 
     int n = 0;
-    for (const auto &[phyCoord, state] : talvos::PipelineExecutor::Lanes)
+    for (const auto &[phyCoord, state] : PE.Lanes)
     {
       assert(n < (sizeof(ret.LaneStates) / sizeof(ret.LaneStates[0])));
       steppedMask &=